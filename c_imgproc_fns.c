@@ -1,9 +1,63 @@
 // C implementations of image processing functions
 
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 #include "imgproc.h"
 
+// Number of histogram bins used per column by imgproc_median:
+// 256 bins for each of the red, green, and blue channels
+#define MEDIAN_HIST_SIZE (3 * 256)
+
+// Number of columns imgproc_erode and imgproc_dilate filter together
+// in their vertical pass
+#define MORPH_STRIP 64
+
+// Width and height of the tiles transposeImage copies one at a time
+#define TRANSPOSE_TILE 8
+
+// Number of sub-histograms imgproc_histogram spreads consecutive
+// pixels across
+#define STATS_SUB_HISTS 4
+
+// Number of fraction bits in the fixed-point color matrix coefficients
+#define COLOR_FRAC_BITS 14
+
+// Largest number of doublings imgproc_expand_n performs (2^30 is the
+// largest power of two an int32_t factor can hold)
+#define EXPAND_MAX_LEVELS 30
+
+// Color matrices used by colorMatrixPixel and colorMatrixImage. Each
+// holds 9 coefficients (row-major: one row per output component, one
+// column per input red/green/blue component) scaled by
+// 1 << COLOR_FRAC_BITS, 3 per-component offsets (which include the
+// rounding term), and the bias subtracted from the input green and
+// blue components (128 when converting from YCbCr).
+static const int32_t s_gray601[13] = {
+  4899, 9617, 1868,  4899, 9617, 1868,  4899, 9617, 1868,
+  8192, 8192, 8192,  0
+};
+static const int32_t s_gray709[13] = {
+  3483, 11718, 1183,  3483, 11718, 1183,  3483, 11718, 1183,
+  8192, 8192, 8192,  0
+};
+static const int32_t s_ycbcr601[13] = {
+  4899, 9617, 1868,  -2765, -5427, 8192,  8192, -6860, -1332,
+  8192, (128 << COLOR_FRAC_BITS) + 8192, (128 << COLOR_FRAC_BITS) + 8192,  0
+};
+static const int32_t s_ycbcr709[13] = {
+  3483, 11718, 1183,  -1877, -6315, 8192,  8192, -7441, -751,
+  8192, (128 << COLOR_FRAC_BITS) + 8192, (128 << COLOR_FRAC_BITS) + 8192,  0
+};
+static const int32_t s_rgb601[13] = {
+  16384, 0, 22970,  16384, -5638, -11700,  16384, 29032, 0,
+  8192, 8192, 8192,  128
+};
+static const int32_t s_rgb709[13] = {
+  16384, 0, 25802,  16384, -3069, -7670,  16384, 30402, 0,
+  8192, 8192, 8192,  128
+};
+
 //! Computes row number for given pixel in photo
 //! @param index index of pixel to calculate row number for
 //! @param width width of image
@@ -95,6 +149,370 @@ uint32_t quadAveragePixel(uint32_t pixel_one, uint32_t pixel_two, uint32_t pixel
   return createPixel(avg_red, avg_green, avg_blue, avg_alpha);
 }
 
+//! Adds delta to the red, green, and blue histogram bins of a pixel
+//! @param hist pointer to a MEDIAN_HIST_SIZE-entry histogram
+//! @param pixel pixel whose color components select the bins
+//! @param delta amount to add to each bin (1 to add the pixel, -1 to remove it)
+void histogramAddPixel(uint32_t *hist, uint32_t pixel, int32_t delta) {
+  hist[getRed(pixel)] += delta;
+  hist[256 + getGreen(pixel)] += delta;
+  hist[512 + getBlue(pixel)] += delta;
+}
+
+//! Adds (or removes) every pixel of one image row to the per-column
+//! histograms used by imgproc_median
+//! @param col_hist pointer to width consecutive MEDIAN_HIST_SIZE-entry histograms
+//! @param input_img pointer to image containing the row
+//! @param row row index of the pixels to add
+//! @param delta 1 to add the row's pixels, -1 to remove them
+void histogramAddRow(uint32_t *col_hist, struct Image *input_img, int row, int32_t delta) {
+  for (int j = 0; j < input_img->width; j++) {
+    histogramAddPixel(&col_hist[j * MEDIAN_HIST_SIZE], getPixel(input_img, row, j), delta);
+  }
+}
+
+//! Adds every bin of one MEDIAN_HIST_SIZE-entry histogram to another
+//! @param dst histogram to add to
+//! @param src histogram to add
+void histogramAdd(uint32_t *dst, const uint32_t *src) {
+  for (int i = 0; i < MEDIAN_HIST_SIZE; i++) {
+    dst[i] += src[i];
+  }
+}
+
+//! Subtracts every bin of one MEDIAN_HIST_SIZE-entry histogram from another
+//! @param dst histogram to subtract from
+//! @param src histogram to subtract
+void histogramSubtract(uint32_t *dst, const uint32_t *src) {
+  for (int i = 0; i < MEDIAN_HIST_SIZE; i++) {
+    dst[i] -= src[i];
+  }
+}
+
+//! Finds the median value of a single 256-bin channel histogram
+//! @param hist pointer to the 256 bins of one channel
+//! @param half half the number of values counted by the histogram
+//!             (rounded down)
+//! @return smallest value whose cumulative count exceeds half, i.e.
+//!         the value at index half of the sorted values
+uint32_t histogramMedian(const uint32_t *hist, uint32_t half) {
+  uint32_t count = 0;
+  for (uint32_t value = 0; value < 256; value++) {
+    count += hist[value];
+    if (count > half) {
+      return value;
+    }
+  }
+  return 255;
+}
+
+//! Returns a pixel whose RGBA values are the larger of the two input pixels
+//! @param pixel_one first pixel to compare
+//! @param pixel_two second pixel to compare
+//! @return pixel with the per-component maximum
+uint32_t maxPixel(uint32_t pixel_one, uint32_t pixel_two) {
+  uint32_t red = getRed(pixel_one) > getRed(pixel_two) ? getRed(pixel_one) : getRed(pixel_two);
+  uint32_t green = getGreen(pixel_one) > getGreen(pixel_two) ? getGreen(pixel_one) : getGreen(pixel_two);
+  uint32_t blue = getBlue(pixel_one) > getBlue(pixel_two) ? getBlue(pixel_one) : getBlue(pixel_two);
+  uint32_t alpha = getAlpha(pixel_one) > getAlpha(pixel_two) ? getAlpha(pixel_one) : getAlpha(pixel_two);
+
+  return createPixel(red, green, blue, alpha);
+}
+
+//! Runs one van Herk/Gil-Werman maximum filter pass along a line.
+//! Every element of the line is a group of lanes adjacent pixels, and
+//! each lane is filtered independently. The line is padded with dist
+//! zero elements at both ends and split into blocks of 2*dist+1
+//! elements; running maxima from the start (g) and end (h) of each block
+//! give the maximum of any window as max(h[x], g[x + 2*dist]), which is
+//! three comparisons per pixel no matter how large dist is. XORing
+//! every pixel with flip on the way in and out turns the maximum
+//! filter into a minimum filter when flip is 0xFFFFFFFF.
+//! @param src pointer to the first pixel of the source line
+//! @param dst pointer to the first pixel of the destination line
+//! @param n number of elements in the line
+//! @param stride number of pixels between consecutive elements
+//! @param lanes number of adjacent pixels in each element
+//! @param dist number of elements on either side included in each window
+//! @param flip 0 for a maximum filter, 0xFFFFFFFF for a minimum filter
+//! @param scratch room for 2 * lanes * (n + 2*dist) rounded up to a
+//!                multiple of 2*dist+1 pixels
+void morphPass(const uint32_t *src, uint32_t *dst, int32_t n, int32_t stride, int32_t lanes,
+               int32_t dist, uint32_t flip, uint32_t *scratch) {
+  int32_t k = 2 * dist + 1;
+  int32_t padded = (n + 2 * dist + k - 1) / k * k;
+  uint32_t *g = scratch;
+  uint32_t *h = scratch + padded * lanes;
+
+  // running maxima from the start of each block
+  for (int32_t p = 0; p < padded; p++) {
+    int32_t x = p - dist;
+    for (int32_t l = 0; l < lanes; l++) {
+      uint32_t value = (x >= 0 && x < n) ? src[x * stride + l] ^ flip : 0;
+      g[p * lanes + l] = (p % k == 0) ? value : maxPixel(g[(p - 1) * lanes + l], value);
+    }
+  }
+
+  // running maxima from the end of each block
+  for (int32_t p = padded - 1; p >= 0; p--) {
+    int32_t x = p - dist;
+    for (int32_t l = 0; l < lanes; l++) {
+      uint32_t value = (x >= 0 && x < n) ? src[x * stride + l] ^ flip : 0;
+      h[p * lanes + l] = (p % k == k - 1) ? value : maxPixel(h[(p + 1) * lanes + l], value);
+    }
+  }
+
+  // the window of element x covers padded elements x through x + 2*dist
+  for (int32_t x = 0; x < n; x++) {
+    for (int32_t l = 0; l < lanes; l++) {
+      dst[x * stride + l] = maxPixel(h[x * lanes + l], g[(x + 2 * dist) * lanes + l]) ^ flip;
+    }
+  }
+}
+
+//! Applies a maximum (flip = 0) or minimum (flip = 0xFFFFFFFF) filter
+//! to each color component over a square window, as a horizontal
+//! morphPass over each row followed by a vertical morphPass over
+//! strips of MORPH_STRIP columns
+//! @param input_img pointer to the input Image
+//! @param output_img pointer to the output Image
+//! @param dist number of pixels on either side included in each window
+//! @param flip 0 for a maximum filter, 0xFFFFFFFF for a minimum filter
+//! @return 1 if successful, 0 if the scratch buffers could not be allocated
+int morphFilter(struct Image *input_img, struct Image *output_img, int32_t dist, uint32_t flip) {
+  int rows = input_img->height;
+  int cols = input_img->width;
+
+  // a window wider than the image sees the same pixels as one that just covers it
+  int32_t longest = rows > cols ? rows : cols;
+  if (dist > longest) {
+    dist = longest;
+  }
+  int32_t k = 2 * dist + 1;
+  int32_t padded = (longest + 2 * dist + k - 1) / k * k;
+
+  uint32_t *tmp = malloc((size_t) rows * cols * sizeof(uint32_t));
+  uint32_t *scratch = malloc((size_t) padded * MORPH_STRIP * 2 * sizeof(uint32_t));
+  if (tmp == NULL || scratch == NULL) {
+    free(tmp);
+    free(scratch);
+    return 0;
+  }
+
+  // horizontal pass, one row at a time
+  for (int i = 0; i < rows; i++) {
+    morphPass(&input_img->data[i * cols], &tmp[i * cols], cols, 1, 1, dist, flip, scratch);
+  }
+
+  // vertical pass, a strip of adjacent columns at a time
+  for (int j = 0; j < cols; j += MORPH_STRIP) {
+    int lanes = cols - j < MORPH_STRIP ? cols - j : MORPH_STRIP;
+    morphPass(&tmp[j], &output_img->data[j], rows, cols, lanes, dist, flip, scratch);
+  }
+
+  // keep the original alpha values
+  for (int i = 0; i < rows * cols; i++) {
+    output_img->data[i] = (output_img->data[i] & ~0xFFU) | getAlpha(input_img->data[i]);
+  }
+
+  free(tmp);
+  free(scratch);
+  return 1;
+}
+
+//! Returns a pixel's luma (BT.601 weights in 8-bit fixed point)
+//! @param pixel pixel whose luma we are computing
+//! @return luma value between 0 and 255
+uint32_t lumaPixel(uint32_t pixel) {
+  return (77 * getRed(pixel) + 150 * getGreen(pixel) + 29 * getBlue(pixel)) >> 8;
+}
+
+//! Computes one imgproc_sobel output pixel, replicating the image's
+//! edge pixels for neighbours that lie outside the image
+//! @param input_img pointer to the input Image
+//! @param row row index of the pixel
+//! @param col column index of the pixel
+//! @return greyscale gradient magnitude pixel with the input pixel's alpha
+uint32_t sobelPixel(struct Image *input_img, int row, int col) {
+  int up = row > 0 ? row - 1 : 0;
+  int down = row + 1 < input_img->height ? row + 1 : input_img->height - 1;
+  int left = col > 0 ? col - 1 : 0;
+  int right = col + 1 < input_img->width ? col + 1 : input_img->width - 1;
+
+  int top_left = lumaPixel(getPixel(input_img, up, left));
+  int top = lumaPixel(getPixel(input_img, up, col));
+  int top_right = lumaPixel(getPixel(input_img, up, right));
+  int mid_left = lumaPixel(getPixel(input_img, row, left));
+  int mid_right = lumaPixel(getPixel(input_img, row, right));
+  int bottom_left = lumaPixel(getPixel(input_img, down, left));
+  int bottom = lumaPixel(getPixel(input_img, down, col));
+  int bottom_right = lumaPixel(getPixel(input_img, down, right));
+
+  int gx = (top_right + 2 * mid_right + bottom_right) - (top_left + 2 * mid_left + bottom_left);
+  int gy = (bottom_left + 2 * bottom + bottom_right) - (top_left + 2 * top + top_right);
+  uint32_t mag = abs(gx) + abs(gy);
+  if (mag > 255) {
+    mag = 255;
+  }
+
+  return createPixel(mag, mag, mag, getAlpha(getPixel(input_img, row, col)));
+}
+
+//! Copies the pixel at row i, column j of input_img to row j, column i
+//! of output_img (which must be input_img->height pixels wide and
+//! input_img->width pixels tall), optionally mirroring the output's
+//! rows and/or columns. The image is walked in TRANSPOSE_TILE x
+//! TRANSPOSE_TILE tiles so that the pixels written by one tile share
+//! a few cache lines instead of each landing on a different one.
+//! @param input_img pointer to the input Image
+//! @param output_img pointer to the output Image
+//! @param mirror_rows if nonzero, pixels from input column j go to
+//!                    output row width - 1 - j instead of row j
+//! @param mirror_cols if nonzero, pixels from input row i go to
+//!                    output column height - 1 - i instead of column i
+void transposeImage(struct Image *input_img, struct Image *output_img, int32_t mirror_rows, int32_t mirror_cols) {
+  int rows = input_img->height;
+  int cols = input_img->width;
+
+  for (int ti = 0; ti < rows; ti += TRANSPOSE_TILE) {
+    int i_end = ti + TRANSPOSE_TILE < rows ? ti + TRANSPOSE_TILE : rows;
+    for (int tj = 0; tj < cols; tj += TRANSPOSE_TILE) {
+      int j_end = tj + TRANSPOSE_TILE < cols ? tj + TRANSPOSE_TILE : cols;
+
+      for (int j = tj; j < j_end; j++) {
+        int out_row = mirror_rows ? cols - 1 - j : j;
+        for (int i = ti; i < i_end; i++) {
+          int out_col = mirror_cols ? rows - 1 - i : i;
+          output_img->data[out_row * rows + out_col] = input_img->data[i * cols + j];
+        }
+      }
+    }
+  }
+}
+
+//! Copies input_img to output_img (which must have the same
+//! dimensions), optionally mirroring its rows and/or columns
+//! @param input_img pointer to the input Image
+//! @param output_img pointer to the output Image
+//! @param mirror_rows if nonzero, row i goes to row height - 1 - i
+//! @param mirror_cols if nonzero, column j goes to column width - 1 - j
+void mirrorImage(struct Image *input_img, struct Image *output_img, int32_t mirror_rows, int32_t mirror_cols) {
+  int rows = input_img->height;
+  int cols = input_img->width;
+
+  for (int i = 0; i < rows; i++) {
+    const uint32_t *src = &input_img->data[i * cols];
+    uint32_t *dst = &output_img->data[(mirror_rows ? rows - 1 - i : i) * cols];
+    if (mirror_cols) {
+      for (int j = 0; j < cols; j++) {
+        dst[cols - 1 - j] = src[j];
+      }
+    } else {
+      memcpy(dst, src, cols * sizeof(uint32_t));
+    }
+  }
+}
+
+//! Selects the color matrix for a video standard
+//! @param standard 601 (BT.601) or 709 (BT.709)
+//! @param bt601 matrix to use for BT.601
+//! @param bt709 matrix to use for BT.709
+//! @return the selected matrix, or NULL if standard is not 601 or 709
+const int32_t *colorMatrixFor(int32_t standard, const int32_t *bt601, const int32_t *bt709) {
+  if (standard == 601) {
+    return bt601;
+  } else if (standard == 709) {
+    return bt709;
+  }
+  return NULL;
+}
+
+//! Multiplies a pixel's red, green, and blue components by a color
+//! matrix, clamping each result to 0..255
+//! @param pixel pixel to convert
+//! @param matrix 13-entry color matrix (see s_gray601)
+//! @return converted pixel with the input pixel's alpha
+uint32_t colorMatrixPixel(uint32_t pixel, const int32_t *matrix) {
+  int32_t in[3] = { getRed(pixel), getGreen(pixel) - matrix[12], getBlue(pixel) - matrix[12] };
+  uint32_t out[3];
+
+  for (int c = 0; c < 3; c++) {
+    int32_t value = (matrix[3 * c] * in[0] + matrix[3 * c + 1] * in[1]
+                     + matrix[3 * c + 2] * in[2] + matrix[9 + c]) >> COLOR_FRAC_BITS;
+    out[c] = value < 0 ? 0 : (value > 255 ? 255 : value);
+  }
+
+  return createPixel(out[0], out[1], out[2], getAlpha(pixel));
+}
+
+//! Converts every pixel of input_img with colorMatrixPixel, storing
+//! the results in output_img (which must have the same dimensions)
+//! @param input_img pointer to the input Image
+//! @param output_img pointer to the output Image
+//! @param matrix 13-entry color matrix (see s_gray601)
+void colorMatrixImage(struct Image *input_img, struct Image *output_img, const int32_t *matrix) {
+  int n = input_img->width * input_img->height;
+  for (int i = 0; i < n; i++) {
+    output_img->data[i] = colorMatrixPixel(input_img->data[i], matrix);
+  }
+}
+
+//! Computes one row of the imgproc_expand result: the 2 * in_w output
+//! pixels expanded from the input row above, and, for odd output rows,
+//! the input row below it (NULL at the bottom edge). Averaging a row
+//! with itself leaves it unchanged, so a missing row below (or a
+//! missing column to the right) just repeats the pixels already used.
+//! @param above input row floor(i/2)
+//! @param below input row floor(i/2) + 1, or NULL for even output rows
+//!              and odd output rows at the bottom edge
+//! @param in_w number of pixels in each input row
+//! @param out_row output row (2 * in_w pixels)
+void expandRow(const uint32_t *above, const uint32_t *below, int32_t in_w, uint32_t *out_row) {
+  if (below == NULL) {
+    below = above;
+  }
+  for (int32_t j = 0; j < in_w; j++) {
+    int32_t right = j + 1 < in_w ? j + 1 : j;
+    out_row[2 * j] = createAveragePixel(above[j], below[j]);
+    out_row[2 * j + 1] = quadAveragePixel(above[j], above[right], below[j], below[right]);
+  }
+}
+
+//! Finds a row of one of the images imgproc_expand_n would produce by
+//! repeatedly calling imgproc_expand. Level 0 is the input image itself,
+//! the rows of levels 1 and up live in a two-row buffer per level (rows
+//! with even indices in the first slot, odd ones in the second).
+//! @param input_img pointer to the input Image
+//! @param rows buffers of the intermediate levels, one after the other
+//! @param level number of expansions of the image the row belongs to
+//! @param row index of the row in that image
+//! @return pointer to the pixels of the row
+uint32_t *expandLevelRow(struct Image *input_img, uint32_t *rows, int32_t level, int32_t row) {
+  if (level == 0) {
+    return &input_img->data[row * input_img->width];
+  }
+  // levels 1 .. level-1 take up 2 * width * (2 + 4 + ... + 2^(level-1))
+  // pixels in front of this level's two rows
+  return &rows[input_img->width * (((2 + (row & 1)) << level) - 4)];
+}
+
+//! Computes a row of an expansion level from the level before it
+//! (see expandLevelRow).
+//! @param input_img pointer to the input Image
+//! @param rows buffers of the intermediate levels
+//! @param level level of the row to compute; must be at least 1
+//! @param row index of the row to compute
+//! @param out_row where to store the row
+void expandLevelNext(struct Image *input_img, uint32_t *rows, int32_t level, int32_t row, uint32_t *out_row) {
+  int32_t src_height = input_img->height << (level - 1);
+  const uint32_t *above = expandLevelRow(input_img, rows, level - 1, row / 2);
+  const uint32_t *below = NULL;
+  if (row % 2 != 0 && row / 2 + 1 < src_height) {
+    below = expandLevelRow(input_img, rows, level - 1, row / 2 + 1);
+  }
+  expandRow(above, below, input_img->width << (level - 1), out_row);
+}
+
 //! Transform the entire image by shrinking it down both 
 //! horizontally and vertically (by potentially different
 //! factors). This is equivalent to sampling the orignal image
@@ -350,4 +768,643 @@ void imgproc_expand( struct Image *input_img, struct Image *output_img) {
       output_img->data[i] = pixel_original;
     }
   }
-}
\ No newline at end of file
+}
+
+//! Transform the input image using a median filter.
+//!
+//! Each pixel of the output image has each of its color components
+//! set to the median of that component over the pixels within
+//! median_dist pixels horizontally and vertically of the pixel's
+//! location in the original image. As with imgproc_blur, pixel
+//! positions outside the image are ignored, and the alpha value of
+//! each output pixel is identical to the corresponding input pixel.
+//! When the window holds an even number of pixels, the upper of the
+//! two middle values is used.
+//!
+//! Runs in constant time per pixel regardless of median_dist: every
+//! column keeps a histogram of the pixels in the window's rows, and
+//! the window's histogram is slid along each row by adding the
+//! column entering on the right and removing the column leaving on
+//! the left (Perreault and Hebert's algorithm).
+//!
+//! @param input_img pointer to the input Image
+//! @param output_img pointer to the output Image (in which the
+//!                   transformed pixels should be stored)
+//! @param median_dist all pixels whose x/y coordinates are within
+//!                    this many pixels of the x/y coordinates of the
+//!                    original pixel are included in the medians;
+//!                    must not be negative
+//! @return 1 if successful, 0 if the histograms could not be allocated
+int imgproc_median( struct Image *input_img, struct Image *output_img, int32_t median_dist ) {
+  int rows = input_img->height;
+  int cols = input_img->width;
+
+  // one histogram per column plus one for the whole window
+  uint32_t *col_hist = calloc((size_t) cols * MEDIAN_HIST_SIZE, sizeof(uint32_t));
+  uint32_t *kernel_hist = malloc(MEDIAN_HIST_SIZE * sizeof(uint32_t));
+  if (col_hist == NULL || kernel_hist == NULL) {
+    free(col_hist);
+    free(kernel_hist);
+    return 0;
+  }
+
+  // column histograms start out covering the window of row 0
+  for (int k = 0; k <= median_dist && k < rows; k++) {
+    histogramAddRow(col_hist, input_img, k, 1);
+  }
+
+  for (int i = 0; i < rows; i++) {
+    // slide the column histograms down one row
+    if (i > 0) {
+      if (i - median_dist - 1 >= 0) {
+        histogramAddRow(col_hist, input_img, i - median_dist - 1, -1);
+      }
+      if (i + median_dist < rows) {
+        histogramAddRow(col_hist, input_img, i + median_dist, 1);
+      }
+    }
+
+    int top = i - median_dist < 0 ? 0 : i - median_dist;
+    int bottom = i + median_dist >= rows ? rows - 1 : i + median_dist;
+    int win_rows = bottom - top + 1;
+
+    // window histogram starts out covering the window of column 0
+    memset(kernel_hist, 0, MEDIAN_HIST_SIZE * sizeof(uint32_t));
+    for (int l = 0; l <= median_dist && l < cols; l++) {
+      histogramAdd(kernel_hist, &col_hist[l * MEDIAN_HIST_SIZE]);
+    }
+
+    for (int j = 0; j < cols; j++) {
+      // slide the window histogram right one column
+      if (j > 0) {
+        if (j + median_dist < cols) {
+          histogramAdd(kernel_hist, &col_hist[(j + median_dist) * MEDIAN_HIST_SIZE]);
+        }
+        if (j - median_dist - 1 >= 0) {
+          histogramSubtract(kernel_hist, &col_hist[(j - median_dist - 1) * MEDIAN_HIST_SIZE]);
+        }
+      }
+
+      int left = j - median_dist < 0 ? 0 : j - median_dist;
+      int right = j + median_dist >= cols ? cols - 1 : j + median_dist;
+      uint32_t half = (uint32_t) (win_rows * (right - left + 1)) / 2;
+
+      int pos = i * cols + j;
+      uint32_t r = histogramMedian(kernel_hist, half);
+      uint32_t g = histogramMedian(kernel_hist + 256, half);
+      uint32_t b = histogramMedian(kernel_hist + 512, half);
+      output_img->data[pos] = createPixel(r, g, b, getAlpha(input_img->data[pos]));
+    }
+  }
+
+  free(col_hist);
+  free(kernel_hist);
+  return 1;
+}
+
+//! Transform the input image by eroding it: each color component of
+//! an output pixel is the minimum of that component over the pixels
+//! within dist pixels horizontally and vertically of its location.
+//!
+//! The window is the same square of pixels used by imgproc_blur:
+//! pixel positions outside the image are ignored, and the alpha value
+//! of each output pixel is identical to the corresponding input pixel.
+//! Runs in time independent of dist (see morphPass).
+//!
+//! @param input_img pointer to the input Image
+//! @param output_img pointer to the output Image (in which the
+//!                   transformed pixels should be stored)
+//! @param dist all pixels whose x/y coordinates are within this many
+//!             pixels of the x/y coordinates of the original pixel are
+//!             considered; must not be negative
+//! @return 1 if successful, 0 if the scratch buffers could not be allocated
+int imgproc_erode( struct Image *input_img, struct Image *output_img, int32_t dist ) {
+  return morphFilter(input_img, output_img, dist, 0xFFFFFFFF);
+}
+
+//! Transform the input image by dilating it: each color component of
+//! an output pixel is the maximum of that component over the pixels
+//! within dist pixels horizontally and vertically of its location.
+//!
+//! The window is the same square of pixels used by imgproc_blur:
+//! pixel positions outside the image are ignored, and the alpha value
+//! of each output pixel is identical to the corresponding input pixel.
+//! Runs in time independent of dist (see morphPass).
+//!
+//! @param input_img pointer to the input Image
+//! @param output_img pointer to the output Image (in which the
+//!                   transformed pixels should be stored)
+//! @param dist all pixels whose x/y coordinates are within this many
+//!             pixels of the x/y coordinates of the original pixel are
+//!             considered; must not be negative
+//! @return 1 if successful, 0 if the scratch buffers could not be allocated
+int imgproc_dilate( struct Image *input_img, struct Image *output_img, int32_t dist ) {
+  return morphFilter(input_img, output_img, dist, 0);
+}
+
+//! Transform the input image into a map of its edges using the Sobel
+//! operator.
+//!
+//! The horizontal and vertical Sobel gradients gx and gy are computed
+//! over the 3x3 neighbourhood of each pixel's luma (see lumaPixel),
+//! with pixels outside the image replaced by the nearest edge pixel.
+//! Each output pixel is grey with all three color components equal
+//! to |gx| + |gy|, capped at 255, and the alpha value of the
+//! corresponding input pixel.
+//!
+//! Interior pixels use the separable form of the operator: for every
+//! column of the 3-row window, s = top + 2*middle + bottom and
+//! d = bottom - top are computed once from the packed pixels and then
+//! shared by the three output pixels that use that column, so
+//! gx = s[right] - s[left] and gy = d[left] + 2*d[center] + d[right].
+//! Border pixels are computed individually by sobelPixel.
+//!
+//! @param input_img pointer to the input Image
+//! @param output_img pointer to the output Image (in which the
+//!                   transformed pixels should be stored)
+void imgproc_sobel( struct Image *input_img, struct Image *output_img ) {
+  int rows = input_img->height;
+  int cols = input_img->width;
+
+  for (int i = 0; i < rows; i++) {
+    // border rows, and the rows of images too narrow to have an interior
+    if (i == 0 || i == rows - 1 || cols < 3) {
+      for (int j = 0; j < cols; j++) {
+        output_img->data[i * cols + j] = sobelPixel(input_img, i, j);
+      }
+      continue;
+    }
+
+    const uint32_t *top = &input_img->data[(i - 1) * cols];
+    const uint32_t *mid = &input_img->data[i * cols];
+    const uint32_t *bottom = &input_img->data[(i + 1) * cols];
+
+    output_img->data[i * cols] = sobelPixel(input_img, i, 0);
+
+    // column sums (s) and differences (d) for columns j - 1 and j
+    int s_left = lumaPixel(top[0]) + 2 * lumaPixel(mid[0]) + lumaPixel(bottom[0]);
+    int d_left = lumaPixel(bottom[0]) - lumaPixel(top[0]);
+    int s_center = lumaPixel(top[1]) + 2 * lumaPixel(mid[1]) + lumaPixel(bottom[1]);
+    int d_center = lumaPixel(bottom[1]) - lumaPixel(top[1]);
+
+    for (int j = 1; j < cols - 1; j++) {
+      int s_right = lumaPixel(top[j + 1]) + 2 * lumaPixel(mid[j + 1]) + lumaPixel(bottom[j + 1]);
+      int d_right = lumaPixel(bottom[j + 1]) - lumaPixel(top[j + 1]);
+
+      int gx = s_right - s_left;
+      int gy = d_left + 2 * d_center + d_right;
+      uint32_t mag = abs(gx) + abs(gy);
+      if (mag > 255) {
+        mag = 255;
+      }
+      output_img->data[i * cols + j] = createPixel(mag, mag, mag, getAlpha(mid[j]));
+
+      s_left = s_center;
+      d_left = d_center;
+      s_center = s_right;
+      d_center = d_right;
+    }
+
+    output_img->data[i * cols + cols - 1] = sobelPixel(input_img, i, cols - 1);
+  }
+}
+
+//! Transform the input image by transposing it: the pixel at row i,
+//! column j of the input image becomes the pixel at row j, column i
+//! of the output image, which is as wide as the input image is tall
+//! and vice versa.
+//!
+//! @param input_img pointer to the input Image
+//! @param output_img pointer to the output Image (in which the
+//!                   transformed pixels should be stored)
+void imgproc_transpose( struct Image *input_img, struct Image *output_img ) {
+  transposeImage(input_img, output_img, 0, 0);
+}
+
+//! Transform the input image by rotating it clockwise by 90, 180 or
+//! 270 degrees. For 90 and 270 degrees, the output image is as wide as
+//! the input image is tall and vice versa.
+//!
+//! @param input_img pointer to the input Image
+//! @param output_img pointer to the output Image (in which the
+//!                   transformed pixels should be stored)
+//! @param degrees clockwise rotation: 90, 180 or 270
+//! @return 1 if successful, 0 if degrees is not one of the allowed values
+int imgproc_rotate( struct Image *input_img, struct Image *output_img, int32_t degrees ) {
+  if (degrees == 90) {
+    // input row i becomes output column height - 1 - i
+    transposeImage(input_img, output_img, 0, 1);
+  } else if (degrees == 180) {
+    mirrorImage(input_img, output_img, 1, 1);
+  } else if (degrees == 270) {
+    // input column j becomes output row width - 1 - j
+    transposeImage(input_img, output_img, 1, 0);
+  } else {
+    return 0;
+  }
+  return 1;
+}
+
+//! Transform the input image by flipping it, either horizontally
+//! (mirroring left and right) or vertically (mirroring top and bottom).
+//!
+//! @param input_img pointer to the input Image
+//! @param output_img pointer to the output Image (in which the
+//!                   transformed pixels should be stored)
+//! @param horizontal nonzero to flip horizontally, 0 to flip vertically
+void imgproc_flip( struct Image *input_img, struct Image *output_img, int32_t horizontal ) {
+  if (horizontal) {
+    mirrorImage(input_img, output_img, 0, 1);
+  } else {
+    mirrorImage(input_img, output_img, 1, 0);
+  }
+}
+
+//! Transform the input image to greyscale: every color component of
+//! an output pixel is set to the luma of the corresponding input pixel
+//! computed with the BT.601 or BT.709 weights. Alpha values are kept.
+//!
+//! @param input_img pointer to the input Image
+//! @param output_img pointer to the output Image (in which the
+//!                   transformed pixels should be stored)
+//! @param standard 601 or 709
+//! @return 1 if successful, 0 if standard is not 601 or 709
+int imgproc_grayscale( struct Image *input_img, struct Image *output_img, int32_t standard ) {
+  const int32_t *matrix = colorMatrixFor(standard, s_gray601, s_gray709);
+  if (matrix == NULL) {
+    return 0;
+  }
+  colorMatrixImage(input_img, output_img, matrix);
+  return 1;
+}
+
+//! Transform the input image from RGB to full-range YCbCr using the
+//! BT.601 or BT.709 matrix. Each output pixel stores Y in its red
+//! component, Cb in its green component, and Cr in its blue component;
+//! alpha values are kept.
+//!
+//! @param input_img pointer to the input Image
+//! @param output_img pointer to the output Image (in which the
+//!                   transformed pixels should be stored)
+//! @param standard 601 or 709
+//! @return 1 if successful, 0 if standard is not 601 or 709
+int imgproc_rgb_to_ycbcr( struct Image *input_img, struct Image *output_img, int32_t standard ) {
+  const int32_t *matrix = colorMatrixFor(standard, s_ycbcr601, s_ycbcr709);
+  if (matrix == NULL) {
+    return 0;
+  }
+  colorMatrixImage(input_img, output_img, matrix);
+  return 1;
+}
+
+//! Transform the input image from full-range YCbCr (packed as by
+//! imgproc_rgb_to_ycbcr) back to RGB using the BT.601 or BT.709
+//! matrix. Alpha values are kept.
+//!
+//! @param input_img pointer to the input Image
+//! @param output_img pointer to the output Image (in which the
+//!                   transformed pixels should be stored)
+//! @param standard 601 or 709
+//! @return 1 if successful, 0 if standard is not 601 or 709
+int imgproc_ycbcr_to_rgb( struct Image *input_img, struct Image *output_img, int32_t standard ) {
+  const int32_t *matrix = colorMatrixFor(standard, s_rgb601, s_rgb709);
+  if (matrix == NULL) {
+    return 0;
+  }
+  colorMatrixImage(input_img, output_img, matrix);
+  return 1;
+}
+
+//! Convert the input image to planar full-range YCbCr, as consumed by
+//! video encoders.
+//!
+//! The Y plane always has one byte per pixel, stored row by row. If
+//! subsample is 0 the Cb and Cr planes are the same size (4:4:4);
+//! otherwise they are subsampled 4:2:0, with (width + 1) / 2 columns
+//! and (height + 1) / 2 rows, each chroma sample being the average of
+//! a 2x2 block of converted pixels. Blocks cut off by the right or
+//! bottom edge of an odd-sized image average only the pixels inside
+//! it, exactly as imgproc_expand does (using quadAveragePixel).
+//!
+//! @param input_img pointer to the input Image
+//! @param y_plane buffer receiving width * height Y samples
+//! @param cb_plane buffer receiving the Cb samples
+//! @param cr_plane buffer receiving the Cr samples
+//! @param standard 601 or 709
+//! @param subsample nonzero for 4:2:0 chroma planes, 0 for 4:4:4
+//! @return 1 if successful, 0 if standard is not 601 or 709
+int imgproc_ycbcr_planes( struct Image *input_img, uint8_t *y_plane, uint8_t *cb_plane, uint8_t *cr_plane,
+                          int32_t standard, int32_t subsample ) {
+  const int32_t *matrix = colorMatrixFor(standard, s_ycbcr601, s_ycbcr709);
+  if (matrix == NULL) {
+    return 0;
+  }
+
+  int rows = input_img->height;
+  int cols = input_img->width;
+
+  for (int i = 0; i < rows * cols; i++) {
+    uint32_t ycc = colorMatrixPixel(input_img->data[i], matrix);
+    y_plane[i] = getRed(ycc);
+    if (!subsample) {
+      cb_plane[i] = getGreen(ycc);
+      cr_plane[i] = getBlue(ycc);
+    }
+  }
+
+  if (subsample) {
+    int chroma_rows = (rows + 1) / 2;
+    int chroma_cols = (cols + 1) / 2;
+    for (int i = 0; i < chroma_rows; i++) {
+      int top = 2 * i;
+      int bottom = top + 1 < rows ? top + 1 : top;
+      for (int j = 0; j < chroma_cols; j++) {
+        int left = 2 * j;
+        int right = left + 1 < cols ? left + 1 : left;
+
+        // repeating the edge pixels makes quadAveragePixel average
+        // just the pixels inside the image
+        uint32_t avg = quadAveragePixel(colorMatrixPixel(getPixel(input_img, top, left), matrix),
+                                        colorMatrixPixel(getPixel(input_img, top, right), matrix),
+                                        colorMatrixPixel(getPixel(input_img, bottom, left), matrix),
+                                        colorMatrixPixel(getPixel(input_img, bottom, right), matrix));
+        cb_plane[i * chroma_cols + j] = getGreen(avg);
+        cr_plane[i * chroma_cols + j] = getBlue(avg);
+      }
+    }
+  }
+
+  return 1;
+}
+
+//! Compute 256-bin histograms of the red, green, blue, and alpha
+//! components of the input image in a single pass over its pixels.
+//!
+//! hist[c * 256 + v] is set to the number of pixels whose component c
+//! (0 = red, 1 = green, 2 = blue, 3 = alpha) equals v. Consecutive
+//! pixels are counted in STATS_SUB_HISTS separate sub-histograms that
+//! are summed at the end, so that runs of similar pixels do not make
+//! each increment wait for the previous one to the same bin.
+//!
+//! @param input_img pointer to the input Image
+//! @param hist array of 4 * 256 counts to fill in
+void imgproc_histogram( struct Image *input_img, uint32_t *hist ) {
+  uint32_t sub[STATS_SUB_HISTS][4 * 256];
+  memset(sub, 0, sizeof(sub));
+
+  int n = input_img->width * input_img->height;
+  for (int i = 0; i < n; i++) {
+    uint32_t pixel = input_img->data[i];
+    uint32_t *h = sub[i % STATS_SUB_HISTS];
+    h[getRed(pixel)]++;
+    h[256 + getGreen(pixel)]++;
+    h[512 + getBlue(pixel)]++;
+    h[768 + getAlpha(pixel)]++;
+  }
+
+  for (int b = 0; b < 4 * 256; b++) {
+    hist[b] = 0;
+    for (int k = 0; k < STATS_SUB_HISTS; k++) {
+      hist[b] += sub[k][b];
+    }
+  }
+}
+
+//! Transform the input image by passing the red, green, and blue
+//! components of every pixel through a lookup table. Alpha values
+//! are kept.
+//!
+//! @param input_img pointer to the input Image
+//! @param output_img pointer to the output Image (in which the
+//!                   transformed pixels should be stored)
+//! @param lut 3 * 256 entry table: lut[v], lut[256 + v] and
+//!            lut[512 + v] replace red, green and blue values of v
+void imgproc_apply_lut( struct Image *input_img, struct Image *output_img, const uint8_t *lut ) {
+  int n = input_img->width * input_img->height;
+  for (int i = 0; i < n; i++) {
+    uint32_t pixel = input_img->data[i];
+    output_img->data[i] = createPixel(lut[getRed(pixel)], lut[256 + getGreen(pixel)],
+                                      lut[512 + getBlue(pixel)], getAlpha(pixel));
+  }
+}
+
+//! Build the lookup table imgproc_autolevels applies: each of the
+//! red, green, and blue channels is stretched linearly so that its
+//! lowest value present maps to 0 and its highest to 255. A channel
+//! with a single value is left unchanged.
+//!
+//! @param hist histograms computed by imgproc_histogram
+//! @param lut 3 * 256 entry table to fill in (see imgproc_apply_lut)
+void imgproc_autolevels_lut( const uint32_t *hist, uint8_t *lut ) {
+  for (int c = 0; c < 3; c++) {
+    const uint32_t *h = &hist[c * 256];
+    int lo = 0, hi = 255;
+    while (lo < 255 && h[lo] == 0) {
+      lo++;
+    }
+    while (hi > 0 && h[hi] == 0) {
+      hi--;
+    }
+
+    for (int v = 0; v < 256; v++) {
+      if (hi <= lo) {
+        lut[c * 256 + v] = v;
+      } else if (v <= lo) {
+        lut[c * 256 + v] = 0;
+      } else if (v >= hi) {
+        lut[c * 256 + v] = 255;
+      } else {
+        lut[c * 256 + v] = ((v - lo) * 255 + (hi - lo) / 2) / (hi - lo);
+      }
+    }
+  }
+}
+
+//! Build the lookup table imgproc_equalize applies: each value of
+//! the red, green, and blue channels maps to its rounded position in
+//! the channel's cumulative distribution, scaled so that the lowest
+//! value present maps to 0 and the highest to 255. A channel with a
+//! single value is left unchanged.
+//!
+//! @param hist histograms computed by imgproc_histogram
+//! @param lut 3 * 256 entry table to fill in (see imgproc_apply_lut)
+void imgproc_equalize_lut( const uint32_t *hist, uint8_t *lut ) {
+  for (int c = 0; c < 3; c++) {
+    const uint32_t *h = &hist[c * 256];
+    uint64_t total = 0, cdf_min = 0;
+    for (int v = 0; v < 256; v++) {
+      if (cdf_min == 0) {
+        cdf_min = h[v];
+      }
+      total += h[v];
+    }
+
+    uint64_t cdf = 0;
+    for (int v = 0; v < 256; v++) {
+      cdf += h[v];
+      if (total == cdf_min) {
+        lut[c * 256 + v] = v;
+      } else if (cdf < cdf_min) {
+        lut[c * 256 + v] = 0;
+      } else {
+        lut[c * 256 + v] = ((cdf - cdf_min) * 255 + (total - cdf_min) / 2) / (total - cdf_min);
+      }
+    }
+  }
+}
+
+//! Transform the input image by stretching the contrast of each of
+//! its red, green, and blue channels to the full 0..255 range (see
+//! imgproc_autolevels_lut). Alpha values are kept.
+//!
+//! @param input_img pointer to the input Image
+//! @param output_img pointer to the output Image (in which the
+//!                   transformed pixels should be stored)
+void imgproc_autolevels( struct Image *input_img, struct Image *output_img ) {
+  uint32_t hist[4 * 256];
+  uint8_t lut[3 * 256];
+  imgproc_histogram(input_img, hist);
+  imgproc_autolevels_lut(hist, lut);
+  imgproc_apply_lut(input_img, output_img, lut);
+}
+
+//! Transform the input image by equalizing the histogram of each of
+//! its red, green, and blue channels (see imgproc_equalize_lut).
+//! Alpha values are kept.
+//!
+//! @param input_img pointer to the input Image
+//! @param output_img pointer to the output Image (in which the
+//!                   transformed pixels should be stored)
+void imgproc_equalize( struct Image *input_img, struct Image *output_img ) {
+  uint32_t hist[4 * 256];
+  uint8_t lut[3 * 256];
+  imgproc_histogram(input_img, hist);
+  imgproc_equalize_lut(hist, lut);
+  imgproc_apply_lut(input_img, output_img, lut);
+}
+
+//! Transform the input image by shrinking it down both
+//! horizontally and vertically like imgproc_squash, but instead of
+//! sampling one pixel of each xfac x yfac block of input pixels,
+//! each output pixel is the average of the whole block. This
+//! avoids the aliasing of imgproc_squash without blurring the
+//! full-size image first.
+//!
+//! The output image is input_img->width / xfac pixels wide and
+//! input_img->height / yfac pixels tall; input pixels in partial
+//! blocks at the right and bottom edges are ignored. As in
+//! imgproc_expand, every component (including alpha) is averaged
+//! using purely integer arithmetic with no rounding. The input is
+//! read once, one row at a time, while a row of per-block sums is
+//! accumulated.
+//!
+//! @param input_img pointer to the input Image
+//! @param output_img pointer to the output Image (in which the
+//!                   transformed pixels should be stored)
+//! @param xfac factor to downsize the image horizontally; must be positive
+//! @param yfac factor to downsize the image vertically; must be positive
+//! @return 1 if successful, 0 if the block sums could not be allocated
+int imgproc_squash_avg( struct Image *input_img, struct Image *output_img, int32_t xfac, int32_t yfac ) {
+  int out_w = output_img->width;
+  int out_h = output_img->height;
+  uint32_t count = xfac * yfac;
+
+  // red, green, blue, and alpha sums for each block of the current output row
+  uint32_t *sums = malloc(((size_t) out_w * 4 + 1) * sizeof(uint32_t));
+  if (sums == NULL) {
+    return 0;
+  }
+
+  for (int i = 0; i < out_h; i++) {
+    memset(sums, 0, (size_t) out_w * 4 * sizeof(uint32_t));
+    for (int r = i * yfac; r < (i + 1) * yfac; r++) {
+      const uint32_t *row = &input_img->data[r * input_img->width];
+      for (int j = 0; j < out_w; j++) {
+        for (int k = 0; k < xfac; k++) {
+          uint32_t pixel = row[j * xfac + k];
+          sums[4 * j] += getRed(pixel);
+          sums[4 * j + 1] += getGreen(pixel);
+          sums[4 * j + 2] += getBlue(pixel);
+          sums[4 * j + 3] += getAlpha(pixel);
+        }
+      }
+    }
+
+    for (int j = 0; j < out_w; j++) {
+      output_img->data[i * out_w + j] = createPixel(sums[4 * j] / count, sums[4 * j + 1] / count,
+                                                    sums[4 * j + 2] / count, sums[4 * j + 3] / count);
+    }
+  }
+
+  free(sums);
+  return 1;
+}
+
+//! Transform the input image by expanding it by a factor of n (a
+//! power of two) both horizontally and vertically. The result is
+//! exactly the image produced by calling imgproc_expand log2(n)
+//! times in a row, but the intermediate images are never stored
+//! in full: each output row is computed as soon as the (at most
+//! two) rows of each intermediate image it depends on are known,
+//! keeping only two rows of every intermediate image. Each output
+//! pixel is written exactly once.
+//!
+//! @param input_img pointer to the input Image
+//! @param output_img pointer to the output Image (in which the
+//!                   transformed pixels should be stored); must be
+//!                   n times as wide and as tall as input_img
+//! @param n expansion factor; must be a power of two of at least 2
+//! @return 1 if successful, 0 if n is not a valid factor or the
+//!         intermediate rows could not be allocated
+int imgproc_expand_n( struct Image *input_img, struct Image *output_img, int32_t n ) {
+  int32_t levels = 0;
+  while (levels < EXPAND_MAX_LEVELS && (1 << levels) < n) {
+    levels++;
+  }
+  if (n < 2 || (1 << levels) != n) {
+    return 0;
+  }
+
+  // two rows for each of the levels 1 .. levels-1 (see expandLevelRow)
+  size_t num_rows_pixels = (size_t) input_img->width * ((2u << levels) - 4);
+  uint32_t *rows = malloc((num_rows_pixels + 1) * sizeof(uint32_t));
+  if (rows == NULL) {
+    return 0;
+  }
+
+  // index of the row held by each slot of each level (-1 if none yet)
+  int32_t cached[EXPAND_MAX_LEVELS + 1][2];
+  // range of rows of each level the current output row depends on
+  int32_t lo[EXPAND_MAX_LEVELS + 1], hi[EXPAND_MAX_LEVELS + 1];
+  for (int32_t k = 0; k <= EXPAND_MAX_LEVELS; k++) {
+    cached[k][0] = cached[k][1] = -1;
+  }
+
+  for (int32_t i = 0; i < output_img->height; i++) {
+    // each row depends on at most two consecutive rows of the level
+    // below it, so every level needs at most two consecutive rows
+    lo[levels] = hi[levels] = i;
+    for (int32_t k = levels; k > 1; k--) {
+      lo[k - 1] = lo[k] / 2;
+      hi[k - 1] = hi[k] / 2;
+      if (hi[k] % 2 != 0 && hi[k] / 2 + 1 < (input_img->height << (k - 1))) {
+        hi[k - 1]++;
+      }
+    }
+
+    // bring the intermediate levels up to date from the bottom up
+    for (int32_t k = 1; k < levels; k++) {
+      for (int32_t r = lo[k]; r <= hi[k]; r++) {
+        if (cached[k][r & 1] != r) {
+          cached[k][r & 1] = r;
+          expandLevelNext(input_img, rows, k, r, expandLevelRow(input_img, rows, k, r));
+        }
+      }
+    }
+
+    expandLevelNext(input_img, rows, levels, i, &output_img->data[i * output_img->width]);
+  }
+
+  free(rows);
+  return 1;
+}
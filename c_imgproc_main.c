@@ -5,37 +5,129 @@
 #include <stdbool.h>
 #include <string.h>
 #include <assert.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 #include "imgproc.h"
+#include "imgstats.h"
+#include "imghash.h"
+#include "imgtile.h"
+#include "imgtilestore.h"
+#include "imgparallel.h"
 
 struct Transformation {
   const char *name;
   int (*apply)( struct Image *input_img, struct Image *output_img, int argc, char **argv );
   int (*out_dimensions)( struct Image *input_img, int argc, char **argv, int32_t *out_w, int32_t *out_h );
+  // optional: for transformations that just apply a lookup table,
+  // builds the table so that it can be applied while writing
+  void (*build_lut)( struct Image *input_img, uint8_t *lut );
 };
 
+// Environment variable naming the job log file (see log_job)
+#define JOB_LOG_ENV "IMGPROC_JOB_LOG"
+
+int run_transformation( int argc, char **argv );
+void log_job( int argc, char **argv, const struct Image *input_img, const struct Image *output_img,
+              double read_time, double apply_time, double write_time, int success );
+
 int apply_squash( struct Image *input_img, struct Image *output_img, int argc, char **argv );
+int apply_squash_avg( struct Image *input_img, struct Image *output_img, int argc, char **argv );
 int apply_rot( struct Image *input_img, struct Image *output_img, int argc, char **argv );
 int apply_blur( struct Image *input_img, struct Image *output_img, int argc, char **argv );
 int apply_expand( struct Image *input_img, struct Image *output_img, int argc, char **argv );
+int apply_median( struct Image *input_img, struct Image *output_img, int argc, char **argv );
+int apply_erode( struct Image *input_img, struct Image *output_img, int argc, char **argv );
+int apply_dilate( struct Image *input_img, struct Image *output_img, int argc, char **argv );
+int apply_sobel( struct Image *input_img, struct Image *output_img, int argc, char **argv );
+int apply_transpose( struct Image *input_img, struct Image *output_img, int argc, char **argv );
+int apply_rotate( struct Image *input_img, struct Image *output_img, int argc, char **argv );
+int apply_flip( struct Image *input_img, struct Image *output_img, int argc, char **argv );
+int apply_grayscale( struct Image *input_img, struct Image *output_img, int argc, char **argv );
+int apply_ycbcr( struct Image *input_img, struct Image *output_img, int argc, char **argv );
+int apply_ycbcr_to_rgb( struct Image *input_img, struct Image *output_img, int argc, char **argv );
+int apply_ycbcr_planar( struct Image *input_img, struct Image *output_img, int argc, char **argv );
+int apply_autolevels( struct Image *input_img, struct Image *output_img, int argc, char **argv );
+int apply_equalize( struct Image *input_img, struct Image *output_img, int argc, char **argv );
+
+void build_lut_autolevels( struct Image *input_img, uint8_t *lut );
+void build_lut_equalize( struct Image *input_img, uint8_t *lut );
 
 int out_dimensions_squash( struct Image *input_img, int argc, char **argv, int32_t *out_w, int32_t *out_h );
 int out_dimensions_expand( struct Image *input_img, int argc, char **argv, int32_t *out_w, int32_t *out_h );
 int out_dimensions_same( struct Image *input_img, int argc, char **argv, int32_t *out_w, int32_t *out_h );
+int out_dimensions_transpose( struct Image *input_img, int argc, char **argv, int32_t *out_w, int32_t *out_h );
+int out_dimensions_rotate( struct Image *input_img, int argc, char **argv, int32_t *out_w, int32_t *out_h );
+int out_dimensions_planar( struct Image *input_img, int argc, char **argv, int32_t *out_w, int32_t *out_h );
 
 static const struct Transformation s_transformations[] = {
   { "squash", apply_squash, out_dimensions_squash },
+  { "squash_avg", apply_squash_avg, out_dimensions_squash },
   { "color_rot", apply_rot, out_dimensions_same },
   { "blur", apply_blur, out_dimensions_same },
   { "expand", apply_expand, out_dimensions_expand },
+  { "median", apply_median, out_dimensions_same },
+  { "erode", apply_erode, out_dimensions_same },
+  { "dilate", apply_dilate, out_dimensions_same },
+  { "sobel", apply_sobel, out_dimensions_same },
+  { "transpose", apply_transpose, out_dimensions_transpose },
+  { "rotate", apply_rotate, out_dimensions_rotate },
+  { "flip", apply_flip, out_dimensions_same },
+  { "grayscale", apply_grayscale, out_dimensions_same },
+  { "ycbcr", apply_ycbcr, out_dimensions_same },
+  { "ycbcr_to_rgb", apply_ycbcr_to_rgb, out_dimensions_same },
+  { "ycbcr_planar", apply_ycbcr_planar, out_dimensions_planar },
+  { "autolevels", apply_autolevels, out_dimensions_same, build_lut_autolevels },
+  { "equalize", apply_equalize, out_dimensions_same, build_lut_equalize },
   { NULL, NULL },
 };
 
+// Transformations (with their arguments) timed by the bench command:
+// the streaming kernels whose speed is limited by memory bandwidth
+static const char *s_bench_kernels[][3] = {
+  { "color_rot", NULL, NULL },
+  { "squash", "1", "1" },
+  { "expand", NULL, NULL },
+};
+
 void usage( const char *progname ) {
   fprintf( stderr, "Error: invalid command-line arguments\n" );
-  fprintf( stderr, "Usage: %s <transform> <input img> <output img> [args...]\n", progname );
+  fprintf( stderr, "Usage: %s <transform> <input img> <output img> [args...] [--palette]\n", progname );
+  fprintf( stderr, "       %s stats <input img> [threads]\n", progname );
+  fprintf( stderr, "       %s <dhash|phash> <input img>\n", progname );
+  fprintf( stderr, "       %s hashdir <dhash|phash> <dir> [max distance] [threads]\n", progname );
+  fprintf( stderr, "       %s <autolevels|equalize> <input img> <output img> [--fused]\n", progname );
+  fprintf( stderr, "       %s --raw-stream <width>x<height> [--stats] <transform> [args...]\n", progname );
+  fprintf( stderr, "       %s bench <input img> [repetitions]\n", progname );
+  fprintf( stderr, "       %s batch <manifest> [threads] [memory budget (MB)]\n", progname );
+  fprintf( stderr, "       %s shard <manifest> <processes> [checkpoint file]\n", progname );
+  fprintf( stderr, "       %s replay <job log> [repetitions]\n", progname );
   exit( 1 );
 }
 
+// Returns the time in seconds since an arbitrary starting point
+// (for measuring elapsed times)
+double now_seconds( void ) {
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Find the transformation with the given name. Returns a pointer
+// to it, or NULL if there is no such transformation.
+const struct Transformation *find_transformation( const char *name ) {
+  for ( int i = 0; s_transformations[i].name != NULL; ++i ) {
+    if ( strcmp( s_transformations[i].name, name ) == 0 )
+      return &s_transformations[i];
+  }
+  return NULL;
+}
+
 // For the squash transformation, get the yfac and xfac
 // values from the command line arguments. Returns 1 if successful
 // (i.e., they are present and valid), 0 otherwise.
@@ -51,6 +143,53 @@ int squash_get_factors( int argc, char **argv, int32_t *xfac, int32_t *yfac ) {
   return 1;
 }
 
+// For the expand transformation, get the optional expansion factor
+// from the command line arguments (2 if it is omitted). Returns 1 if
+// successful (i.e., it is absent, or present and a power of two of at
+// least 2), 0 otherwise.
+int expand_get_factor( int argc, char **argv, int32_t *n ) {
+  *n = 2;
+  if ( ( argc != 4 && argc != 5 )
+       || ( argc == 5 && sscanf( argv[4], "%d", n ) != 1 ) )
+    return 0;
+
+  if ( *n < 2 || ( *n & ( *n - 1 ) ) != 0 )
+    return 0;
+
+  return 1;
+}
+
+// For the rotate transformation, get the number of degrees from
+// the command line arguments. Returns 1 if successful (i.e., it is
+// present and one of 90, 180, or 270), 0 otherwise.
+int rotate_get_degrees( int argc, char **argv, int32_t *degrees ) {
+  if ( argc != 5 || sscanf( argv[4], "%d", degrees ) != 1 )
+    return 0;
+
+  if ( *degrees != 90 && *degrees != 180 && *degrees != 270 )
+    return 0;
+
+  return 1;
+}
+
+// For the ycbcr_planar transformation, get the standard (601 or 709)
+// and the chroma subsampling (444 or 420) from the command line
+// arguments. Returns 1 if successful (i.e., they are present and
+// valid), 0 otherwise. *subsample is set to 1 for 420, 0 for 444.
+int planar_get_args( int argc, char **argv, int32_t *standard, int32_t *subsample ) {
+  int32_t sampling;
+  if ( argc != 6
+       || sscanf( argv[4], "%d", standard ) != 1
+       || sscanf( argv[5], "%d", &sampling ) != 1 )
+    return 0;
+
+  if ( ( *standard != 601 && *standard != 709 ) || ( sampling != 444 && sampling != 420 ) )
+    return 0;
+
+  *subsample = sampling == 420;
+  return 1;
+}
+
 // Make a new empty output Image.
 // Calls the out_dimensions function of the Transformation
 // to determine the dimensions of the output Image.
@@ -92,22 +231,1023 @@ void cleanup_image( struct Image *img ) {
   }
 }
 
+// Read an image and print its per-channel statistics as JSON
+// to stdout. Returns the program's exit code.
+int run_stats( int argc, char **argv ) {
+  int num_threads = (int) sysconf( _SC_NPROCESSORS_ONLN );
+  if ( argc < 3 || argc > 4 || ( argc == 4 && ( sscanf( argv[3], "%d", &num_threads ) != 1 || num_threads < 1 ) ) )
+    usage( argv[0] );
+
+  struct Image input_img;
+  if ( img_read( argv[2], &input_img ) != IMG_SUCCESS ) {
+    fprintf( stderr, "Error: couldn't read input image\n" );
+    return 1;
+  }
+
+  struct ImageStats *stats = (struct ImageStats *) malloc( sizeof( struct ImageStats ) );
+  int success = stats != NULL && img_stats( &input_img, num_threads, stats ) == IMG_SUCCESS;
+  if ( success )
+    img_stats_write_json( stdout, stats );
+  else
+    fprintf( stderr, "Error: couldn't compute image statistics\n" );
+
+  free( stats );
+  img_cleanup( &input_img );
+  return success ? 0 : 1;
+}
+
+// Apply a transformation to every frame of a stream of raw RGBA frames
+// read from stdin (see img_read_raw), writing the transformed frames
+// to stdout. The input and output Images are allocated once and reused
+// for every frame, and no PNG encoding or decoding is involved.
+int run_raw_stream( int argc, char **argv ) {
+  int32_t width, height;
+  char extra;
+  if ( argc < 4 || sscanf( argv[2], "%dx%d%c", &width, &height, &extra ) != 2 || width < 1 || height < 1 )
+    usage( argv[0] );
+
+  int report_stats = strcmp( argv[3], "--stats" ) == 0;
+  int first_arg = report_stats ? 4 : 3;
+  if ( first_arg >= argc )
+    usage( argv[0] );
+
+  const struct Transformation *xform = find_transformation( argv[first_arg] );
+  if ( xform == NULL ) {
+    fprintf( stderr, "Error: unknown transformation '%s'\n", argv[first_arg] );
+    return 1;
+  }
+
+  // the transformation functions expect the arguments of
+  // "<transform> <input img> <output img> [args...]"
+  int xform_argc = argc - first_arg + 3;
+  char **xform_argv = (char **) malloc( ( xform_argc + 1 ) * sizeof( char * ) );
+  struct Image *input_img = (struct Image *) malloc( sizeof( struct Image ) );
+  if ( xform_argv == NULL || input_img == NULL || img_init( input_img, width, height ) != IMG_SUCCESS ) {
+    fprintf( stderr, "Error: couldn't allocate input image\n" );
+    free( xform_argv );
+    free( input_img );
+    return 1;
+  }
+  xform_argv[0] = argv[0];
+  xform_argv[1] = argv[first_arg];
+  xform_argv[2] = xform_argv[3] = "-";
+  for ( int i = first_arg + 1; i <= argc; ++i )
+    xform_argv[i - first_arg + 3] = argv[i];
+
+  struct Image *output_img = create_output_img( input_img, xform_argc, xform_argv, xform );
+  if ( output_img == NULL ) {
+    fprintf( stderr, "Error: couldn't create output image object\n" );
+    cleanup_image( input_img );
+    free( xform_argv );
+    return 1;
+  }
+
+  double start = now_seconds();
+
+  long frames = 0;
+  int success = 1;
+  int rc;
+  while ( success && ( rc = img_read_raw( stdin, input_img ) ) == IMG_SUCCESS ) {
+    if ( !xform->apply( input_img, output_img, xform_argc, xform_argv ) ) {
+      fprintf( stderr, "Error: transformation failed on frame %ld\n", frames );
+      success = 0;
+    } else if ( img_write_raw( stdout, output_img ) != IMG_SUCCESS ) {
+      fprintf( stderr, "Error: couldn't write frame %ld\n", frames );
+      success = 0;
+    } else {
+      frames++;
+    }
+  }
+  if ( success && rc == IMG_ERR_TRUNCATED ) {
+    fprintf( stderr, "Error: incomplete frame %ld\n", frames );
+    success = 0;
+  }
+  if ( fflush( stdout ) != 0 )
+    success = 0;
+
+  if ( report_stats ) {
+    double seconds = now_seconds() - start;
+    fprintf( stderr, "%ld frames in %.3f s (%.1f fps)\n", frames, seconds, seconds > 0 ? frames / seconds : 0.0 );
+  }
+
+  cleanup_image( input_img );
+  cleanup_image( output_img );
+  free( xform_argv );
+  return success ? 0 : 1;
+}
+
+// Number of decompressed tiles cached by the tile stores of the bench
+// command
+#define BENCH_TILE_CACHE 16
+
+// Rotate an image by 90 degrees through compressed tile stores (see
+// imgtilestore.h), reporting the compression ratio, the time taken
+// and how much of it was spent compressing and decompressing tiles.
+// Returns 1 if successful, 0 if the stores couldn't be allocated.
+int bench_tile_store( const struct TiledImage *tiled ) {
+  struct TileStore store, rotated;
+  if ( img_tilestore_from_tiled( tiled, &store, BENCH_TILE_CACHE ) != IMG_SUCCESS )
+    return 0;
+  if ( img_tilestore_init( &rotated, tiled->height, tiled->width, BENCH_TILE_CACHE ) != IMG_SUCCESS ) {
+    img_tilestore_cleanup( &store );
+    return 0;
+  }
+  printf( "%-12s %9.2fx (%llu of %llu bytes)\n", "tile store", store.stats.compressed_bytes > 0
+          ? (double) store.stats.raw_bytes / store.stats.compressed_bytes : 0.0,
+          (unsigned long long) store.stats.compressed_bytes, (unsigned long long) store.stats.raw_bytes );
+
+  // only count the compressions done by the rotation
+  struct TileStoreStats init_stats = rotated.stats;
+  double start = now_seconds();
+  int success = img_tilestore_rotate( &store, &rotated, 90 ) == IMG_SUCCESS;
+  double seconds = now_seconds() - start;
+  if ( success )
+    printf( "%-12s %9.3f ms (tile store), %.3f ms decompressing %llu tiles, %.3f ms compressing %llu\n",
+            "rotate 90", seconds * 1e3, store.stats.decompress_seconds * 1e3,
+            (unsigned long long) store.stats.decompressions,
+            ( rotated.stats.compress_seconds - init_stats.compress_seconds ) * 1e3,
+            (unsigned long long) ( rotated.stats.compressions - init_stats.compressions ) );
+
+  img_tilestore_cleanup( &rotated );
+  img_tilestore_cleanup( &store );
+  return success;
+}
+
+// Time rotating an image by 90 degrees in row-major order against
+// rotating it in tiled order (see imgtile.h), where the column walks
+// stay within a tile, and the conversions to and from the tiled
+// layout, then through compressed tile stores (see bench_tile_store).
+// Times are the best of the repetitions.
+// Returns 1 if successful, 0 if the images couldn't be allocated.
+int bench_tiled( struct Image *input_img, int reps ) {
+  struct Image rotated;
+  struct TiledImage tiled, tiled_rotated;
+  if ( img_init( &rotated, input_img->height, input_img->width ) != IMG_SUCCESS )
+    return 0;
+  if ( img_to_tiled( input_img, &tiled ) != IMG_SUCCESS ) {
+    img_cleanup( &rotated );
+    return 0;
+  }
+  if ( img_tiled_init( &tiled_rotated, input_img->height, input_img->width ) != IMG_SUCCESS ) {
+    img_tiled_cleanup( &tiled );
+    img_cleanup( &rotated );
+    return 0;
+  }
+
+  double best_row_major = -1.0, best_tiled = -1.0, best_convert = -1.0;
+  for ( int r = 0; r < reps; ++r ) {
+    double start = now_seconds();
+    imgproc_rotate( input_img, &rotated, 90 );
+    double mid = now_seconds();
+    img_tiled_rotate( &tiled, &tiled_rotated, 90 );
+    double end = now_seconds();
+    img_from_tiled( &tiled_rotated, &rotated );
+    double converted = now_seconds();
+
+    if ( best_row_major < 0 || mid - start < best_row_major )
+      best_row_major = mid - start;
+    if ( best_tiled < 0 || end - mid < best_tiled )
+      best_tiled = end - mid;
+    if ( best_convert < 0 || converted - end < best_convert )
+      best_convert = converted - end;
+  }
+  printf( "%-12s %9.3f ms (row-major)\n", "rotate 90", best_row_major * 1e3 );
+  printf( "%-12s %9.3f ms (tiled), %.3f ms to convert back\n", "rotate 90", best_tiled * 1e3, best_convert * 1e3 );
+  int success = bench_tile_store( &tiled );
+
+  img_tiled_cleanup( &tiled_rotated );
+  img_tiled_cleanup( &tiled );
+  img_cleanup( &rotated );
+  return success;
+}
+
+// Time the bandwidth-bound kernels (see s_bench_kernels) on an input
+// image, reporting the bandwidth each one achieves (bytes of input read
+// plus bytes of output written, per second, best of the repetitions)
+// next to that of a plain memcpy of the image, as a STREAM-style copy
+// roofline, then compare row-major and tiled rotation (see bench_tiled).
+// Use an image larger than the last level cache to measure memory
+// rather than cache bandwidth.
+int run_bench( int argc, char **argv ) {
+  int reps = 5;
+  if ( argc < 3 || argc > 4 || ( argc == 4 && ( sscanf( argv[3], "%d", &reps ) != 1 || reps < 1 ) ) )
+    usage( argv[0] );
+
+  struct Image *input_img = (struct Image *) malloc( sizeof( struct Image ) );
+  if ( input_img == NULL || img_read( argv[2], input_img ) != IMG_SUCCESS ) {
+    fprintf( stderr, "Error: couldn't read input image\n" );
+    free( input_img );
+    return 1;
+  }
+
+  // copy roofline: each byte is read once and written once
+  double image_bytes = (double) input_img->width * input_img->height * sizeof( uint32_t );
+  struct Image copy_img;
+  if ( img_init( &copy_img, input_img->width, input_img->height ) != IMG_SUCCESS ) {
+    fprintf( stderr, "Error: couldn't allocate image\n" );
+    cleanup_image( input_img );
+    return 1;
+  }
+  double best = -1.0;
+  for ( int r = 0; r < reps; ++r ) {
+    double start = now_seconds();
+    memcpy( copy_img.data, input_img->data, (size_t) image_bytes );
+    double seconds = now_seconds() - start;
+    if ( best < 0 || seconds < best )
+      best = seconds;
+  }
+  img_cleanup( &copy_img );
+  double roofline = best > 0 ? 2 * image_bytes / best : 0.0;
+  printf( "%-12s %9.2f GB/s\n", "memcpy", roofline / 1e9 );
+
+  int success = 1;
+  for ( size_t k = 0; success && k < sizeof( s_bench_kernels ) / sizeof( s_bench_kernels[0] ); ++k ) {
+    // "<transform> <input img> <output img> [args...]" as usual
+    char *xform_argv[] = { argv[0], (char *) s_bench_kernels[k][0], "-", "-",
+                           (char *) s_bench_kernels[k][1], (char *) s_bench_kernels[k][2], NULL };
+    int xform_argc = 4 + ( xform_argv[4] != NULL ) + ( xform_argv[5] != NULL );
+    const struct Transformation *xform = find_transformation( s_bench_kernels[k][0] );
+    struct Image *output_img = create_output_img( input_img, xform_argc, xform_argv, xform );
+    if ( output_img == NULL ) {
+      fprintf( stderr, "Error: couldn't create output image object\n" );
+      success = 0;
+      break;
+    }
+
+    best = -1.0;
+    for ( int r = 0; success && r < reps; ++r ) {
+      double start = now_seconds();
+      success = xform->apply( input_img, output_img, xform_argc, xform_argv ) != 0;
+      double seconds = now_seconds() - start;
+      if ( best < 0 || seconds < best )
+        best = seconds;
+    }
+
+    double bytes = image_bytes + (double) output_img->width * output_img->height * sizeof( uint32_t );
+    double bandwidth = best > 0 ? bytes / best : 0.0;
+    char label[32];
+    snprintf( label, sizeof( label ), "%s%s%s%s%s", xform_argv[1],
+              xform_argv[4] ? " " : "", xform_argv[4] ? xform_argv[4] : "",
+              xform_argv[5] ? " " : "", xform_argv[5] ? xform_argv[5] : "" );
+    printf( "%-12s %9.2f GB/s %6.1f%% of memcpy\n", label, bandwidth / 1e9,
+            roofline > 0 ? 100 * bandwidth / roofline : 0.0 );
+    cleanup_image( output_img );
+  }
+
+  if ( success && !bench_tiled( input_img, reps ) ) {
+    fprintf( stderr, "Error: couldn't allocate image\n" );
+    success = 0;
+  }
+
+  cleanup_image( input_img );
+  return success ? 0 : 1;
+}
+
+// Maximum number of words on a line of a batch manifest
+#define BATCH_MAX_ARGS 16
+
+// Maximum number of characters on a line of a batch manifest (not
+// counting the newline)
+#define MANIFEST_MAX_LINE 4094
+
+// Memory budget of the batch command, in MB, unless one is given
+#define BATCH_DEFAULT_BUDGET_MB 1024
+
+// Bytes of zlib state and other fixed costs of decoding or encoding
+// a PNG file
+#define CODEC_OVERHEAD ( 512 * 1024 )
+
+// A job of the batch command: one manifest line
+struct BatchJob {
+  char *line;                  // the line, split into words in place
+  char *argv[BATCH_MAX_ARGS + 2];
+  int argc;
+  size_t estimate;             // estimated peak memory use in bytes
+  int rc;                      // result of run_transformation
+};
+
+// State shared by the threads of the batch command
+struct BatchSchedule {
+  struct BatchJob *jobs;
+  int *order;                  // job indices, smallest estimate first
+  int *started;                // indexed like jobs
+  int num_jobs;
+  size_t budget;
+  size_t in_use;               // total estimate of the running jobs
+  size_t peak;                 // highest in_use seen
+  pthread_mutex_t lock;
+  pthread_cond_t finished;     // signaled when a job finishes
+};
+
+// Estimate the peak memory use of a job from the header of its input
+// file (see img_read_header) and the output dimensions its
+// transformation gives, without decoding anything. While the input
+// is read, the pixels, the file's raw pixel data (with a filter byte
+// per row), the compressed data and the zlib state are alive; while
+// the output is written, the input and output pixels, a byte-swapped
+// copy, the filtered rows and the compressed data are. The
+// transformation's own scratch memory isn't counted.
+// Returns 1 if successful, 0 (after printing an error message) if
+// the input can't be read or the arguments are invalid.
+int estimate_job_memory( struct BatchJob *job ) {
+  int argc = job->argc;
+  if ( argc >= 5 && strcmp( job->argv[argc - 1], "--palette" ) == 0 )
+    argc--;
+
+  const struct Transformation *xform = find_transformation( job->argv[1] );
+  if ( xform == NULL ) {
+    fprintf( stderr, "Error: unknown transformation '%s'\n", job->argv[1] );
+    return 0;
+  }
+
+  // the dimensions are all out_dimensions looks at
+  struct Image header = { 0, 0, NULL };
+  int bpp;
+  struct stat st;
+  if ( img_read_header( job->argv[2], &header.width, &header.height, &bpp ) != IMG_SUCCESS
+       || stat( job->argv[2], &st ) != 0 ) {
+    fprintf( stderr, "Error: couldn't read input image '%s'\n", job->argv[2] );
+    return 0;
+  }
+  int32_t out_w, out_h;
+  if ( !xform->out_dimensions( &header, argc, job->argv, &out_w, &out_h ) ) {
+    fprintf( stderr, "Error: invalid arguments for '%s'\n", job->argv[2] );
+    return 0;
+  }
+
+  size_t in_pixels = (size_t) header.width * header.height;
+  size_t out_pixels = (size_t) out_w * out_h;
+  size_t raw = in_pixels * bpp + header.height;
+  size_t read_peak = in_pixels * sizeof( uint32_t ) + 2 * raw + (size_t) st.st_size + CODEC_OVERHEAD;
+  size_t write_peak = ( in_pixels + 4 * out_pixels ) * sizeof( uint32_t ) + (size_t) out_h + CODEC_OVERHEAD;
+  job->estimate = read_peak > write_peak ? read_peak : write_peak;
+  return 1;
+}
+
+// Run one job of the batch command (an ImgItemFn, called once per
+// job): the smallest job not yet started that fits in what is left of
+// the memory budget (or any job, when nothing is running, so that a
+// job larger than the whole budget runs on its own). Waits for
+// running jobs to finish until one fits.
+void batch_job( void *arg, int item ) {
+  (void) item;
+  struct BatchSchedule *sched = arg;
+  pthread_mutex_lock( &sched->lock );
+  int chosen = -1;
+  while ( chosen < 0 ) {
+    for ( int k = 0; k < sched->num_jobs && chosen < 0; ++k ) {
+      int i = sched->order[k];
+      if ( !sched->started[i]
+           && ( sched->in_use == 0 || sched->in_use + sched->jobs[i].estimate <= sched->budget ) )
+        chosen = i;
+    }
+    if ( chosen < 0 )
+      pthread_cond_wait( &sched->finished, &sched->lock );
+  }
+
+  struct BatchJob *job = &sched->jobs[chosen];
+  sched->started[chosen] = 1;
+  sched->in_use += job->estimate;
+  if ( sched->in_use > sched->peak )
+    sched->peak = sched->in_use;
+  pthread_mutex_unlock( &sched->lock );
+
+  job->rc = run_transformation( job->argc, job->argv );
+
+  pthread_mutex_lock( &sched->lock );
+  sched->in_use -= job->estimate;
+  pthread_cond_broadcast( &sched->finished );
+  pthread_mutex_unlock( &sched->lock );
+}
+
+// Read the jobs listed in a manifest file, one per line in the usual
+// "<transform> <input img> <output img> [args...] [--palette]" form
+// (blank lines and lines starting with # are skipped). Lines may have
+// at most BATCH_MAX_ARGS words and MANIFEST_MAX_LINE characters. The
+// jobs are returned even if reading fails, and must be freed with
+// free_manifest.
+// Returns 1 if successful, 0 (after printing an error message) if
+// the manifest can't be read or a line is incomplete or too long.
+int read_manifest( const char *filename, char *progname, struct BatchJob **jobs, int *num_jobs ) {
+  *jobs = NULL;
+  *num_jobs = 0;
+  FILE *manifest = fopen( filename, "r" );
+  if ( manifest == NULL ) {
+    fprintf( stderr, "Error: couldn't open manifest '%s'\n", filename );
+    return 0;
+  }
+
+  int capacity = 0, success = 1, line_number = 0;
+  char buf[MANIFEST_MAX_LINE + 2];
+  while ( fgets( buf, sizeof( buf ), manifest ) != NULL ) {
+    line_number++;
+    if ( strchr( buf, '\n' ) == NULL && !feof( manifest ) ) {
+      // skip the rest of the line rather than reading it as another job
+      int c;
+      while ( ( c = getc( manifest ) ) != EOF && c != '\n' )
+        ;
+      fprintf( stderr, "Error: manifest line %d is longer than %d characters\n", line_number, MANIFEST_MAX_LINE );
+      success = 0;
+      continue;
+    }
+    char *first = buf + strspn( buf, " \t\r\n" );
+    if ( *first == '\0' || *first == '#' )
+      continue;
+    if ( *num_jobs == capacity ) {
+      capacity = capacity > 0 ? 2 * capacity : 16;
+      struct BatchJob *grown = realloc( *jobs, capacity * sizeof( struct BatchJob ) );
+      if ( grown == NULL )
+        break;
+      *jobs = grown;
+    }
+
+    struct BatchJob *job = &( *jobs )[*num_jobs];
+    job->line = strdup( first );
+    if ( job->line == NULL )
+      break;
+    job->argv[0] = progname;
+    job->argc = 1;
+    char *save;
+    char *word = strtok_r( job->line, " \t\r\n", &save );
+    for ( ; word != NULL && job->argc <= BATCH_MAX_ARGS; word = strtok_r( NULL, " \t\r\n", &save ) )
+      job->argv[job->argc++] = word;
+    job->argv[job->argc] = NULL;
+    job->estimate = 0;
+    job->rc = 1;
+    ( *num_jobs )++;
+
+    if ( word != NULL ) {
+      fprintf( stderr, "Error: manifest line %d has more than %d words\n", line_number, BATCH_MAX_ARGS );
+      success = 0;
+    } else if ( job->argc < 4 ) {
+      fprintf( stderr, "Error: manifest line %d is incomplete\n", line_number );
+      success = 0;
+    }
+  }
+  if ( ferror( manifest ) || !feof( manifest ) ) {
+    fprintf( stderr, "Error: couldn't read manifest '%s'\n", filename );
+    success = 0;
+  }
+  fclose( manifest );
+  return success;
+}
+
+// Free the jobs read by read_manifest.
+void free_manifest( struct BatchJob *jobs, int num_jobs ) {
+  for ( int i = 0; i < num_jobs; ++i )
+    free( jobs[i].line );
+  free( jobs );
+}
+
+// Used to sort job indices by estimated memory use (ties keep
+// manifest order)
+static const struct BatchJob *s_sort_jobs;
+
+int compare_job_estimates( const void *a, const void *b ) {
+  int i = *(const int *) a, j = *(const int *) b;
+  size_t x = s_sort_jobs[i].estimate, y = s_sort_jobs[j].estimate;
+  return x < y ? -1 : ( x > y ? 1 : i - j );
+}
+
+// Run the transformations listed in a manifest file (see
+// read_manifest) on several threads. Jobs are only started while the sum
+// of their estimated peak memory use (see estimate_job_memory) stays
+// within the budget, smallest first, so that many small jobs keep
+// the threads busy and large ones don't run out of memory together.
+int run_batch( int argc, char **argv ) {
+  int num_threads = 4, budget_mb = BATCH_DEFAULT_BUDGET_MB;
+  if ( argc < 3 || argc > 5
+       || ( argc >= 4 && ( sscanf( argv[3], "%d", &num_threads ) != 1 || num_threads < 1 ) )
+       || ( argc == 5 && ( sscanf( argv[4], "%d", &budget_mb ) != 1 || budget_mb < 1 ) ) )
+    usage( argv[0] );
+
+  // parse the manifest and estimate the memory use of every job
+  struct BatchSchedule sched;
+  memset( &sched, 0, sizeof( sched ) );
+  int success = read_manifest( argv[2], argv[0], &sched.jobs, &sched.num_jobs );
+  for ( int i = 0; success && i < sched.num_jobs; ++i ) {
+    if ( !estimate_job_memory( &sched.jobs[i] ) )
+      success = 0;
+  }
+
+  sched.order = malloc( ( sched.num_jobs + 1 ) * sizeof( int ) );
+  sched.started = calloc( sched.num_jobs + 1, sizeof( int ) );
+  success = success && sched.order != NULL && sched.started != NULL;
+
+  if ( success ) {
+    for ( int i = 0; i < sched.num_jobs; ++i )
+      sched.order[i] = i;
+    s_sort_jobs = sched.jobs;
+    qsort( sched.order, sched.num_jobs, sizeof( int ), compare_job_estimates );
+    sched.budget = (size_t) budget_mb * 1024 * 1024;
+    pthread_mutex_init( &sched.lock, NULL );
+    pthread_cond_init( &sched.finished, NULL );
+
+    double start = now_seconds();
+    img_parallel_for( sched.num_jobs, num_threads, batch_job, &sched );
+
+    int succeeded = 0;
+    for ( int i = 0; i < sched.num_jobs; ++i )
+      succeeded += sched.jobs[i].rc == 0;
+    fprintf( stderr, "%d of %d jobs succeeded in %.3f s (peak estimated memory %.1f MB of %d MB)\n",
+             succeeded, sched.num_jobs, now_seconds() - start, sched.peak / ( 1024.0 * 1024.0 ), budget_mb );
+    success = succeeded == sched.num_jobs;
+    pthread_mutex_destroy( &sched.lock );
+    pthread_cond_destroy( &sched.finished );
+  }
+
+  free_manifest( sched.jobs, sched.num_jobs );
+  free( sched.order );
+  free( sched.started );
+  return success ? 0 : 1;
+}
+
+// Maximum number of worker processes of the shard command
+#define SHARD_MAX_PROCESSES 256
+
+// States of the jobs of the shard command
+enum { SHARD_PENDING, SHARD_SUCCEEDED, SHARD_FAILED, SHARD_CRASHED, SHARD_CHECKPOINTED };
+
+// State shared by the shard command's processes, in memory mapped
+// before the workers are forked. Workers claim jobs by atomically
+// incrementing next, so the queue needs no lock.
+struct ShardQueue {
+  int next;                              // next job to claim
+  int running[SHARD_MAX_PROCESSES];      // job each worker is running, -1 if none
+  int state[];                           // SHARD_* state of each job
+};
+
+// Shard command worker process: runs the jobs it claims until none
+// are left, recording each one that succeeds in the checkpoint file
+// (if checkpoint_fd isn't -1).
+void shard_worker( struct ShardQueue *queue, int slot, struct BatchJob *jobs, int num_jobs, int checkpoint_fd ) {
+  for ( ;; ) {
+    int i = __atomic_fetch_add( &queue->next, 1, __ATOMIC_SEQ_CST );
+    if ( i >= num_jobs )
+      _exit( 0 );
+    if ( queue->state[i] != SHARD_PENDING )
+      continue;
+
+    __atomic_store_n( &queue->running[slot], i, __ATOMIC_SEQ_CST );
+    int rc = run_transformation( jobs[i].argc, jobs[i].argv );
+    if ( rc == 0 && checkpoint_fd >= 0 ) {
+      // a single short O_APPEND write, so lines from different
+      // workers don't interleave
+      char line[4096];
+      int len = snprintf( line, sizeof( line ), "%d %s\n", i, jobs[i].argv[3] );
+      if ( len >= (int) sizeof( line ) || write( checkpoint_fd, line, len ) != len )
+        fprintf( stderr, "Warning: couldn't checkpoint job %d\n", i );
+    }
+    __atomic_store_n( &queue->state[i], rc == 0 ? SHARD_SUCCEEDED : SHARD_FAILED, __ATOMIC_SEQ_CST );
+    __atomic_store_n( &queue->running[slot], -1, __ATOMIC_SEQ_CST );
+  }
+}
+
+// Fork a shard command worker process.
+// Returns its process id, or -1 if it couldn't be started.
+pid_t start_shard_worker( struct ShardQueue *queue, int slot, struct BatchJob *jobs, int num_jobs,
+                          int checkpoint_fd ) {
+  queue->running[slot] = -1;
+  pid_t pid = fork();
+  if ( pid == 0 )
+    shard_worker( queue, slot, jobs, num_jobs, checkpoint_fd );
+  return pid;
+}
+
+// Mark the jobs recorded in a checkpoint file (lines of a job number
+// and the job's output file, written by shard_worker) as done. Lines
+// that don't match the manifest's jobs are ignored, as is a last line
+// without a newline (a write cut short by a crash).
+// Returns 1 if the file ends with a complete line (or is empty or
+// doesn't exist), 0 if it ends with a partial one.
+int read_checkpoint( const char *filename, struct ShardQueue *queue, struct BatchJob *jobs, int num_jobs ) {
+  FILE *checkpoint = fopen( filename, "r" );
+  if ( checkpoint == NULL )
+    return 1;
+  char buf[4096], output[4096];
+  int i, complete = 1;
+  while ( fgets( buf, sizeof( buf ), checkpoint ) != NULL ) {
+    complete = strchr( buf, '\n' ) != NULL;
+    if ( complete && sscanf( buf, "%d %4095s", &i, output ) == 2 && i >= 0 && i < num_jobs
+         && strcmp( jobs[i].argv[3], output ) == 0 )
+      queue->state[i] = SHARD_CHECKPOINTED;
+  }
+  fclose( checkpoint );
+  return complete;
+}
+
+// Run the transformations listed in a manifest file (see
+// read_manifest) in several worker processes, so that a job that
+// crashes (e.g. on a malformed input file) only takes its own worker
+// down; the coordinator (this process) reports the job and starts a
+// new worker in its place. If a checkpoint file is given, the jobs
+// that succeed are recorded in it, and the jobs it already records
+// aren't run again, so an interrupted run can be resumed.
+int run_shard( int argc, char **argv ) {
+  int num_processes;
+  if ( argc < 4 || argc > 5 || sscanf( argv[3], "%d", &num_processes ) != 1
+       || num_processes < 1 || num_processes > SHARD_MAX_PROCESSES )
+    usage( argv[0] );
+
+  struct BatchJob *jobs;
+  int num_jobs;
+  if ( !read_manifest( argv[2], argv[0], &jobs, &num_jobs ) ) {
+    free_manifest( jobs, num_jobs );
+    return 1;
+  }
+
+  size_t queue_size = sizeof( struct ShardQueue ) + num_jobs * sizeof( int );
+  struct ShardQueue *queue = mmap( NULL, queue_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0 );
+  if ( queue == MAP_FAILED ) {
+    fprintf( stderr, "Error: couldn't allocate the job queue\n" );
+    free_manifest( jobs, num_jobs );
+    return 1;
+  }
+
+  int checkpoint_fd = -1;
+  if ( argc == 5 ) {
+    int complete = read_checkpoint( argv[4], queue, jobs, num_jobs );
+    checkpoint_fd = open( argv[4], O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644 );
+    // end a partial last line, so that it isn't joined to the next job's
+    if ( checkpoint_fd >= 0 && !complete && write( checkpoint_fd, "\n", 1 ) != 1 ) {
+      close( checkpoint_fd );
+      checkpoint_fd = -1;
+    }
+    if ( checkpoint_fd < 0 ) {
+      fprintf( stderr, "Error: couldn't open checkpoint file '%s'\n", argv[4] );
+      munmap( queue, queue_size );
+      free_manifest( jobs, num_jobs );
+      return 1;
+    }
+  }
+
+  double start = now_seconds();
+  pid_t pids[SHARD_MAX_PROCESSES];
+  int alive = 0;
+  for ( int slot = 0; slot < num_processes; ++slot ) {
+    pids[slot] = start_shard_worker( queue, slot, jobs, num_jobs, checkpoint_fd );
+    alive += pids[slot] > 0;
+  }
+  if ( alive == 0 )
+    fprintf( stderr, "Error: couldn't start any worker processes\n" );
+
+  while ( alive > 0 ) {
+    int status;
+    pid_t pid = waitpid( -1, &status, 0 );
+    if ( pid < 0 ) {
+      if ( errno == EINTR )
+        continue;
+      break;
+    }
+    int slot = 0;
+    while ( slot < num_processes && pids[slot] != pid )
+      slot++;
+    if ( slot == num_processes )
+      continue;
+    alive--;
+    pids[slot] = -1;
+    if ( WIFEXITED( status ) && WEXITSTATUS( status ) == 0 )
+      continue;
+
+    // the worker crashed: its job is lost, the rest of the queue isn't
+    int job = queue->running[slot];
+    if ( job >= 0 ) {
+      queue->state[job] = SHARD_CRASHED;
+      fprintf( stderr, "Error: worker crashed (%s %d) running '%s %s'\n",
+               WIFSIGNALED( status ) ? "signal" : "exit status",
+               WIFSIGNALED( status ) ? WTERMSIG( status ) : WEXITSTATUS( status ),
+               jobs[job].argv[1], jobs[job].argv[2] );
+    }
+    if ( __atomic_load_n( &queue->next, __ATOMIC_SEQ_CST ) < num_jobs ) {
+      pids[slot] = start_shard_worker( queue, slot, jobs, num_jobs, checkpoint_fd );
+      alive += pids[slot] > 0;
+    }
+  }
+
+  int counts[SHARD_CHECKPOINTED + 1] = { 0 };
+  for ( int i = 0; i < num_jobs; ++i )
+    counts[queue->state[i]]++;
+  fprintf( stderr, "%d of %d jobs succeeded in %.3f s (%d resumed from checkpoint, %d failed, %d crashed)\n",
+           counts[SHARD_SUCCEEDED] + counts[SHARD_CHECKPOINTED], num_jobs, now_seconds() - start,
+           counts[SHARD_CHECKPOINTED], counts[SHARD_FAILED], counts[SHARD_CRASHED] );
+  int success = counts[SHARD_SUCCEEDED] + counts[SHARD_CHECKPOINTED] == num_jobs;
+
+  if ( checkpoint_fd >= 0 )
+    close( checkpoint_fd );
+  munmap( queue, queue_size );
+  free_manifest( jobs, num_jobs );
+  return success ? 0 : 1;
+}
+
+// A job read from a job log (see log_job), to replay
+struct ReplayJob {
+  char *line;                  // the line, split into words in place
+  char *argv[BATCH_MAX_ARGS + 2];
+  int argc;
+  char input[64];              // synthetic input file
+  int32_t width, height;       // input dimensions
+  double recorded;             // time taken when it was logged
+};
+
+// Fill an image with synthetic content: smooth gradients with a
+// little noise, so that it compresses roughly as well as a photograph
+// (which affects the time taken to read and write it).
+void fill_synthetic( struct Image *img ) {
+  uint32_t noise = 2463534242u;
+  for ( int32_t y = 0; y < img->height; ++y ) {
+    for ( int32_t x = 0; x < img->width; ++x ) {
+      noise ^= noise << 13;
+      noise ^= noise >> 17;
+      noise ^= noise << 5;
+      uint32_t r = ( x * 255 / img->width + ( noise & 15 ) ) & 0xFF;
+      uint32_t g = ( y * 255 / img->height + ( ( noise >> 4 ) & 15 ) ) & 0xFF;
+      uint32_t b = ( ( x + y ) * 127 / ( img->width + img->height ) + ( ( noise >> 8 ) & 15 ) ) & 0xFF;
+      img->data[(size_t) y * img->width + x] = ( r << 24 ) | ( g << 16 ) | ( b << 8 ) | 0xFF;
+    }
+  }
+}
+
+// Create the synthetic input file of a replayed job, unless an
+// earlier job of the same size already did.
+// Returns 1 if successful, 0 otherwise.
+int create_replay_input( const struct ReplayJob *job ) {
+  struct stat st;
+  if ( stat( job->input, &st ) == 0 )
+    return 1;
+  struct Image img = { job->width, job->height, NULL };
+  img.data = malloc( (size_t) job->width * job->height * sizeof( uint32_t ) );
+  if ( img.data == NULL )
+    return 0;
+  fill_synthetic( &img );
+  int success = img_write( job->input, &img ) == IMG_SUCCESS;
+  free( img.data );
+  return success;
+}
+
+int compare_seconds( const void *a, const void *b ) {
+  double x = *(const double *) a, y = *(const double *) b;
+  return x < y ? -1 : ( x > y ? 1 : 0 );
+}
+
+// Print the nearest-rank percentiles of n times (which are sorted).
+void print_percentiles( const char *label, double *times, int n ) {
+  qsort( times, n, sizeof( double ), compare_seconds );
+  printf( "%-10s %9.6f %9.6f %9.6f %9.6f\n", label, times[( n * 50 + 99 ) / 100 - 1],
+          times[( n * 90 + 99 ) / 100 - 1], times[( n * 99 + 99 ) / 100 - 1], times[n - 1] );
+}
+
+// Replay the successful jobs of a job log (see log_job) against
+// synthetic input images of the same sizes, one after another, and
+// report the throughput and the latency percentiles of the replay
+// next to those recorded in the log, so that changes can be measured
+// against the shape of a real workload. Blank lines are ignored;
+// malformed lines (and lines longer than MANIFEST_MAX_LINE) are
+// counted and skipped with a warning.
+int run_replay( int argc, char **argv ) {
+  int repetitions = 1;
+  if ( argc < 3 || argc > 4
+       || ( argc == 4 && ( sscanf( argv[3], "%d", &repetitions ) != 1 || repetitions < 1 ) ) )
+    usage( argv[0] );
+
+  FILE *log = fopen( argv[2], "r" );
+  if ( log == NULL ) {
+    fprintf( stderr, "Error: couldn't open job log '%s'\n", argv[2] );
+    return 1;
+  }
+  char dir[] = "/tmp/imgproc_replay_XXXXXX";
+  if ( mkdtemp( dir ) == NULL ) {
+    fprintf( stderr, "Error: couldn't create a directory for the synthetic images\n" );
+    fclose( log );
+    return 1;
+  }
+  char output[64];
+  snprintf( output, sizeof( output ), "%s/out.png", dir );
+
+  struct ReplayJob *jobs = NULL;
+  int num_jobs = 0, capacity = 0, skipped = 0, malformed = 0, success = 1, line_number = 0;
+  char buf[MANIFEST_MAX_LINE + 2];
+  while ( success && fgets( buf, sizeof( buf ), log ) != NULL ) {
+    line_number++;
+    if ( strchr( buf, '\n' ) == NULL && !feof( log ) ) {
+      int c;
+      while ( ( c = getc( log ) ) != EOF && c != '\n' )
+        ;
+      fprintf( stderr, "Warning: job log line %d is too long\n", line_number );
+      malformed++;
+      continue;
+    }
+    if ( buf[strspn( buf, " \t\r\n" )] == '\0' )
+      continue;
+    if ( num_jobs == capacity ) {
+      capacity = capacity > 0 ? 2 * capacity : 64;
+      struct ReplayJob *grown = realloc( jobs, capacity * sizeof( struct ReplayJob ) );
+      if ( grown == NULL ) {
+        success = 0;
+        break;
+      }
+      jobs = grown;
+    }
+    struct ReplayJob *job = &jobs[num_jobs];
+    job->line = strdup( buf );
+    if ( job->line == NULL ) {
+      success = 0;
+      break;
+    }
+
+    // transformation, dimensions, times and result, then the arguments
+    char *words[BATCH_MAX_ARGS + 9], *save;
+    int num_words = 0;
+    char *word = strtok_r( job->line, " \t\r\n", &save );
+    for ( ; word != NULL && num_words < BATCH_MAX_ARGS + 9; word = strtok_r( NULL, " \t\r\n", &save ) )
+      words[num_words++] = word;
+    double times[3];
+    int rc;
+    if ( word != NULL || num_words < 9 || sscanf( words[1], "%d", &job->width ) != 1
+         || sscanf( words[2], "%d", &job->height ) != 1 || sscanf( words[5], "%lf", &times[0] ) != 1
+         || sscanf( words[6], "%lf", &times[1] ) != 1 || sscanf( words[7], "%lf", &times[2] ) != 1
+         || sscanf( words[8], "%d", &rc ) != 1 || job->width <= 0 || job->height <= 0 || ( rc != 0 && rc != 1 ) ) {
+      fprintf( stderr, "Warning: job log line %d is malformed\n", line_number );
+      free( job->line );
+      malformed++;
+      continue;
+    }
+    if ( rc != 0 ) {
+      // the job failed when it was logged
+      free( job->line );
+      skipped++;
+      continue;
+    }
+
+    snprintf( job->input, sizeof( job->input ), "%s/in_%dx%d.png", dir, job->width, job->height );
+    job->recorded = times[0] + times[1] + times[2];
+    job->argv[0] = argv[0];
+    job->argv[1] = words[0];
+    job->argv[2] = job->input;
+    job->argv[3] = output;
+    job->argc = 4;
+    for ( int w = 9; w < num_words; ++w )
+      job->argv[job->argc++] = words[w];
+    job->argv[job->argc] = NULL;
+    if ( !create_replay_input( job ) ) {
+      fprintf( stderr, "Error: couldn't create a %dx%d input image\n", job->width, job->height );
+      free( job->line );
+      success = 0;
+      break;
+    }
+    num_jobs++;
+  }
+  fclose( log );
+
+  // the replayed jobs mustn't be logged themselves
+  unsetenv( JOB_LOG_ENV );
+
+  double *recorded = malloc( ( num_jobs + 1 ) * sizeof( double ) );
+  double *replayed = malloc( ( (size_t) num_jobs * repetitions + 1 ) * sizeof( double ) );
+  if ( success && num_jobs > 0 && recorded != NULL && replayed != NULL ) {
+    int failed = 0;
+    double pixels = 0.0, start = now_seconds();
+    for ( int r = 0; r < repetitions; ++r ) {
+      for ( int i = 0; i < num_jobs; ++i ) {
+        double job_start = now_seconds();
+        failed += run_transformation( jobs[i].argc, jobs[i].argv ) != 0;
+        replayed[r * num_jobs + i] = now_seconds() - job_start;
+        pixels += (double) jobs[i].width * jobs[i].height;
+      }
+    }
+    double elapsed = now_seconds() - start;
+
+    for ( int i = 0; i < num_jobs; ++i )
+      recorded[i] = jobs[i].recorded;
+    printf( "%d jobs x %d (%d skipped, %d malformed, %d failed) in %.3f s: %.1f jobs/s, %.1f Mpixels/s\n",
+            num_jobs, repetitions, skipped, malformed, failed, elapsed, num_jobs * repetitions / elapsed,
+            pixels / elapsed / 1e6 );
+    printf( "%-10s %9s %9s %9s %9s\n", "latency/s", "p50", "p90", "p99", "max" );
+    print_percentiles( "recorded", recorded, num_jobs );
+    print_percentiles( "replayed", replayed, num_jobs * repetitions );
+    success = failed == 0;
+  } else if ( success ) {
+    fprintf( stderr, "Error: no jobs to replay\n" );
+    success = 0;
+  }
+
+  // remove the synthetic images
+  remove( output );
+  for ( int i = 0; i < num_jobs; ++i ) {
+    remove( jobs[i].input );
+    free( jobs[i].line );
+  }
+  rmdir( dir );
+  free( jobs );
+  free( recorded );
+  free( replayed );
+  return success ? 0 : 1;
+}
+
+// Print the perceptual hash (dhash or phash) of an image
+// as 16 hex digits. Returns the program's exit code.
+int run_hash( int argc, char **argv ) {
+  if ( argc != 3 )
+    usage( argv[0] );
+
+  int kind = strcmp( argv[1], "phash" ) == 0 ? IMG_HASH_PHASH : IMG_HASH_DHASH;
+  uint64_t hash;
+  if ( img_hash_file( argv[2], kind, &hash ) != IMG_SUCCESS ) {
+    fprintf( stderr, "Error: couldn't read input image\n" );
+    return 1;
+  }
+
+  printf( "%016llx\n", (unsigned long long) hash );
+  return 0;
+}
+
+// Hash every PNG file in a directory and print each pair of files
+// whose hashes differ in at most max distance bits (default 10),
+// one per line as "<distance> <file> <file>". Returns the program's
+// exit code.
+int run_hashdir( int argc, char **argv ) {
+  int max_distance = 10;
+  int num_threads = (int) sysconf( _SC_NPROCESSORS_ONLN );
+  if ( argc < 4 || argc > 6
+       || ( strcmp( argv[2], "dhash" ) != 0 && strcmp( argv[2], "phash" ) != 0 )
+       || ( argc >= 5 && ( sscanf( argv[4], "%d", &max_distance ) != 1 || max_distance < 0 ) )
+       || ( argc == 6 && ( sscanf( argv[5], "%d", &num_threads ) != 1 || num_threads < 1 ) ) )
+    usage( argv[0] );
+
+  int kind = strcmp( argv[2], "phash" ) == 0 ? IMG_HASH_PHASH : IMG_HASH_DHASH;
+  struct ImageHash *hashes;
+  int count;
+  if ( img_hash_dir( argv[3], kind, num_threads, &hashes, &count ) != IMG_SUCCESS ) {
+    fprintf( stderr, "Error: couldn't read directory '%s'\n", argv[3] );
+    return 1;
+  }
+
+  for ( int i = 0; i < count; ++i ) {
+    if ( hashes[i].rc != IMG_SUCCESS ) {
+      fprintf( stderr, "Warning: couldn't read '%s'\n", hashes[i].filename );
+      continue;
+    }
+    for ( int j = i + 1; j < count; ++j ) {
+      if ( hashes[j].rc != IMG_SUCCESS )
+        continue;
+      int distance = img_hash_distance( hashes[i].hash, hashes[j].hash );
+      if ( distance <= max_distance )
+        printf( "%d %s %s\n", distance, hashes[i].filename, hashes[j].filename );
+    }
+  }
+
+  img_hash_free( hashes, count );
+  return 0;
+}
+
 int main( int argc, char **argv ) {
+  // stats and the hashing commands print results instead of
+  // writing an output image, --raw-stream works on stdin and stdout
+  if ( argc >= 2 && strcmp( argv[1], "stats" ) == 0 )
+    return run_stats( argc, argv );
+  if ( argc >= 2 && ( strcmp( argv[1], "dhash" ) == 0 || strcmp( argv[1], "phash" ) == 0 ) )
+    return run_hash( argc, argv );
+  if ( argc >= 2 && strcmp( argv[1], "hashdir" ) == 0 )
+    return run_hashdir( argc, argv );
+  if ( argc >= 2 && strcmp( argv[1], "--raw-stream" ) == 0 )
+    return run_raw_stream( argc, argv );
+  if ( argc >= 2 && strcmp( argv[1], "bench" ) == 0 )
+    return run_bench( argc, argv );
+
+  if ( argc >= 2 && strcmp( argv[1], "batch" ) == 0 )
+    return run_batch( argc, argv );
+  if ( argc >= 2 && strcmp( argv[1], "shard" ) == 0 )
+    return run_shard( argc, argv );
+  if ( argc >= 2 && strcmp( argv[1], "replay" ) == 0 )
+    return run_replay( argc, argv );
+
   if ( argc < 4 )
     usage( argv[0] );
 
+  return run_transformation( argc, argv );
+}
+
+// Apply the transformation named by argv[1] to the image in the file
+// argv[2] and write the result to the file argv[3]; argv[4] and up
+// are the transformation's arguments, optionally followed by
+// --palette. Returns 0 if successful, 1 (after printing an error
+// message) otherwise. If the JOB_LOG_ENV environment variable names a
+// file, the job is recorded in it (see log_job).
+int run_transformation( int argc, char **argv ) {
+  int logged_argc = argc;
+  double start = now_seconds();
+
+  // --palette after the transformation's arguments writes images
+  // with at most 256 colors as indexed PNGs
+  int palette = argc >= 5 && strcmp( argv[argc - 1], "--palette" ) == 0;
+  if ( palette )
+    argc--;
+
   const char *transformation = argv[1];
   const char *input_filename = argv[2];
   const char *output_filename = argv[3];
 
   // find transformation
-  const struct Transformation *xform = NULL;
-  for ( int i = 0; s_transformations[i].name != NULL; ++i ) {
-    if ( strcmp( s_transformations[i].name, transformation ) == 0 ) {
-      xform = &s_transformations[i];
-      break;
-    }
-  }
+  const struct Transformation *xform = find_transformation( transformation );
 
   if ( xform == NULL ) {
     fprintf( stderr, "Error: unknown transformation '%s'\n", transformation );
@@ -125,6 +1265,20 @@ int main( int argc, char **argv ) {
     free( input_img );
     return 1;
   }
+  double read_done = now_seconds();
+
+  // Lookup table transformations can be applied while the output
+  // file is written, saving a pass over the pixels
+  if ( xform->build_lut != NULL && argc == 5 && strcmp( argv[4], "--fused" ) == 0 ) {
+    uint8_t lut[3 * 256];
+    xform->build_lut( input_img, lut );
+    int success = img_write_lut( output_filename, input_img, lut ) == IMG_SUCCESS;
+    if ( !success )
+      fprintf( stderr, "Error: couldn't write output image\n" );
+    log_job( logged_argc, argv, input_img, input_img, read_done - start, 0.0, now_seconds() - read_done, success );
+    cleanup_image( input_img );
+    return success ? 0 : 1;
+  }
 
   // Create output Image object
   struct Image *output_img = create_output_img( input_img, argc, argv, xform );
@@ -138,14 +1292,18 @@ int main( int argc, char **argv ) {
 
   // apply the transformation!
   success = xform->apply( input_img, output_img, argc, argv ) != 0;
+  double apply_done = now_seconds();
 
   if ( success ) {
     // Write output image
-    if ( img_write( output_filename, output_img ) != IMG_SUCCESS ) {
+    int rc = palette ? img_write_palette( output_filename, output_img ) : img_write( output_filename, output_img );
+    if ( rc != IMG_SUCCESS ) {
       fprintf( stderr, "Error: couldn't write output image\n" );
       success = 0;
     }
   }
+  log_job( logged_argc, argv, input_img, output_img, read_done - start, apply_done - read_done,
+           now_seconds() - apply_done, success );
 
   cleanup_image( input_img );
   cleanup_image( output_img );
@@ -169,6 +1327,18 @@ int apply_squash( struct Image *input_img, struct Image *output_img, int argc, c
   return 1;
 }
 
+int apply_squash_avg( struct Image *input_img, struct Image *output_img, int argc, char **argv ) {
+  int32_t xfac, yfac;
+
+  // Same arguments as squash, already checked by out_dimensions_squash()
+  int rc;
+  rc = squash_get_factors( argc, argv, &xfac, &yfac );
+  assert( rc != 0 );
+  (void) rc;
+
+  return imgproc_squash_avg( input_img, output_img, xfac, yfac );
+}
+
 int apply_rot( struct Image *input_img, struct Image *output_img, int argc, char **argv ) {
   (void) argc;
   (void) argv;
@@ -186,12 +1356,180 @@ int apply_blur( struct Image *input_img, struct Image *output_img, int argc, cha
 }
 
 int apply_expand( struct Image *input_img, struct Image *output_img, int argc, char **argv ) {
+  int32_t n;
+  int rc;
+  rc = expand_get_factor( argc, argv, &n );
+  assert( rc != 0 );
+  (void) rc;
+
+  if ( n == 2 ) {
+    imgproc_expand( input_img, output_img );
+    return 1;
+  }
+  // larger factors are computed in one pass rather than
+  // by expanding the image over and over again
+  return imgproc_expand_n( input_img, output_img, n );
+}
+
+int apply_median( struct Image *input_img, struct Image *output_img, int argc, char **argv ) {
+  int median_dist;
+  if ( argc != 5 || sscanf( argv[4], "%d", &median_dist ) != 1 || median_dist < 0 )
+    // invalid arguments
+    return 0;
+  int num_threads = (int) sysconf( _SC_NPROCESSORS_ONLN );
+  return img_parallel_median( input_img, output_img, median_dist, num_threads ) == IMG_SUCCESS;
+}
+
+int apply_erode( struct Image *input_img, struct Image *output_img, int argc, char **argv ) {
+  int dist;
+  if ( argc != 5 || sscanf( argv[4], "%d", &dist ) != 1 || dist < 0 )
+    // invalid arguments
+    return 0;
+  return imgproc_erode( input_img, output_img, dist );
+}
+
+int apply_dilate( struct Image *input_img, struct Image *output_img, int argc, char **argv ) {
+  int dist;
+  if ( argc != 5 || sscanf( argv[4], "%d", &dist ) != 1 || dist < 0 )
+    // invalid arguments
+    return 0;
+  return imgproc_dilate( input_img, output_img, dist );
+}
+
+int apply_sobel( struct Image *input_img, struct Image *output_img, int argc, char **argv ) {
   (void) argc;
   (void) argv;
-  imgproc_expand( input_img, output_img );
+  int num_threads = (int) sysconf( _SC_NPROCESSORS_ONLN );
+  return img_parallel_sobel( input_img, output_img, num_threads ) == IMG_SUCCESS;
+}
+
+int apply_transpose( struct Image *input_img, struct Image *output_img, int argc, char **argv ) {
+  (void) argc;
+  (void) argv;
+  imgproc_transpose( input_img, output_img );
+  return 1;
+}
+
+int apply_rotate( struct Image *input_img, struct Image *output_img, int argc, char **argv ) {
+  int32_t degrees;
+
+  // out_dimensions_rotate() has already checked the degrees argument
+  int rc;
+  rc = rotate_get_degrees( argc, argv, &degrees );
+  assert( rc != 0 );
+  (void) rc;
+
+  return imgproc_rotate( input_img, output_img, degrees );
+}
+
+int apply_flip( struct Image *input_img, struct Image *output_img, int argc, char **argv ) {
+  if ( argc != 5 )
+    return 0;
+
+  if ( strcmp( argv[4], "h" ) == 0 )
+    imgproc_flip( input_img, output_img, 1 );
+  else if ( strcmp( argv[4], "v" ) == 0 )
+    imgproc_flip( input_img, output_img, 0 );
+  else
+    // invalid direction
+    return 0;
+
+  return 1;
+}
+
+int apply_grayscale( struct Image *input_img, struct Image *output_img, int argc, char **argv ) {
+  int standard;
+  if ( argc != 5 || sscanf( argv[4], "%d", &standard ) != 1 )
+    // invalid arguments
+    return 0;
+  return imgproc_grayscale( input_img, output_img, standard );
+}
+
+int apply_ycbcr( struct Image *input_img, struct Image *output_img, int argc, char **argv ) {
+  int standard;
+  if ( argc != 5 || sscanf( argv[4], "%d", &standard ) != 1 )
+    // invalid arguments
+    return 0;
+  return imgproc_rgb_to_ycbcr( input_img, output_img, standard );
+}
+
+int apply_ycbcr_to_rgb( struct Image *input_img, struct Image *output_img, int argc, char **argv ) {
+  int standard;
+  if ( argc != 5 || sscanf( argv[4], "%d", &standard ) != 1 )
+    // invalid arguments
+    return 0;
+  return imgproc_ycbcr_to_rgb( input_img, output_img, standard );
+}
+
+int apply_ycbcr_planar( struct Image *input_img, struct Image *output_img, int argc, char **argv ) {
+  int32_t standard, subsample;
+
+  // out_dimensions_planar() has already checked the arguments
+  int rc;
+  rc = planar_get_args( argc, argv, &standard, &subsample );
+  assert( rc != 0 );
+  (void) rc;
+
+  int32_t w = input_img->width, h = input_img->height;
+  int32_t chroma_w = subsample ? ( w + 1 ) / 2 : w;
+  int32_t chroma_h = subsample ? ( h + 1 ) / 2 : h;
+  uint8_t *y_plane = malloc( (size_t) w * h );
+  uint8_t *cb_plane = malloc( (size_t) chroma_w * chroma_h );
+  uint8_t *cr_plane = malloc( (size_t) chroma_w * chroma_h );
+
+  int success = y_plane != NULL && cb_plane != NULL && cr_plane != NULL
+    && imgproc_ycbcr_planes( input_img, y_plane, cb_plane, cr_plane, standard, subsample );
+
+  if ( success ) {
+    // Draw the planes as grey images: Y on top, then Cb, then Cr,
+    // each starting at the left edge of the output
+    const uint8_t *planes[3] = { y_plane, cb_plane, cr_plane };
+    int32_t plane_w[3] = { w, chroma_w, chroma_w };
+    int32_t plane_h[3] = { h, chroma_h, chroma_h };
+    int32_t out_row = 0;
+    for ( int p = 0; p < 3; ++p ) {
+      for ( int32_t i = 0; i < plane_h[p]; ++i, ++out_row )
+        for ( int32_t j = 0; j < plane_w[p]; ++j ) {
+          uint32_t v = planes[p][i * plane_w[p] + j];
+          output_img->data[out_row * output_img->width + j] = ( v << 24 ) | ( v << 16 ) | ( v << 8 ) | 0xFF;
+        }
+    }
+  }
+
+  free( y_plane );
+  free( cb_plane );
+  free( cr_plane );
+  return success;
+}
+
+int apply_autolevels( struct Image *input_img, struct Image *output_img, int argc, char **argv ) {
+  (void) argv;
+  if ( argc != 4 )
+    return 0;
+  imgproc_autolevels( input_img, output_img );
   return 1;
 }
 
+int apply_equalize( struct Image *input_img, struct Image *output_img, int argc, char **argv ) {
+  (void) argv;
+  if ( argc != 4 )
+    return 0;
+  imgproc_equalize( input_img, output_img );
+  return 1;
+}
+
+void build_lut_autolevels( struct Image *input_img, uint8_t *lut ) {
+  uint32_t hist[4 * 256];
+  imgproc_histogram( input_img, hist );
+  imgproc_autolevels_lut( hist, lut );
+}
+
+void build_lut_equalize( struct Image *input_img, uint8_t *lut ) {
+  uint32_t hist[4 * 256];
+  imgproc_histogram( input_img, hist );
+  imgproc_equalize_lut( hist, lut );
+}
+
 int out_dimensions_squash( struct Image *input_img, int argc, char **argv, int32_t *out_w, int32_t *out_h ) {
   // In the squash transformation, the x (width) and y (height) dimensions
   // are divided by an integer factor.
@@ -205,9 +1543,14 @@ int out_dimensions_squash( struct Image *input_img, int argc, char **argv, int32
 
 int out_dimensions_expand( struct Image *input_img, int argc, char **argv, int32_t *out_w, int32_t *out_h ) {
   // In the expand transformation, the width and height
-  // are both doubled.
-  *out_w = input_img->width * 2;
-  *out_h = input_img->height * 2;
+  // are both multiplied by the expansion factor (doubled by default).
+  int32_t n;
+  if ( !expand_get_factor( argc, argv, &n ) )
+    return 0;
+  if ( input_img->width > INT32_MAX / n || input_img->height > INT32_MAX / n )
+    return 0;
+  *out_w = input_img->width * n;
+  *out_h = input_img->height * n;
   return 1;
 }
 
@@ -218,3 +1561,68 @@ int out_dimensions_same( struct Image *input_img, int argc, char **argv, int32_t
   *out_h = input_img->height;
   return 1;
 }
+
+int out_dimensions_transpose( struct Image *input_img, int argc, char **argv, int32_t *out_w, int32_t *out_h ) {
+  // In the transpose transformation, the width and height
+  // are swapped.
+  *out_w = input_img->height;
+  *out_h = input_img->width;
+  return 1;
+}
+
+int out_dimensions_rotate( struct Image *input_img, int argc, char **argv, int32_t *out_w, int32_t *out_h ) {
+  // Rotating by 90 or 270 degrees swaps the width and height,
+  // rotating by 180 degrees keeps them.
+  int32_t degrees;
+  if ( !rotate_get_degrees( argc, argv, &degrees ) )
+    return 0;
+  if ( degrees == 180 ) {
+    *out_w = input_img->width;
+    *out_h = input_img->height;
+  } else {
+    *out_w = input_img->height;
+    *out_h = input_img->width;
+  }
+  return 1;
+}
+
+int out_dimensions_planar( struct Image *input_img, int argc, char **argv, int32_t *out_w, int32_t *out_h ) {
+  // The ycbcr_planar transformation stacks the Y plane and the
+  // (possibly half-height) Cb and Cr planes vertically.
+  int32_t standard, subsample;
+  if ( !planar_get_args( argc, argv, &standard, &subsample ) )
+    return 0;
+  *out_w = input_img->width;
+  *out_h = input_img->height + 2 * ( subsample ? ( input_img->height + 1 ) / 2 : input_img->height );
+  return 1;
+}
+
+// Append a job to the job log named by JOB_LOG_ENV, if it's set, as a
+// line of the form
+//   <transform> <input w> <input h> <output w> <output h>
+//   <read s> <apply s> <write s> <0 if successful, 1 if not> [args...]
+// (on one line), for replay (see run_replay). Each line is written
+// with a single O_APPEND write, so concurrent jobs (batch threads and
+// shard processes) can share a log.
+void log_job( int argc, char **argv, const struct Image *input_img, const struct Image *output_img,
+              double read_time, double apply_time, double write_time, int success ) {
+  const char *filename = getenv( JOB_LOG_ENV );
+  if ( filename == NULL || *filename == '\0' )
+    return;
+
+  char line[4096];
+  int len = snprintf( line, sizeof( line ), "%s %d %d %d %d %.6f %.6f %.6f %d", argv[1],
+                      input_img->width, input_img->height, output_img->width, output_img->height,
+                      read_time, apply_time, write_time, success ? 0 : 1 );
+  for ( int i = 4; i < argc && len < (int) sizeof( line ); ++i )
+    len += snprintf( line + len, sizeof( line ) - len, " %s", argv[i] );
+  if ( len >= (int) sizeof( line ) - 1 )
+    return;
+  line[len++] = '\n';
+
+  int fd = open( filename, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644 );
+  if ( fd < 0 || write( fd, line, len ) != len )
+    fprintf( stderr, "Warning: couldn't write to job log '%s'\n", filename );
+  if ( fd >= 0 )
+    close( fd );
+}
\ No newline at end of file
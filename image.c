@@ -1,9 +1,32 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
 #include "pnglite.h"
 #include "image.h"
 
-int png_init_called;
+// Number of pixels is_opaque checks between looking for a translucent one
+#define OPAQUE_BLOCK 256
+
+// Alignment of Image pixel buffers: a cache line, so that rows of
+// images with suitable widths can be written with aligned (and
+// non-temporal) vector stores
+#define PIXEL_ALIGN 64
+
+// Number of pixels img_write_raw converts at a time
+#define RAW_CHUNK 1024
+
+// Number of slots in the hash set build_palette collects colors in
+// (a power of two, kept at most a quarter full)
+#define PALETTE_HASH_SIZE 1024
+
+// pnglite is initialized once, by whichever thread first reads or
+// writes a file
+static pthread_once_t png_init_once = PTHREAD_ONCE_INIT;
+
+static void init_png(void) {
+  png_init(0, 0);
+}
 
 int is_little_endian(void) {
   int32_t x = 1;
@@ -16,10 +39,21 @@ uint32_t byteswap(uint32_t val) {
   return result;
 }
 
+// Allocates a PIXEL_ALIGN-aligned buffer for num_pixels pixels,
+// which can be freed with free(); returns NULL on failure
+static uint32_t *alloc_pixels(size_t num_pixels) {
+  void *p;
+  // posix_memalign may return NULL for a size of 0
+  if (posix_memalign(&p, PIXEL_ALIGN, (num_pixels > 0 ? num_pixels : 1) * sizeof(uint32_t)) != 0) {
+    return NULL;
+  }
+  return p;
+}
+
 int img_init(struct Image *img, int32_t width, int32_t height) {
   int num_pixels = width * height;
 
-  uint32_t *pixel_data = (uint32_t *) malloc(num_pixels * sizeof(uint32_t));
+  uint32_t *pixel_data = alloc_pixels(num_pixels);
   if (pixel_data == NULL) {
     return IMG_ERR_MALLOC_FAILED;
   }
@@ -36,21 +70,81 @@ int img_init(struct Image *img, int32_t width, int32_t height) {
   return IMG_SUCCESS;
 }
 
-int img_read(const char *filename, struct Image *img) {
-  if (!png_init_called) {
-    png_init(0, 0);
-    png_init_called = 1;
+// Returns the pixel value of an entry of the palette of an indexed
+// png (opaque black for indices past the end of the palette)
+static uint32_t palette_pixel(const png_t *png, unsigned index) {
+  if (index >= png->palette_size) {
+    return 0x000000FFU;
   }
+  const unsigned char *p = &png->palette[index * 4];
+  return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+// Returns the current CLOCK_MONOTONIC time in seconds.
+static double monotonic_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void img_cancel_init(struct ImgCancel *cancel, double timeout) {
+  cancel->cancelled = 0;
+  cancel->deadline = timeout > 0 ? monotonic_seconds() + timeout : 0.0;
+  cancel->yield = NULL;
+  cancel->yield_arg = NULL;
+}
+
+void img_cancel_request(struct ImgCancel *cancel) {
+  __atomic_store_n(&cancel->cancelled, 1, __ATOMIC_RELAXED);
+}
+
+int img_cancelled(const struct ImgCancel *cancel) {
+  if (cancel == NULL) {
+    return 0;
+  }
+  if (__atomic_load_n(&cancel->cancelled, __ATOMIC_RELAXED)) {
+    return 1;
+  }
+  return cancel->deadline > 0 && monotonic_seconds() >= cancel->deadline;
+}
+
+int img_checkpoint(const struct ImgCancel *cancel) {
+  if (cancel != NULL && cancel->yield != NULL) {
+    cancel->yield(cancel->yield_arg);
+  }
+  return img_cancelled(cancel);
+}
+
+// pnglite cancel callback: the user pointer is an ImgCancel
+static int png_cancelled(void *user_pointer) {
+  return img_cancelled(user_pointer);
+}
+
+// Returns the img_read result for a failed png_get_data.
+static int read_error(int png_rc) {
+  return png_rc == PNG_CANCELLED ? IMG_ERR_CANCELLED : IMG_ERR_MALLOC_FAILED;
+}
+
+int img_read(const char *filename, struct Image *img) {
+  return img_read_cancellable(filename, img, NULL);
+}
+
+int img_read_cancellable(const char *filename, struct Image *img, const struct ImgCancel *cancel) {
+  pthread_once(&png_init_once, init_png);
 
   png_t png;
 
   if (png_open_file_read(&png, filename) != PNG_NO_ERROR) {
     return IMG_ERR_COULD_NOT_OPEN;
   }
+  if (cancel != NULL) {
+    png_set_cancel(&png, png_cancelled, (void *) cancel);
+  }
 
-  // only allow truecolor 8bpp images
+  // only allow truecolor 8bpp images and 8-bit indexed images
   if (!(png.color_type == PNG_TRUECOLOR && png.bpp == 3) &&
-      !(png.color_type == PNG_TRUECOLOR_ALPHA && png.bpp == 4)) {
+      !(png.color_type == PNG_TRUECOLOR_ALPHA && png.bpp == 4) &&
+      !(png.color_type == PNG_INDEXED && png.bpp == 1)) {
     png_close_file(&png);
     return IMG_ERR_NOT_TRUECOLOR;
   }
@@ -58,17 +152,28 @@ int img_read(const char *filename, struct Image *img) {
   int num_pixels = png.width * png.height;
 
   // allocate buffer for pixel data in truecolor RGBA format
-  uint32_t *pixel_data = (uint32_t *) malloc(num_pixels * sizeof(uint32_t));
+  uint32_t *pixel_data = alloc_pixels(num_pixels);
+  if (pixel_data == NULL) {
+    png_close_file(&png);
+    return IMG_ERR_MALLOC_FAILED;
+  }
 
   if (png.color_type == PNG_TRUECOLOR) {
     // PNG pixel data is in RGB form, expand it to add the alpha channel
 
-    unsigned char *pixel_data_raw = (unsigned char *) malloc(num_pixels * 3);
-    if (png_get_data(&png, pixel_data_raw) != PNG_NO_ERROR) {
+    unsigned char *pixel_data_raw = (unsigned char *) malloc((size_t) num_pixels * 3);
+    if (pixel_data_raw == NULL) {
       png_close_file(&png);
       free(pixel_data);
       return IMG_ERR_MALLOC_FAILED;
     }
+    int rc = png_get_data(&png, pixel_data_raw);
+    if (rc != PNG_NO_ERROR) {
+      png_close_file(&png);
+      free(pixel_data);
+      free(pixel_data_raw);
+      return read_error(rc);
+    }
 
     for (int i = 0; i < num_pixels; i++) {
       unsigned char r = pixel_data_raw[i*3 + 0];
@@ -79,15 +184,39 @@ int img_read(const char *filename, struct Image *img) {
       pixel_data[i] = (r << 24) | (g << 16) | (b << 8) | a;
     }
 
+    free(pixel_data_raw);
+  } else if (png.color_type == PNG_INDEXED) {
+    // PNG pixel data is palette indices, the palette is known once
+    // the data has been decoded
+
+    unsigned char *pixel_data_raw = (unsigned char *) malloc(num_pixels);
+    if (pixel_data_raw == NULL) {
+      png_close_file(&png);
+      free(pixel_data);
+      return IMG_ERR_MALLOC_FAILED;
+    }
+    int rc = png_get_data(&png, pixel_data_raw);
+    if (rc != PNG_NO_ERROR) {
+      png_close_file(&png);
+      free(pixel_data);
+      free(pixel_data_raw);
+      return read_error(rc);
+    }
+
+    for (int i = 0; i < num_pixels; i++) {
+      pixel_data[i] = palette_pixel(&png, pixel_data_raw[i]);
+    }
+
     free(pixel_data_raw);
   } else {
     // PNG pixel data is already in the correct format,
     // except that the RGBA data is in big-endian form, so we
     // need to byteswap if on a little endian system
-    if (png_get_data(&png, (unsigned char *) pixel_data) != PNG_NO_ERROR) {
+    int rc = png_get_data(&png, (unsigned char *) pixel_data);
+    if (rc != PNG_NO_ERROR) {
       png_close_file(&png);
       free(pixel_data);
-      return IMG_ERR_MALLOC_FAILED;
+      return read_error(rc);
     }
 
     if (is_little_endian()) {
@@ -107,49 +236,320 @@ int img_read(const char *filename, struct Image *img) {
   return IMG_SUCCESS;
 }
 
-int img_write(const char *filename, struct Image *img) {
-  if (!png_init_called) {
-    png_init(0, 0);
-    png_init_called = 1;
+int img_read_header(const char *filename, int32_t *width, int32_t *height, int *bpp) {
+  pthread_once(&png_init_once, init_png);
+
+  png_t png;
+
+  if (png_open_file_read(&png, filename) != PNG_NO_ERROR) {
+    return IMG_ERR_COULD_NOT_OPEN;
+  }
+  png_close_file(&png);
+
+  if (!(png.color_type == PNG_TRUECOLOR && png.bpp == 3) &&
+      !(png.color_type == PNG_TRUECOLOR_ALPHA && png.bpp == 4) &&
+      !(png.color_type == PNG_INDEXED && png.bpp == 1)) {
+    return IMG_ERR_NOT_TRUECOLOR;
+  }
+
+  *width = png.width;
+  *height = png.height;
+  *bpp = png.bpp;
+  return IMG_SUCCESS;
+}
+
+// State shared with squash_row while img_read_squashed decodes
+struct SquashRead {
+  struct Image *img;
+  int32_t xfac, yfac;
+  int bpp;
+  const png_t *png;
+};
+
+// png_get_rows callback: keeps every xfac'th pixel of every
+// yfac'th row
+static void squash_row(unsigned row, const unsigned char *data, void *user_pointer) {
+  struct SquashRead *sr = user_pointer;
+  if (row % sr->yfac != 0 || (int32_t) (row / sr->yfac) >= sr->img->height) {
+    return;
+  }
+
+  uint32_t *out = sr->img->data + (row / sr->yfac) * sr->img->width;
+  for (int32_t j = 0; j < sr->img->width; j++) {
+    const unsigned char *p = data + (size_t) j * sr->xfac * sr->bpp;
+    if (sr->bpp == 1) {
+      out[j] = palette_pixel(sr->png, p[0]);
+      continue;
+    }
+    unsigned char a = sr->bpp == 4 ? p[3] : 255;
+    out[j] = (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | a;
   }
+}
+
+int img_read_squashed(const char *filename, struct Image *img, int32_t min_width, int32_t min_height) {
+  pthread_once(&png_init_once, init_png);
+
+  png_t png;
+
+  if (png_open_file_read(&png, filename) != PNG_NO_ERROR) {
+    return IMG_ERR_COULD_NOT_OPEN;
+  }
+
+  // only allow truecolor 8bpp images and 8-bit indexed images
+  if (!(png.color_type == PNG_TRUECOLOR && png.bpp == 3) &&
+      !(png.color_type == PNG_TRUECOLOR_ALPHA && png.bpp == 4) &&
+      !(png.color_type == PNG_INDEXED && png.bpp == 1)) {
+    png_close_file(&png);
+    return IMG_ERR_NOT_TRUECOLOR;
+  }
+
+  // the largest factors that keep the image at least as big as requested
+  struct SquashRead sr;
+  sr.img = img;
+  sr.bpp = png.bpp;
+  sr.png = &png;
+  sr.xfac = min_width > 0 && (int32_t) png.width / min_width > 1 ? (int32_t) png.width / min_width : 1;
+  sr.yfac = min_height > 0 && (int32_t) png.height / min_height > 1 ? (int32_t) png.height / min_height : 1;
+
+  // same dimensions as imgproc_squash gives
+  int rc = img_init(img, png.width / sr.xfac, png.height / sr.yfac);
+  if (rc != IMG_SUCCESS) {
+    png_close_file(&png);
+    return rc;
+  }
+
+  if (png_get_rows(&png, squash_row, &sr) != PNG_NO_ERROR) {
+    png_close_file(&png);
+    img_cleanup(img);
+    return IMG_ERR_MALLOC_FAILED;
+  }
+
+  png_close_file(&png);
+
+  return IMG_SUCCESS;
+}
+
+// Returns 1 if every pixel of img has an alpha value of 255, 0
+// otherwise. The alpha values of a block of pixels are combined
+// with a branch-free AND (which the compiler can vectorize), and the
+// scan stops after the first block containing a translucent pixel.
+static int is_opaque(const struct Image *img) {
+  int32_t num_pixels = img->width * img->height;
+
+  for (int32_t start = 0; start < num_pixels; start += OPAQUE_BLOCK) {
+    int32_t end = num_pixels - start < OPAQUE_BLOCK ? num_pixels : start + OPAQUE_BLOCK;
+    uint32_t alpha = 0xFF;
+    for (int32_t i = start; i < end; i++) {
+      alpha &= img->data[i];
+    }
+    if ((alpha & 0xFF) != 0xFF) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+// Shared implementation of img_write, img_write_lut and
+// img_write_cancellable: lut is NULL when the pixels are written
+// unchanged, cancel is NULL when the write can't be cancelled
+static int write_png(const char *filename, struct Image *img, const uint8_t *lut, const struct ImgCancel *cancel) {
+  pthread_once(&png_init_once, init_png);
 
   png_t png;
 
   if (png_open_file_write(&png, filename) != PNG_NO_ERROR) {
     return IMG_ERR_COULD_NOT_OPEN;
   }
+  if (cancel != NULL) {
+    png_set_cancel(&png, png_cancelled, (void *) cancel);
+  }
 
   // if this is a little endian system, we need to byteswap
   // every uint32_t so that it can be written in big-endian order
-  // (which is what PNG requires)
+  // (which is what PNG requires); a lookup table is applied in the
+  // same loop, so it doesn't cost another pass over the pixels.
+  // Fully opaque images are written without their alpha channel,
+  // which leaves a quarter less data to compress and write.
 
   uint32_t *data_to_write = img->data;
+  int opaque = is_opaque(img);
   int need_byteswap = is_little_endian();
+  int need_copy = need_byteswap || lut != NULL || opaque;
 
-  if (need_byteswap) {
+  if (need_copy) {
     data_to_write = (uint32_t *) malloc(img->width * img->height * sizeof(uint32_t));
     if (data_to_write == NULL) {
       png_close_file(&png);
       return IMG_ERR_MALLOC_FAILED;
     }
 
+    unsigned char *rgb = (unsigned char *) data_to_write;
     int32_t num_pixels = img->width * img->height;
     for (int32_t i = 0; i < num_pixels; i++) {
-      data_to_write[i] = byteswap(img->data[i]);
+      uint32_t pixel = img->data[i];
+      if (lut != NULL) {
+        pixel = (lut[pixel >> 24] << 24)
+          | (lut[256 + ((pixel >> 16) & 0xFF)] << 16)
+          | (lut[512 + ((pixel >> 8) & 0xFF)] << 8)
+          | (pixel & 0xFF);
+      }
+      if (opaque) {
+        rgb[i*3 + 0] = pixel >> 24;
+        rgb[i*3 + 1] = pixel >> 16;
+        rgb[i*3 + 2] = pixel >> 8;
+      } else {
+        data_to_write[i] = need_byteswap ? byteswap(pixel) : pixel;
+      }
     }
   }
 
-  int rc = png_set_data(&png, img->width, img->height, 8, PNG_TRUECOLOR_ALPHA, (unsigned char *) data_to_write);
-  int success = (rc == PNG_NO_ERROR);
+  int color = opaque ? PNG_TRUECOLOR : PNG_TRUECOLOR_ALPHA;
+  int rc = png_set_data(&png, img->width, img->height, 8, color, (unsigned char *) data_to_write);
 
-  png_close_file(&png);
-  if (need_byteswap) {
+  // closing flushes the file, so it can fail even if every write succeeded
+  int close_rc = png_close_file(&png);
+  if (rc == PNG_NO_ERROR) {
+    rc = close_rc;
+  }
+  if (need_copy) {
     free(data_to_write);
   }
 
+  if (rc == PNG_CANCELLED) {
+    return IMG_ERR_CANCELLED;
+  }
+  return rc == PNG_NO_ERROR ? IMG_SUCCESS : IMG_ERR_COULD_NOT_WRITE;
+}
+
+int img_write(const char *filename, struct Image *img) {
+  return write_png(filename, img, NULL, NULL);
+}
+
+int img_write_cancellable(const char *filename, struct Image *img, const struct ImgCancel *cancel) {
+  return write_png(filename, img, NULL, cancel);
+}
+
+// Collects the distinct pixel values of img in palette (as RGBA
+// bytes, in order of first appearance) while storing the palette
+// index of every pixel in indices. Colors are looked up in a small
+// open-addressing hash set, and runs of identical pixels skip the
+// lookup entirely. Returns the number of colors, or -1 as soon as
+// a 257th color is seen.
+static int build_palette(struct Image *img, unsigned char *palette, unsigned char *indices) {
+  uint32_t keys[PALETTE_HASH_SIZE];
+  int16_t slots[PALETTE_HASH_SIZE];
+  for (int i = 0; i < PALETTE_HASH_SIZE; i++) {
+    slots[i] = -1;
+  }
+
+  int num_colors = 0;
+  uint32_t last_pixel = 0;
+  int last_index = -1;
+  int32_t num_pixels = img->width * img->height;
+
+  for (int32_t i = 0; i < num_pixels; i++) {
+    uint32_t pixel = img->data[i];
+    if (pixel != last_pixel || last_index < 0) {
+      uint32_t h = (pixel * 2654435761U) >> 22;
+      while (slots[h] >= 0 && keys[h] != pixel) {
+        h = (h + 1) & (PALETTE_HASH_SIZE - 1);
+      }
+      if (slots[h] < 0) {
+        if (num_colors == 256) {
+          return -1;
+        }
+        keys[h] = pixel;
+        slots[h] = num_colors;
+        palette[num_colors*4 + 0] = pixel >> 24;
+        palette[num_colors*4 + 1] = pixel >> 16;
+        palette[num_colors*4 + 2] = pixel >> 8;
+        palette[num_colors*4 + 3] = pixel;
+        num_colors++;
+      }
+      last_pixel = pixel;
+      last_index = slots[h];
+    }
+    indices[i] = last_index;
+  }
+
+  return num_colors;
+}
+
+int img_write_palette(const char *filename, struct Image *img) {
+  unsigned char palette[256 * 4];
+  unsigned char *indices = (unsigned char *) malloc(img->width * img->height);
+  if (indices == NULL) {
+    return IMG_ERR_MALLOC_FAILED;
+  }
+
+  int num_colors = build_palette(img, palette, indices);
+  if (num_colors <= 0) {
+    // too many colors for a palette (or no pixels at all)
+    free(indices);
+    return write_png(filename, img, NULL, NULL);
+  }
+
+  pthread_once(&png_init_once, init_png);
+
+  png_t png;
+
+  if (png_open_file_write(&png, filename) != PNG_NO_ERROR) {
+    free(indices);
+    return IMG_ERR_COULD_NOT_OPEN;
+  }
+
+  png_set_palette(&png, palette, num_colors);
+  int rc = png_set_data(&png, img->width, img->height, 8, PNG_INDEXED, indices);
+  int close_rc = png_close_file(&png);
+  int success = (rc == PNG_NO_ERROR && close_rc == PNG_NO_ERROR);
+  free(indices);
+
   return success ? IMG_SUCCESS : IMG_ERR_COULD_NOT_WRITE;
 }
 
+int img_write_lut(const char *filename, struct Image *img, const uint8_t *lut) {
+  return write_png(filename, img, lut, NULL);
+}
+
+int img_read_raw(FILE *in, struct Image *img) {
+  size_t num_pixels = (size_t) img->width * img->height;
+  size_t num_read = fread(img->data, sizeof(uint32_t), num_pixels, in);
+  if (num_read != num_pixels) {
+    return num_read == 0 && feof(in) ? IMG_END_OF_STREAM : IMG_ERR_TRUNCATED;
+  }
+
+  // the bytes of each pixel are in red, green, blue, alpha order,
+  // i.e. the pixel value in big-endian form
+  if (is_little_endian()) {
+    for (size_t i = 0; i < num_pixels; i++) {
+      img->data[i] = byteswap(img->data[i]);
+    }
+  }
+
+  return IMG_SUCCESS;
+}
+
+int img_write_raw(FILE *out, struct Image *img) {
+  size_t num_pixels = (size_t) img->width * img->height;
+  if (!is_little_endian()) {
+    return fwrite(img->data, sizeof(uint32_t), num_pixels, out) == num_pixels ? IMG_SUCCESS : IMG_ERR_COULD_NOT_WRITE;
+  }
+
+  uint32_t chunk[RAW_CHUNK];
+  for (size_t start = 0; start < num_pixels; start += RAW_CHUNK) {
+    size_t n = num_pixels - start < RAW_CHUNK ? num_pixels - start : RAW_CHUNK;
+    for (size_t i = 0; i < n; i++) {
+      chunk[i] = byteswap(img->data[start + i]);
+    }
+    if (fwrite(chunk, sizeof(uint32_t), n, out) != n) {
+      return IMG_ERR_COULD_NOT_WRITE;
+    }
+  }
+
+  return IMG_SUCCESS;
+}
+
 void img_cleanup( struct Image *img ) {
   // The data array is the only dynamically-allocated
   // part of the representation of a struct Image
@@ -7,9 +7,16 @@
 #define IMG_ERR_NOT_TRUECOLOR    -2
 #define IMG_ERR_MALLOC_FAILED    -3
 #define IMG_ERR_COULD_NOT_WRITE  -4
+#define IMG_ERR_TRUNCATED        -5
+#define IMG_ERR_INVALID_ARGUMENT -6
+#define IMG_ERR_CANCELLED        -7
+
+// return value from img_read_raw when the stream has no more frames
+#define IMG_END_OF_STREAM        1
 
 #ifndef ASM_SOURCE
 #include <stdint.h>
+#include <stdio.h>
 
 struct Image {
   int32_t width;
@@ -20,7 +27,8 @@ struct Image {
 // Initialize an Image struct instance by creating a pixel
 // buffer large enough to accommodate an image of the specified
 // dimensions, initialzing all pixels to opaque black,
-// and initialzing all of the struct Image field values.
+// and initialzing all of the struct Image field values. The pixel
+// buffer is aligned to a 64-byte cache line boundary.
 // This function only needs to be called if the program
 // needs to create an "empty" image in memory.
 //
@@ -35,7 +43,8 @@ struct Image {
 int img_init(struct Image *img, int32_t width, int32_t height);
 
 // Read PNG image data from a file and initialize the specified
-// Image struct instance.
+// Image struct instance. The file must hold an 8-bit truecolor
+// (RGB or RGBA) or 8-bit indexed image.
 //
 // Parameters:
 //   filename - name of PNG file to read
@@ -47,8 +56,109 @@ int img_init(struct Image *img, int32_t width, int32_t height);
 //   IMG_ERR_* values
 int img_read(const char *filename, struct Image *img);
 
+// A cancellation token: long-running operations that are given one
+// check it every band of rows (or every chunk of a PNG file) and stop
+// with IMG_ERR_CANCELLED once it has been cancelled or its deadline
+// has passed. Checking costs a load and, if there is a deadline, a
+// clock read, so it is negligible at that granularity.
+struct ImgCancel {
+  int cancelled;     // set by img_cancel_request (from any thread)
+  double deadline;   // CLOCK_MONOTONIC time in seconds, 0 if none
+  void (*yield)(void *arg);  // called by img_checkpoint, or NULL
+  void *yield_arg;           // argument passed to yield
+};
+
+// Initialize a cancellation token.
+//
+// Parameters:
+//   cancel - pointer to the token to initialize
+//   timeout - seconds from now until the token counts as cancelled,
+//             or 0 (or less) for no deadline
+void img_cancel_init(struct ImgCancel *cancel, double timeout);
+
+// Cancel the operations using a token. Safe to call from any thread.
+//
+// Parameters:
+//   cancel - pointer to the token
+void img_cancel_request(struct ImgCancel *cancel);
+
+// Check a cancellation token.
+//
+// Parameters:
+//   cancel - pointer to the token, or NULL (which is never cancelled)
+//
+// Returns:
+//   1 if the token was cancelled or its deadline has passed, 0 otherwise
+int img_cancelled(const struct ImgCancel *cancel);
+
+// Check a cancellation token at a point where a long operation can
+// be interrupted (e.g. between the bands of an img_band_* kernel).
+// If the token has a yield function, it's called first, so that the
+// token's owner (such as an ImgAsync pool) can run more urgent work
+// on this thread before the operation continues.
+//
+// Parameters:
+//   cancel - pointer to the token, or NULL (which is never cancelled)
+//
+// Returns:
+//   1 if the token was cancelled or its deadline has passed, 0 otherwise
+int img_checkpoint(const struct ImgCancel *cancel);
+
+// Read a PNG file like img_read, giving up if a cancellation token
+// is cancelled while the file is being decoded.
+//
+// Parameters:
+//   filename - name of PNG file to read
+//   img - pointer to Image struct to initialize with the loaded
+//         image data
+//   cancel - pointer to a cancellation token, or NULL
+//
+// Returns:
+//   IMG_SUCCESS if successful, IMG_ERR_CANCELLED if cancelled,
+//   otherwise one of the IMG_ERR_* values
+int img_read_cancellable(const char *filename, struct Image *img, const struct ImgCancel *cancel);
+
+// Read just the header (IHDR chunk) of a PNG file, giving the
+// dimensions of the image without decoding it.
+//
+// Parameters:
+//   filename - name of PNG file to read
+//   width - receives the image width
+//   height - receives the image height
+//   bpp - receives the number of bytes per pixel of the file's pixel
+//         data (3 for RGB, 4 for RGBA, 1 for indexed)
+//
+// Returns:
+//   IMG_SUCCESS if successful, otherwise one of the
+//   IMG_ERR_* values (IMG_ERR_NOT_TRUECOLOR if img_read can't
+//   read the file's pixel format)
+int img_read_header(const char *filename, int32_t *width, int32_t *height, int *bpp);
+
+// Read a PNG file and shrink it on the fly, giving the same image
+// as img_read followed by imgproc_squash (keeping every xfac'th pixel
+// of every yfac'th row) but without ever storing the full-size image:
+// rows are decoded one at a time and the unused ones are dropped.
+// xfac and yfac are chosen as large as possible while keeping the
+// result at least min_width pixels wide and min_height pixels tall
+// (or the full size, if the image is smaller than that).
+//
+// Parameters:
+//   filename - name of PNG file to read
+//   img - pointer to Image struct to initialize with the shrunken
+//         image data
+//   min_width - minimum width of the result
+//   min_height - minimum height of the result
+//
+// Returns:
+//   IMG_SUCCESS if successful, otherwise one of the
+//   IMG_ERR_* values
+int img_read_squashed(const char *filename, struct Image *img, int32_t min_width, int32_t min_height);
+
 // Write pixel data from specified Image struct instance to the
-// named PNG output file.
+// named PNG output file. If every pixel has an alpha value of 255,
+// the file is written as an RGB (truecolor without alpha) PNG,
+// otherwise as an RGBA PNG; img_read gives back the same pixels
+// either way.
 //
 // Parameters:
 //   filename - name of PNG file to write
@@ -60,6 +170,84 @@ int img_read(const char *filename, struct Image *img);
 //   IMG_ERR_* values
 int img_write(const char *filename, struct Image *img);
 
+// Write an image to a PNG file like img_write, giving up (leaving an
+// incomplete file) if a cancellation token is cancelled while the
+// pixel data is being compressed.
+//
+// Parameters:
+//   filename - name of PNG file to write
+//   img - pointer to Image struct with the pixel data to write
+//         to a PNG file
+//   cancel - pointer to a cancellation token, or NULL
+//
+// Returns:
+//   IMG_SUCCESS if successful, IMG_ERR_CANCELLED if cancelled,
+//   otherwise one of the IMG_ERR_* values
+int img_write_cancellable(const char *filename, struct Image *img, const struct ImgCancel *cancel);
+
+// Write pixel data to the named PNG output file like img_write, but
+// as an indexed (palette) PNG if the image has at most 256 distinct
+// pixel values. Colors are counted in a single pass that gives up
+// as soon as a 257th color is found, in which case the file is
+// written exactly like img_write does.
+//
+// Parameters:
+//   filename - name of PNG file to write
+//   img - pointer to Image struct with the pixel data to write
+//         to a PNG file
+//
+// Returns:
+//   IMG_SUCCESS if successful, otherwise one of the
+//   IMG_ERR_* values
+int img_write_palette(const char *filename, struct Image *img);
+
+// Write pixel data to the named PNG output file like img_write,
+// passing each color component through a lookup table on the way.
+// This gives the same file as applying the table with
+// imgproc_apply_lut and then calling img_write, without the extra
+// pass over the pixels.
+//
+// Parameters:
+//   filename - name of PNG file to write
+//   img - pointer to Image struct with the pixel data to write
+//         to a PNG file
+//   lut - 3 * 256 entry table: lut[v], lut[256 + v] and lut[512 + v]
+//         replace red, green and blue values of v (alpha values are
+//         written unchanged)
+//
+// Returns:
+//   IMG_SUCCESS if successful, otherwise one of the
+//   IMG_ERR_* values
+int img_write_lut(const char *filename, struct Image *img, const uint8_t *lut);
+
+// Read one raw frame from a stream into an Image whose dimensions
+// (and pixel buffer) have already been set up, e.g. by img_init.
+// A raw frame is width * height pixels in row-major order, each
+// pixel 4 bytes: red, green, blue, and alpha. The same Image can
+// be reused for every frame of a stream.
+//
+// Parameters:
+//   in - stream to read from
+//   img - pointer to Image struct to store the frame in
+//
+// Returns:
+//   IMG_SUCCESS if a frame was read, IMG_END_OF_STREAM if the
+//   stream ended before the frame started, IMG_ERR_TRUNCATED if
+//   it ended part way through the frame
+int img_read_raw(FILE *in, struct Image *img);
+
+// Write the pixels of an Image to a stream as one raw frame (see
+// img_read_raw). The pixels are converted in small chunks, so the
+// Image is left unchanged and no memory is allocated.
+//
+// Parameters:
+//   out - stream to write to
+//   img - pointer to Image struct with the pixel data to write
+//
+// Returns:
+//   IMG_SUCCESS if successful, IMG_ERR_COULD_NOT_WRITE otherwise
+int img_write_raw(FILE *out, struct Image *img);
+
 // De-allocate the dynamically-allocated memory used in the internal
 // representation of the given Image struct. Note that this function
 // does NOT de-allocate the struct Image instance itself (since allocating
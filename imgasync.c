@@ -0,0 +1,414 @@
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include "imgasync.h"
+
+// The kinds of jobs
+enum JobKind { JOB_READ, JOB_WRITE, JOB_COMPUTE };
+
+struct ImgJob {
+  enum JobKind kind;
+  char *filename;             // file to read or write
+  struct Image *img;          // image written, or read (until taken)
+  ImgComputeFn fn;
+  void *arg;
+  ImgJobCallback callback;
+  void *user;
+  struct ImgCancel cancel;
+  struct ImgAsync *pool;
+  enum ImgPriority priority;
+  double deadline;            // CLOCK_MONOTONIC time in seconds, 0 if none
+  double submitted;           // CLOCK_MONOTONIC time in seconds
+
+  pthread_mutex_t lock;       // protects rc, done and img
+  pthread_cond_t completed;
+  int rc;
+  int done;
+  int refs;                   // one for the caller, one for the pool
+  struct ImgJob *next;        // next job in the queue
+};
+
+// Jobs waiting for one group of worker threads, a list per priority
+// class in deadline order
+struct JobQueue {
+  struct ImgAsync *pool;
+  struct ImgJob *heads[IMG_NUM_PRIORITIES], *tails[IMG_NUM_PRIORITIES];
+  pthread_cond_t ready;       // signaled when a job is queued
+  pthread_t *threads;
+  int num_threads;
+  int idle;                   // threads waiting for a job
+};
+
+// Latencies of the recently completed jobs of a priority class
+struct LatencyLog {
+  double samples[IMG_ASYNC_LATENCY_SAMPLES];  // circular, by completion
+  long completed;
+};
+
+struct ImgAsync {
+  pthread_mutex_t lock;       // protects the queues, pending, stopping and latency
+  pthread_cond_t idle;        // signaled when pending drops to 0
+  struct JobQueue io, compute;
+  int pending;                // jobs submitted but not completed
+  int stopping;
+  int pipe_fds[2];            // completion notifications
+  struct LatencyLog latency[IMG_NUM_PRIORITIES];
+};
+
+// Returns the current CLOCK_MONOTONIC time in seconds.
+static double monotonic_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Drop one reference to a job, freeing it when none are left.
+static void job_unref(struct ImgJob *job) {
+  if (__atomic_sub_fetch(&job->refs, 1, __ATOMIC_ACQ_REL) > 0) {
+    return;
+  }
+  if (job->kind == JOB_READ && job->img != NULL) {
+    img_cleanup(job->img);
+    free(job->img);
+  }
+  free(job->filename);
+  pthread_mutex_destroy(&job->lock);
+  pthread_cond_destroy(&job->completed);
+  free(job);
+}
+
+static int run_job(struct ImgJob *job) {
+  switch (job->kind) {
+  case JOB_READ: {
+    struct Image *img = malloc(sizeof(struct Image));
+    if (img == NULL) {
+      return IMG_ERR_MALLOC_FAILED;
+    }
+    int rc = img_read_cancellable(job->filename, img, &job->cancel);
+    if (rc != IMG_SUCCESS) {
+      free(img);
+      return rc;
+    }
+    job->img = img;
+    return IMG_SUCCESS;
+  }
+  case JOB_WRITE:
+    return img_write_cancellable(job->filename, job->img, &job->cancel);
+  default:
+    return job->fn(job->arg, &job->cancel);
+  }
+}
+
+// Remove the first job of the most urgent class of a queue that is
+// more urgent than a given class (the pool's lock must be held).
+// Returns the job, or NULL if there is none.
+static struct ImgJob *dequeue(struct JobQueue *queue, enum ImgPriority before) {
+  for (int p = 0; p < (int) before; p++) {
+    struct ImgJob *job = queue->heads[p];
+    if (job != NULL) {
+      queue->heads[p] = job->next;
+      if (queue->heads[p] == NULL) {
+        queue->tails[p] = NULL;
+      }
+      return job;
+    }
+  }
+  return NULL;
+}
+
+// Run a job taken from a queue and complete it.
+static void execute_job(struct ImgAsync *pool, struct ImgJob *job) {
+  int rc = img_cancelled(&job->cancel) ? IMG_ERR_CANCELLED : run_job(job);
+
+  // logged before the job completes, so its handle's holder sees it
+  pthread_mutex_lock(&pool->lock);
+  struct LatencyLog *log = &pool->latency[job->priority];
+  log->samples[log->completed++ % IMG_ASYNC_LATENCY_SAMPLES] = monotonic_seconds() - job->submitted;
+  pthread_mutex_unlock(&pool->lock);
+
+  pthread_mutex_lock(&job->lock);
+  job->rc = rc;
+  job->done = 1;
+  pthread_cond_broadcast(&job->completed);
+  pthread_mutex_unlock(&job->lock);
+
+  char byte = 0;
+  if (write(pool->pipe_fds[1], &byte, 1) < 0) {
+    // the pipe is full: the reader has notifications pending anyway
+  }
+  if (job->callback != NULL) {
+    job->callback(job, job->user);
+  }
+  job_unref(job);
+
+  pthread_mutex_lock(&pool->lock);
+  if (--pool->pending == 0) {
+    pthread_cond_broadcast(&pool->idle);
+  }
+  pthread_mutex_unlock(&pool->lock);
+}
+
+// Yield function of compute jobs' cancellation tokens: while every
+// compute thread is busy, runs the waiting compute jobs that are more
+// urgent than the running one.
+static void preempt(void *arg) {
+  struct ImgJob *running = arg;
+  struct ImgAsync *pool = running->pool;
+  for (;;) {
+    pthread_mutex_lock(&pool->lock);
+    struct ImgJob *job = pool->compute.idle == 0 ? dequeue(&pool->compute, running->priority) : NULL;
+    pthread_mutex_unlock(&pool->lock);
+    if (job == NULL) {
+      return;
+    }
+    execute_job(pool, job);
+  }
+}
+
+static void *async_worker(void *arg) {
+  struct JobQueue *queue = arg;
+  struct ImgAsync *pool = queue->pool;
+  for (;;) {
+    pthread_mutex_lock(&pool->lock);
+    struct ImgJob *job;
+    while ((job = dequeue(queue, IMG_NUM_PRIORITIES)) == NULL && !pool->stopping) {
+      queue->idle++;
+      pthread_cond_wait(&queue->ready, &pool->lock);
+      queue->idle--;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    if (job == NULL) {
+      return NULL;
+    }
+    execute_job(pool, job);
+  }
+}
+
+// Start the threads of a queue.
+// Returns 1 if at least one thread was started, 0 otherwise.
+static int start_queue(struct ImgAsync *pool, struct JobQueue *queue, int num_threads) {
+  queue->pool = pool;
+  pthread_cond_init(&queue->ready, NULL);
+  queue->threads = malloc((num_threads > 0 ? num_threads : 1) * sizeof(pthread_t));
+  queue->num_threads = 0;
+  if (queue->threads == NULL) {
+    return 0;
+  }
+  while (queue->num_threads < num_threads
+         && pthread_create(&queue->threads[queue->num_threads], NULL, async_worker, queue) == 0) {
+    queue->num_threads++;
+  }
+  return queue->num_threads > 0;
+}
+
+// Stop and join the threads of a queue (the pool must be stopping).
+static void stop_queue(struct JobQueue *queue) {
+  for (int t = 0; t < queue->num_threads; t++) {
+    pthread_join(queue->threads[t], NULL);
+  }
+  free(queue->threads);
+  pthread_cond_destroy(&queue->ready);
+}
+
+struct ImgAsync *img_async_create(int io_threads, int compute_threads) {
+  struct ImgAsync *pool = calloc(1, sizeof(struct ImgAsync));
+  if (pool == NULL) {
+    return NULL;
+  }
+  if (pipe(pool->pipe_fds) != 0) {
+    free(pool);
+    return NULL;
+  }
+  for (int k = 0; k < 2; k++) {
+    fcntl(pool->pipe_fds[k], F_SETFL, fcntl(pool->pipe_fds[k], F_GETFL) | O_NONBLOCK);
+  }
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->idle, NULL);
+
+  int started = start_queue(pool, &pool->io, io_threads > 1 ? io_threads : 1);
+  started = start_queue(pool, &pool->compute, compute_threads > 1 ? compute_threads : 1) && started;
+  if (!started) {
+    img_async_destroy(pool);
+    return NULL;
+  }
+  return pool;
+}
+
+void img_async_destroy(struct ImgAsync *pool) {
+  pthread_mutex_lock(&pool->lock);
+  while (pool->pending > 0) {
+    pthread_cond_wait(&pool->idle, &pool->lock);
+  }
+  pool->stopping = 1;
+  pthread_cond_broadcast(&pool->io.ready);
+  pthread_cond_broadcast(&pool->compute.ready);
+  pthread_mutex_unlock(&pool->lock);
+
+  stop_queue(&pool->io);
+  stop_queue(&pool->compute);
+  close(pool->pipe_fds[0]);
+  close(pool->pipe_fds[1]);
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy(&pool->idle);
+  free(pool);
+}
+
+int img_async_fd(struct ImgAsync *pool) {
+  return pool->pipe_fds[0];
+}
+
+static int compare_latencies(const void *a, const void *b) {
+  double x = *(const double *) a, y = *(const double *) b;
+  return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+void img_async_stats(struct ImgAsync *pool, enum ImgPriority priority, struct ImgAsyncStats *stats) {
+  double sorted[IMG_ASYNC_LATENCY_SAMPLES];
+  pthread_mutex_lock(&pool->lock);
+  const struct LatencyLog *log = &pool->latency[priority];
+  stats->completed = log->completed;
+  int n = log->completed < IMG_ASYNC_LATENCY_SAMPLES ? (int) log->completed : IMG_ASYNC_LATENCY_SAMPLES;
+  memcpy(sorted, log->samples, n * sizeof(double));
+  pthread_mutex_unlock(&pool->lock);
+
+  if (n == 0) {
+    stats->p50 = stats->p90 = stats->p99 = stats->max = 0.0;
+    return;
+  }
+  // nearest-rank percentiles
+  qsort(sorted, n, sizeof(double), compare_latencies);
+  stats->p50 = sorted[(n * 50 + 99) / 100 - 1];
+  stats->p90 = sorted[(n * 90 + 99) / 100 - 1];
+  stats->p99 = sorted[(n * 99 + 99) / 100 - 1];
+  stats->max = sorted[n - 1];
+}
+
+// Create a job (referenced by both the caller and the pool).
+// Returns the job's handle, or NULL if it couldn't be allocated.
+static struct ImgJob *new_job(struct ImgAsync *pool, enum JobKind kind, const char *filename,
+                              const struct ImgJobOptions *options, ImgJobCallback callback, void *user) {
+  struct ImgJob *job = calloc(1, sizeof(struct ImgJob));
+  if (job == NULL) {
+    return NULL;
+  }
+  if (filename != NULL) {
+    job->filename = strdup(filename);
+    if (job->filename == NULL) {
+      free(job);
+      return NULL;
+    }
+  }
+  job->kind = kind;
+  job->callback = callback;
+  job->user = user;
+  job->refs = 2;
+  job->pool = pool;
+  job->priority = options != NULL ? options->priority : IMG_PRIORITY_NORMAL;
+  job->submitted = monotonic_seconds();
+  job->deadline = options != NULL && options->deadline > 0 ? job->submitted + options->deadline : 0.0;
+  img_cancel_init(&job->cancel, options != NULL ? options->timeout : 0.0);
+  pthread_mutex_init(&job->lock, NULL);
+  pthread_cond_init(&job->completed, NULL);
+  return job;
+}
+
+// Returns 1 if job a is due before job b (jobs without a deadline are
+// due after all those with one), 0 otherwise.
+static int due_before(const struct ImgJob *a, const struct ImgJob *b) {
+  return a->deadline > 0 && (b->deadline == 0 || a->deadline < b->deadline);
+}
+
+// Add a job to a queue, after the jobs of its class that are due no
+// later.
+// Returns the job's handle.
+static struct ImgJob *enqueue(struct ImgAsync *pool, struct JobQueue *queue, struct ImgJob *job) {
+  pthread_mutex_lock(&pool->lock);
+  struct ImgJob **link = &queue->heads[job->priority];
+  if (queue->tails[job->priority] != NULL && !due_before(job, queue->tails[job->priority])) {
+    link = &queue->tails[job->priority]->next;
+  } else {
+    while (*link != NULL && !due_before(job, *link)) {
+      link = &(*link)->next;
+    }
+  }
+  job->next = *link;
+  *link = job;
+  if (job->next == NULL) {
+    queue->tails[job->priority] = job;
+  }
+  pool->pending++;
+  pthread_cond_signal(&queue->ready);
+  pthread_mutex_unlock(&pool->lock);
+  return job;
+}
+
+struct ImgJob *img_async_read(struct ImgAsync *pool, const char *filename, const struct ImgJobOptions *options,
+                              ImgJobCallback callback, void *user) {
+  struct ImgJob *job = new_job(pool, JOB_READ, filename, options, callback, user);
+  return job != NULL ? enqueue(pool, &pool->io, job) : NULL;
+}
+
+struct ImgJob *img_async_write(struct ImgAsync *pool, const char *filename, struct Image *img,
+                               const struct ImgJobOptions *options, ImgJobCallback callback, void *user) {
+  struct ImgJob *job = new_job(pool, JOB_WRITE, filename, options, callback, user);
+  if (job == NULL) {
+    return NULL;
+  }
+  job->img = img;
+  return enqueue(pool, &pool->io, job);
+}
+
+struct ImgJob *img_async_compute(struct ImgAsync *pool, ImgComputeFn fn, void *arg,
+                                 const struct ImgJobOptions *options, ImgJobCallback callback, void *user) {
+  struct ImgJob *job = new_job(pool, JOB_COMPUTE, NULL, options, callback, user);
+  if (job == NULL) {
+    return NULL;
+  }
+  job->fn = fn;
+  job->arg = arg;
+  job->cancel.yield = preempt;
+  job->cancel.yield_arg = job;
+  return enqueue(pool, &pool->compute, job);
+}
+
+void img_job_cancel(struct ImgJob *job) {
+  img_cancel_request(&job->cancel);
+}
+
+int img_job_poll(struct ImgJob *job, int *rc) {
+  pthread_mutex_lock(&job->lock);
+  int done = job->done;
+  if (done) {
+    *rc = job->rc;
+  }
+  pthread_mutex_unlock(&job->lock);
+  return done;
+}
+
+int img_job_wait(struct ImgJob *job) {
+  pthread_mutex_lock(&job->lock);
+  while (!job->done) {
+    pthread_cond_wait(&job->completed, &job->lock);
+  }
+  int rc = job->rc;
+  pthread_mutex_unlock(&job->lock);
+  return rc;
+}
+
+struct Image *img_job_take_image(struct ImgJob *job) {
+  pthread_mutex_lock(&job->lock);
+  struct Image *img = NULL;
+  if (job->done && job->kind == JOB_READ) {
+    img = job->img;
+    job->img = NULL;
+  }
+  pthread_mutex_unlock(&job->lock);
+  return img;
+}
+
+void img_job_release(struct ImgJob *job) {
+  job_unref(job);
+}
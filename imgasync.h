@@ -0,0 +1,214 @@
+#ifndef IMGASYNC_H
+#define IMGASYNC_H
+
+#include "image.h"
+
+// Asynchronous image jobs, for programs (such as event-loop services)
+// that must not block on reading, processing or writing images.
+//
+// An ImgAsync has two groups of worker threads: one for file reads and
+// writes and one for computation, so slow disks don't hold up the
+// CPU-bound jobs and vice versa. Submitting a job returns at once with
+// an ImgJob handle. The job's completion can be collected by polling
+// or waiting on the handle, by a callback (run on the worker thread
+// that finished the job), or by watching the pool's completion file
+// descriptor (see img_async_fd) from an event loop.
+//
+// Every job has a cancellation token (see struct ImgCancel), which
+// img_job_cancel cancels and which expires after the job's timeout,
+// if it has one. A job that is cancelled before it starts doesn't
+// run; reads, writes and compute functions that check the token stop
+// early. Either way the job's result is IMG_ERR_CANCELLED.
+//
+// Jobs are queued by the priority class given in their options (see
+// struct ImgJobOptions): a worker thread always takes a waiting job of
+// the most urgent class, and within a class the job with the earliest
+// deadline (jobs without one come after those with one, in the order
+// they were submitted). When a job of a more urgent class is waiting
+// and every compute thread is busy, a compute job that reaches a
+// checkpoint (see img_checkpoint; the img_band_* kernels have one
+// between bands) runs it on its own thread before continuing, so a
+// long bulk job holds up an interactive one by at most one band.
+
+// Opaque types: a pool of worker threads, and a submitted job
+struct ImgAsync;
+struct ImgJob;
+
+// Priority classes, most urgent first
+enum ImgPriority {
+  IMG_PRIORITY_INTERACTIVE,
+  IMG_PRIORITY_NORMAL,        // the default
+  IMG_PRIORITY_BULK,
+  IMG_NUM_PRIORITIES
+};
+
+// Number of recent jobs of each class whose latency is kept for
+// img_async_stats
+#define IMG_ASYNC_LATENCY_SAMPLES 1024
+
+// Scheduling options of a job. Unlike the timeout, the deadline only
+// orders jobs within their class; a job that misses it still runs.
+struct ImgJobOptions {
+  enum ImgPriority priority;  // priority class
+  double deadline;            // seconds from submission by which the job
+                              // should be done, or 0 (or less) for none
+  double timeout;             // seconds from submission after which the
+                              // job is cancelled, or 0 (or less) for none
+};
+
+// Latency statistics of a priority class. Latency is the time from a
+// job's submission to its completion; the percentiles are over the
+// most recent IMG_ASYNC_LATENCY_SAMPLES jobs (0 if there are none).
+struct ImgAsyncStats {
+  long completed;             // jobs of the class completed so far
+  double p50, p90, p99, max;  // latencies, in seconds
+};
+
+// Function run by a compute job, given the job's cancellation token
+// (to pass on to img_band_* kernels, or to check itself). It returns
+// IMG_SUCCESS or one of the IMG_ERR_* values, which becomes the job's
+// result.
+typedef int (*ImgComputeFn)(void *arg, const struct ImgCancel *cancel);
+
+// Function called on the worker thread when a job completes (after
+// its result is available through the handle).
+typedef void (*ImgJobCallback)(struct ImgJob *job, void *user);
+
+// Create a pool of worker threads.
+//
+// Parameters:
+//   io_threads - number of threads for reading and writing files
+//                (values below 1 are treated as 1)
+//   compute_threads - number of threads for compute jobs (values
+//                     below 1 are treated as 1)
+//
+// Returns:
+//   pointer to the pool, or NULL if it couldn't be created
+struct ImgAsync *img_async_create(int io_threads, int compute_threads);
+
+// Wait for every submitted job to complete, then stop the worker
+// threads and free the pool. Job handles that haven't been released
+// stay valid.
+//
+// Parameters:
+//   pool - pointer to the pool
+void img_async_destroy(struct ImgAsync *pool);
+
+// Get a file descriptor that becomes readable when jobs complete
+// (a byte is written to it for each completed job, as long as there
+// is room in the pipe). An event loop should drain it and then poll
+// the handles of its outstanding jobs. The descriptor is non-blocking
+// and is closed by img_async_destroy.
+//
+// Parameters:
+//   pool - pointer to the pool
+//
+// Returns:
+//   the file descriptor
+int img_async_fd(struct ImgAsync *pool);
+
+// Get the latency statistics of a priority class.
+//
+// Parameters:
+//   pool - pointer to the pool
+//   priority - priority class
+//   stats - receives the statistics
+void img_async_stats(struct ImgAsync *pool, enum ImgPriority priority, struct ImgAsyncStats *stats);
+
+// Submit a job that reads a PNG file with img_read. When it succeeds,
+// the image can be taken with img_job_take_image.
+//
+// Parameters:
+//   pool - pointer to the pool
+//   filename - name of PNG file to read (copied)
+//   options - the job's scheduling options (copied), or NULL for
+//             IMG_PRIORITY_NORMAL without a deadline or timeout
+//   callback - function to call when the job completes, or NULL
+//   user - argument passed to the callback
+//
+// Returns:
+//   handle of the job, or NULL if it couldn't be submitted
+struct ImgJob *img_async_read(struct ImgAsync *pool, const char *filename, const struct ImgJobOptions *options,
+                              ImgJobCallback callback, void *user);
+
+// Submit a job that writes an image to a PNG file with img_write. The
+// image must not be changed or freed until the job completes.
+//
+// Parameters:
+//   pool - pointer to the pool
+//   filename - name of PNG file to write (copied)
+//   img - pointer to the Image to write
+//   options - the job's scheduling options (copied), or NULL for
+//             IMG_PRIORITY_NORMAL without a deadline or timeout
+//   callback - function to call when the job completes, or NULL
+//   user - argument passed to the callback
+//
+// Returns:
+//   handle of the job, or NULL if it couldn't be submitted
+struct ImgJob *img_async_write(struct ImgAsync *pool, const char *filename, struct Image *img,
+                               const struct ImgJobOptions *options, ImgJobCallback callback, void *user);
+
+// Submit a job that runs a function (e.g. one that calls imgproc_*
+// kernels) on a compute thread.
+//
+// Parameters:
+//   pool - pointer to the pool
+//   fn - function to run
+//   arg - argument passed to fn
+//   options - the job's scheduling options (copied), or NULL for
+//             IMG_PRIORITY_NORMAL without a deadline or timeout
+//   callback - function to call when the job completes, or NULL
+//   user - argument passed to the callback
+//
+// Returns:
+//   handle of the job, or NULL if it couldn't be submitted
+struct ImgJob *img_async_compute(struct ImgAsync *pool, ImgComputeFn fn, void *arg,
+                                 const struct ImgJobOptions *options, ImgJobCallback callback, void *user);
+
+// Cancel a job. Safe to call from any thread, at any time before the
+// handle is released.
+//
+// Parameters:
+//   job - handle of the job
+void img_job_cancel(struct ImgJob *job);
+
+// Check whether a job has completed, without blocking.
+//
+// Parameters:
+//   job - handle of the job
+//   rc - receives the job's result (IMG_SUCCESS or one of the
+//        IMG_ERR_* values) if it has completed
+//
+// Returns:
+//   1 if the job has completed, 0 otherwise
+int img_job_poll(struct ImgJob *job, int *rc);
+
+// Wait until a job has completed.
+//
+// Parameters:
+//   job - handle of the job
+//
+// Returns:
+//   the job's result: IMG_SUCCESS or one of the IMG_ERR_* values
+int img_job_wait(struct ImgJob *job);
+
+// Take the image read by a completed read job. The caller becomes
+// responsible for freeing it (with img_cleanup and free).
+//
+// Parameters:
+//   job - handle of a completed read job
+//
+// Returns:
+//   pointer to the image, or NULL if the read failed or the image
+//   was already taken
+struct Image *img_job_take_image(struct ImgJob *job);
+
+// Release a job handle. A job that hasn't completed still runs; its
+// resources are freed once it completes. An image read by the job
+// that wasn't taken is freed.
+//
+// Parameters:
+//   job - handle of the job
+void img_job_release(struct ImgJob *job);
+
+#endif
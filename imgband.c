@@ -0,0 +1,74 @@
+#include <stdlib.h>
+#include <string.h>
+#include "imgproc.h"
+#include "imgband.h"
+
+// Number of output pixels in a band (at least one row)
+#define BAND_PIXELS (256 * 1024)
+
+// Minimum height of a blur band, in multiples of the blur distance
+#define BLUR_BAND_DISTS 32
+
+// Returns the number of rows of a band of an image with the given width.
+static int32_t band_rows(int32_t width) {
+  return width > 0 && BAND_PIXELS / width > 1 ? BAND_PIXELS / width : 1;
+}
+
+int img_band_squash(struct Image *input_img, struct Image *output_img, int32_t xfac, int32_t yfac,
+                    const struct ImgCancel *cancel) {
+  int32_t rows = band_rows(output_img->width);
+  for (int32_t row = 0; row < output_img->height; row += rows) {
+    if (img_checkpoint(cancel)) {
+      return IMG_ERR_CANCELLED;
+    }
+
+    // output row r only reads input row r * yfac
+    int32_t n = output_img->height - row < rows ? output_img->height - row : rows;
+    struct Image in_band = { input_img->width, n * yfac,
+                             input_img->data + (size_t) row * yfac * input_img->width };
+    struct Image out_band = { output_img->width, n, output_img->data + (size_t) row * output_img->width };
+    imgproc_squash(&in_band, &out_band, xfac, yfac);
+  }
+  return IMG_SUCCESS;
+}
+
+int img_band_blur(struct Image *input_img, struct Image *output_img, int32_t blur_dist,
+                  const struct ImgCancel *cancel) {
+  int32_t width = input_img->width;
+  int32_t height = input_img->height;
+  int32_t rows = band_rows(width);
+  if (rows < BLUR_BAND_DISTS * blur_dist) {
+    rows = BLUR_BAND_DISTS * blur_dist;
+  }
+
+  // the blur_dist rows above a band are blurred again (with clipped
+  // windows) along with it; their finished values are saved here and
+  // put back afterwards
+  size_t halo_pixels = (size_t) (blur_dist < height ? blur_dist : height) * width;
+  uint32_t *saved = malloc((halo_pixels > 0 ? halo_pixels : 1) * sizeof(uint32_t));
+  if (saved == NULL) {
+    return IMG_ERR_MALLOC_FAILED;
+  }
+
+  int rc = IMG_SUCCESS;
+  for (int32_t row = 0; row < height; row += rows) {
+    if (img_checkpoint(cancel)) {
+      rc = IMG_ERR_CANCELLED;
+      break;
+    }
+
+    int32_t top = row - blur_dist > 0 ? row - blur_dist : 0;
+    int32_t end = row + rows + blur_dist < height ? row + rows + blur_dist : height;
+    struct Image in_band = { width, end - top, input_img->data + (size_t) top * width };
+    struct Image out_band = { width, end - top, output_img->data + (size_t) top * width };
+
+    // rows below the band are overwritten by the next band
+    size_t saved_pixels = (size_t) (row - top) * width;
+    memcpy(saved, out_band.data, saved_pixels * sizeof(uint32_t));
+    imgproc_blur(&in_band, &out_band, blur_dist);
+    memcpy(out_band.data, saved, saved_pixels * sizeof(uint32_t));
+  }
+
+  free(saved);
+  return rc;
+}
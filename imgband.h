@@ -0,0 +1,48 @@
+#ifndef IMGBAND_H
+#define IMGBAND_H
+
+#include "image.h"
+
+// Cancellable versions of imgproc kernels. The kernel is applied to
+// one band of rows at a time (through Image views of the bands), and
+// a cancellation token is checked between bands (with img_checkpoint),
+// so an abandoned request stops within one band's worth of work, and
+// a pool can run more urgent jobs in between. The results are the
+// same as those of the imgproc_* functions.
+
+// Squash an image like imgproc_squash, one band of output rows at a
+// time.
+//
+// Parameters:
+//   input_img - pointer to the input Image
+//   output_img - pointer to the output Image (input_img->width / xfac
+//                pixels wide and input_img->height / yfac pixels tall)
+//   xfac - factor to downsize the image horizontally; must be positive
+//   yfac - factor to downsize the image vertically; must be positive
+//   cancel - pointer to a cancellation token, or NULL
+//
+// Returns:
+//   IMG_SUCCESS if successful, IMG_ERR_CANCELLED if cancelled (the
+//   output is then incomplete)
+int img_band_squash(struct Image *input_img, struct Image *output_img, int32_t xfac, int32_t yfac,
+                    const struct ImgCancel *cancel);
+
+// Blur an image like imgproc_blur, one band of rows at a time. Each
+// band is blurred together with the blur_dist rows on either side of
+// it (which its windows reach into); bands are at least 32 times
+// blur_dist rows tall, so the extra rows add at most a sixteenth to
+// the work.
+//
+// Parameters:
+//   input_img - pointer to the input Image
+//   output_img - pointer to the output Image (same dimensions)
+//   blur_dist - blur distance; must not be negative
+//   cancel - pointer to a cancellation token, or NULL
+//
+// Returns:
+//   IMG_SUCCESS if successful, IMG_ERR_CANCELLED if cancelled (the
+//   output is then incomplete), otherwise one of the IMG_ERR_* values
+int img_band_blur(struct Image *input_img, struct Image *output_img, int32_t blur_dist,
+                  const struct ImgCancel *cancel);
+
+#endif
@@ -0,0 +1,165 @@
+#include <stdlib.h>
+#include "imgproc.h"
+#include "imgparallel.h"
+#include "imgbatch.h"
+
+// Number of output pixels a batch task aims to cover
+#define BATCH_TASK_PIXELS (64 * 1024)
+
+// The operations a batch can apply
+enum BatchOp { BATCH_SQUASH, BATCH_BLUR };
+
+// A task: the output rows from (first_image, first_row) up to, but
+// not including, (last_image, last_row), in batch order
+struct BatchTask {
+  int first_image;
+  int32_t first_row;
+  int last_image;
+  int32_t last_row;
+  int done;
+};
+
+// Work shared by the threads of a batch
+struct BatchWork {
+  enum BatchOp op;
+  struct Image **inputs;
+  struct Image **outputs;
+  const int32_t *args[2];
+  const int *status;
+  const struct ImgCancel *cancel;
+  struct BatchTask *tasks;
+  int num_tasks;
+};
+
+// Apply the batch's operation to output rows row_begin .. row_end - 1
+// of image i.
+static void batch_apply(struct BatchWork *work, int i, int32_t row_begin, int32_t row_end) {
+  struct Image *in = work->inputs[i];
+  struct Image *out = work->outputs[i];
+  if (work->op == BATCH_BLUR) {
+    imgproc_blur(in, out, work->args[0][i]);
+    return;
+  }
+
+  // output row r of a squash only reads input row r * yfac, so a band
+  // of output rows is the squash of a band of input rows
+  int32_t yfac = work->args[1][i];
+  struct Image in_band = { in->width, (row_end - row_begin) * yfac, in->data + (size_t) row_begin * yfac * in->width };
+  struct Image out_band = { out->width, row_end - row_begin, out->data + (size_t) row_begin * out->width };
+  imgproc_squash(&in_band, &out_band, work->args[0][i], yfac);
+}
+
+// ImgItemFn running a task, unless the batch has been cancelled
+static void batch_task(void *arg, int t) {
+  struct BatchWork *work = arg;
+  if (img_cancelled(work->cancel)) {
+    return;
+  }
+
+  struct BatchTask *task = &work->tasks[t];
+  for (int i = task->first_image; i <= task->last_image; i++) {
+    int32_t row_begin = i == task->first_image ? task->first_row : 0;
+    int32_t row_end = i == task->last_image ? task->last_row : work->outputs[i]->height;
+    if (work->status[i] == IMG_SUCCESS && row_begin < row_end) {
+      batch_apply(work, i, row_begin, row_end);
+    }
+  }
+  task->done = 1;
+}
+
+// Cut the valid images of a batch into tasks of about
+// BATCH_TASK_PIXELS output pixels each (whole images only, unless
+// split_rows is set), then run the tasks on num_threads threads. The
+// images of tasks that didn't run because of cancellation get the
+// status IMG_ERR_CANCELLED.
+// Returns IMG_SUCCESS, IMG_ERR_CANCELLED, or IMG_ERR_MALLOC_FAILED.
+static int run_batch(struct BatchWork *work, int count, int split_rows, int num_threads, int *status) {
+  // there are at most this many tasks: one per image, plus one per
+  // BATCH_TASK_PIXELS of output
+  int64_t total_pixels = 0;
+  for (int i = 0; i < count; i++) {
+    if (work->status[i] == IMG_SUCCESS) {
+      total_pixels += (int64_t) work->outputs[i]->width * work->outputs[i]->height;
+    }
+  }
+  int64_t max_tasks = count + total_pixels / BATCH_TASK_PIXELS + 1;
+  work->tasks = malloc(max_tasks * sizeof(struct BatchTask));
+  if (work->tasks == NULL) {
+    return IMG_ERR_MALLOC_FAILED;
+  }
+
+  work->num_tasks = 0;
+  int64_t pixels = 0;
+  struct BatchTask task = { 0, 0, 0, 0, 0 };
+  for (int i = 0; i < count; i++) {
+    if (work->status[i] != IMG_SUCCESS) {
+      continue;
+    }
+    int32_t width = work->outputs[i]->width;
+    int32_t height = work->outputs[i]->height;
+    int32_t row = 0;
+    while (row < height) {
+      // take rows until the task is full (or the image is done)
+      int32_t rows = height - row;
+      if (split_rows && width > 0 && pixels + (int64_t) rows * width > BATCH_TASK_PIXELS) {
+        rows = (BATCH_TASK_PIXELS - pixels + width - 1) / width;
+      }
+      if (pixels == 0) {
+        task.first_image = i;
+        task.first_row = row;
+      }
+      row += rows;
+      pixels += (int64_t) rows * width;
+      task.last_image = i;
+      task.last_row = row;
+      if (pixels >= BATCH_TASK_PIXELS) {
+        work->tasks[work->num_tasks++] = task;
+        pixels = 0;
+      }
+    }
+  }
+  if (pixels > 0) {
+    work->tasks[work->num_tasks++] = task;
+  }
+
+  img_parallel_for(work->num_tasks, num_threads, batch_task, work);
+
+  int rc = IMG_SUCCESS;
+  for (int t = 0; t < work->num_tasks; t++) {
+    if (!work->tasks[t].done) {
+      for (int i = work->tasks[t].first_image; i <= work->tasks[t].last_image; i++) {
+        if (status[i] == IMG_SUCCESS) {
+          status[i] = IMG_ERR_CANCELLED;
+        }
+      }
+      rc = IMG_ERR_CANCELLED;
+    }
+  }
+  free(work->tasks);
+  return rc;
+}
+
+int img_batch_squash(struct Image **inputs, struct Image **outputs, const int32_t *xfacs,
+                     const int32_t *yfacs, int count, int num_threads, const struct ImgCancel *cancel,
+                     int *status) {
+  for (int i = 0; i < count; i++) {
+    int valid = inputs[i] != NULL && outputs[i] != NULL && xfacs[i] > 0 && yfacs[i] > 0
+      && outputs[i]->width == inputs[i]->width / xfacs[i] && outputs[i]->height == inputs[i]->height / yfacs[i];
+    status[i] = valid ? IMG_SUCCESS : IMG_ERR_INVALID_ARGUMENT;
+  }
+
+  struct BatchWork work = { BATCH_SQUASH, inputs, outputs, { xfacs, yfacs }, status, cancel };
+  return run_batch(&work, count, 1, num_threads, status);
+}
+
+int img_batch_blur(struct Image **inputs, struct Image **outputs, const int32_t *blur_dists,
+                   int count, int num_threads, const struct ImgCancel *cancel, int *status) {
+  for (int i = 0; i < count; i++) {
+    int valid = inputs[i] != NULL && outputs[i] != NULL && blur_dists[i] >= 0
+      && outputs[i]->width == inputs[i]->width && outputs[i]->height == inputs[i]->height;
+    status[i] = valid ? IMG_SUCCESS : IMG_ERR_INVALID_ARGUMENT;
+  }
+
+  struct BatchWork work = { BATCH_BLUR, inputs, outputs, { blur_dists, NULL }, status, cancel };
+  return run_batch(&work, count, 0, num_threads, status);
+}
@@ -0,0 +1,64 @@
+#ifndef IMGBATCH_H
+#define IMGBATCH_H
+
+#include "image.h"
+
+// Batched versions of imgproc_squash and imgproc_blur for many small
+// images. The work of the whole batch is cut into tasks of roughly
+// equal size (a task covers consecutive rows that may span several
+// images), and the tasks are shared by a group of threads, so short
+// images neither pay for a thread start each nor leave threads idle
+// while a larger one finishes. A cancellation token is checked before
+// each task; the images whose tasks didn't all run are given the
+// status IMG_ERR_CANCELLED.
+
+// Squash every image of a batch, like imgproc_squash.
+//
+// Parameters:
+//   inputs - array of pointers to the input images
+//   outputs - array of pointers to the output images; output i must
+//             be inputs[i]->width / xfacs[i] pixels wide and
+//             inputs[i]->height / yfacs[i] pixels tall
+//   xfacs - horizontal factor for each image
+//   yfacs - vertical factor for each image
+//   count - number of images in the batch
+//   num_threads - number of threads to use (values below 1 are
+//                 treated as 1)
+//   cancel - pointer to a cancellation token, or NULL
+//   status - array that receives, for each image, IMG_SUCCESS,
+//            IMG_ERR_INVALID_ARGUMENT (if the factors or the output
+//            dimensions are wrong, in which case the image is skipped)
+//            or IMG_ERR_CANCELLED
+//
+// Returns:
+//   IMG_SUCCESS if the batch was processed, IMG_ERR_CANCELLED if it
+//   was cancelled, otherwise one of the IMG_ERR_* values
+int img_batch_squash(struct Image **inputs, struct Image **outputs, const int32_t *xfacs,
+                     const int32_t *yfacs, int count, int num_threads, const struct ImgCancel *cancel,
+                     int *status);
+
+// Blur every image of a batch, like imgproc_blur. Each image is
+// blurred as a whole by one thread (a blurred row depends on the rows
+// around it), so tasks are made of whole images.
+//
+// Parameters:
+//   inputs - array of pointers to the input images
+//   outputs - array of pointers to the output images, each with the
+//             same dimensions as its input image
+//   blur_dists - blur distance for each image
+//   count - number of images in the batch
+//   num_threads - number of threads to use (values below 1 are
+//                 treated as 1)
+//   cancel - pointer to a cancellation token, or NULL
+//   status - array that receives, for each image, IMG_SUCCESS,
+//            IMG_ERR_INVALID_ARGUMENT (if the distance is negative or
+//            the output dimensions are wrong, in which case the image
+//            is skipped) or IMG_ERR_CANCELLED
+//
+// Returns:
+//   IMG_SUCCESS if the batch was processed, IMG_ERR_CANCELLED if it
+//   was cancelled, otherwise one of the IMG_ERR_* values
+int img_batch_blur(struct Image **inputs, struct Image **outputs, const int32_t *blur_dists,
+                   int count, int num_threads, const struct ImgCancel *cancel, int *status);
+
+#endif
@@ -0,0 +1,217 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <dirent.h>
+#include "imgproc.h"
+#include "imgparallel.h"
+#include "imghash.h"
+
+// Size of the grey images the hashes are computed from
+#define DHASH_WIDTH   9
+#define DHASH_HEIGHT  8
+#define PHASH_SIZE    32
+#define PHASH_BITS    8
+
+// Reduce img to an out_w x out_h array of luma values, averaging the
+// block of pixels that falls into each output pixel.
+// Returns IMG_SUCCESS, or IMG_ERR_MALLOC_FAILED.
+static int grey_thumbnail(struct Image *img, int out_w, int out_h, double *out) {
+  struct Image grey;
+  if (img_init(&grey, img->width, img->height) != IMG_SUCCESS) {
+    return IMG_ERR_MALLOC_FAILED;
+  }
+  imgproc_grayscale(img, &grey, 601);
+
+  for (int i = 0; i < out_h; i++) {
+    int row_begin = i * img->height / out_h;
+    int row_end = (i + 1) * img->height / out_h;
+    if (row_end <= row_begin) {
+      row_end = row_begin + 1;
+    }
+    for (int j = 0; j < out_w; j++) {
+      int col_begin = j * img->width / out_w;
+      int col_end = (j + 1) * img->width / out_w;
+      if (col_end <= col_begin) {
+        col_end = col_begin + 1;
+      }
+
+      uint64_t sum = 0;
+      for (int r = row_begin; r < row_end && r < img->height; r++) {
+        for (int c = col_begin; c < col_end && c < img->width; c++) {
+          sum += grey.data[r * img->width + c] >> 24;
+        }
+      }
+      out[i * out_w + j] = (double) sum / ((row_end - row_begin) * (col_end - col_begin));
+    }
+  }
+
+  img_cleanup(&grey);
+  return IMG_SUCCESS;
+}
+
+int img_dhash(struct Image *img, uint64_t *hash) {
+  double thumb[DHASH_WIDTH * DHASH_HEIGHT];
+  if (grey_thumbnail(img, DHASH_WIDTH, DHASH_HEIGHT, thumb) != IMG_SUCCESS) {
+    return IMG_ERR_MALLOC_FAILED;
+  }
+
+  *hash = 0;
+  for (int i = 0; i < DHASH_HEIGHT; i++) {
+    for (int j = 0; j < DHASH_WIDTH - 1; j++) {
+      *hash = (*hash << 1) | (thumb[i * DHASH_WIDTH + j + 1] > thumb[i * DHASH_WIDTH + j]);
+    }
+  }
+  return IMG_SUCCESS;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+  double x = *(const double *) a, y = *(const double *) b;
+  return (x > y) - (x < y);
+}
+
+int img_phash(struct Image *img, uint64_t *hash) {
+  double thumb[PHASH_SIZE * PHASH_SIZE];
+  if (grey_thumbnail(img, PHASH_SIZE, PHASH_SIZE, thumb) != IMG_SUCCESS) {
+    return IMG_ERR_MALLOC_FAILED;
+  }
+
+  // cosines of the DCT-II basis functions for the lowest frequencies
+  double basis[PHASH_BITS][PHASH_SIZE];
+  for (int u = 0; u < PHASH_BITS; u++) {
+    for (int x = 0; x < PHASH_SIZE; x++) {
+      basis[u][x] = cos((2 * x + 1) * u * M_PI / (2 * PHASH_SIZE));
+    }
+  }
+
+  // separable 2D DCT: first along rows, then along columns
+  double rows[PHASH_SIZE][PHASH_BITS];
+  for (int y = 0; y < PHASH_SIZE; y++) {
+    for (int u = 0; u < PHASH_BITS; u++) {
+      double sum = 0.0;
+      for (int x = 0; x < PHASH_SIZE; x++) {
+        sum += thumb[y * PHASH_SIZE + x] * basis[u][x];
+      }
+      rows[y][u] = sum;
+    }
+  }
+
+  double coef[PHASH_BITS * PHASH_BITS], sorted[PHASH_BITS * PHASH_BITS];
+  for (int v = 0; v < PHASH_BITS; v++) {
+    for (int u = 0; u < PHASH_BITS; u++) {
+      double sum = 0.0;
+      for (int y = 0; y < PHASH_SIZE; y++) {
+        sum += rows[y][u] * basis[v][y];
+      }
+      coef[v * PHASH_BITS + u] = sum;
+    }
+  }
+
+  memcpy(sorted, coef, sizeof(coef));
+  qsort(sorted, PHASH_BITS * PHASH_BITS, sizeof(double), compare_doubles);
+  double median = (sorted[PHASH_BITS * PHASH_BITS / 2 - 1] + sorted[PHASH_BITS * PHASH_BITS / 2]) / 2;
+
+  *hash = 0;
+  for (int i = 0; i < PHASH_BITS * PHASH_BITS; i++) {
+    *hash = (*hash << 1) | (coef[i] > median);
+  }
+  return IMG_SUCCESS;
+}
+
+int img_hash_file(const char *filename, int kind, uint64_t *hash) {
+  // a few source pixels per thumbnail pixel is plenty
+  int min_size = kind == IMG_HASH_PHASH ? 4 * PHASH_SIZE : 4 * DHASH_WIDTH;
+
+  struct Image img;
+  int rc = img_read_squashed(filename, &img, min_size, min_size);
+  if (rc != IMG_SUCCESS) {
+    return rc;
+  }
+
+  rc = kind == IMG_HASH_PHASH ? img_phash(&img, hash) : img_dhash(&img, hash);
+  img_cleanup(&img);
+  return rc;
+}
+
+int img_hash_distance(uint64_t a, uint64_t b) {
+  return __builtin_popcountll(a ^ b);
+}
+
+// Files hashed by img_hash_dir
+struct HashWork {
+  struct ImageHash *hashes;
+  int count;
+  int kind;
+};
+
+// ImgItemFn hashing one file
+static void hash_one(void *arg, int i) {
+  struct HashWork *work = arg;
+  work->hashes[i].rc = img_hash_file(work->hashes[i].filename, work->kind, &work->hashes[i].hash);
+}
+
+static int compare_hashes(const void *a, const void *b) {
+  return strcmp(((const struct ImageHash *) a)->filename, ((const struct ImageHash *) b)->filename);
+}
+
+int img_hash_dir(const char *dirname, int kind, int num_threads, struct ImageHash **hashes, int *count) {
+  DIR *dir = opendir(dirname);
+  if (dir == NULL) {
+    return IMG_ERR_COULD_NOT_OPEN;
+  }
+
+  // collect the names of the .png files
+  struct HashWork work;
+  int capacity = 16;
+  work.hashes = malloc(capacity * sizeof(struct ImageHash));
+  work.count = 0;
+  work.kind = kind;
+
+  struct dirent *entry;
+  while (work.hashes != NULL && (entry = readdir(dir)) != NULL) {
+    size_t len = strlen(entry->d_name);
+    if (len < 4 || strcmp(entry->d_name + len - 4, ".png") != 0) {
+      continue;
+    }
+    if (work.count == capacity) {
+      capacity *= 2;
+      struct ImageHash *grown = realloc(work.hashes, capacity * sizeof(struct ImageHash));
+      if (grown == NULL) {
+        img_hash_free(work.hashes, work.count);
+        work.hashes = NULL;
+        break;
+      }
+      work.hashes = grown;
+    }
+    char *path = malloc(strlen(dirname) + len + 2);
+    if (path == NULL) {
+      img_hash_free(work.hashes, work.count);
+      work.hashes = NULL;
+      break;
+    }
+    sprintf(path, "%s/%s", dirname, entry->d_name);
+    work.hashes[work.count].filename = path;
+    work.hashes[work.count].hash = 0;
+    work.hashes[work.count].rc = IMG_SUCCESS;
+    work.count++;
+  }
+  closedir(dir);
+
+  if (work.hashes == NULL) {
+    return IMG_ERR_MALLOC_FAILED;
+  }
+  qsort(work.hashes, work.count, sizeof(struct ImageHash), compare_hashes);
+
+  img_parallel_for(work.count, num_threads, hash_one, &work);
+
+  *hashes = work.hashes;
+  *count = work.count;
+  return IMG_SUCCESS;
+}
+
+void img_hash_free(struct ImageHash *hashes, int count) {
+  for (int i = 0; i < count; i++) {
+    free(hashes[i].filename);
+  }
+  free(hashes);
+}
@@ -0,0 +1,90 @@
+#ifndef IMGHASH_H
+#define IMGHASH_H
+
+#include "image.h"
+
+// kinds of perceptual hash
+#define IMG_HASH_DHASH  0
+#define IMG_HASH_PHASH  1
+
+// Hash of one file computed by img_hash_dir
+struct ImageHash {
+  char *filename;   // path of the file
+  uint64_t hash;
+  int rc;           // IMG_SUCCESS, or the error reading the file
+};
+
+// Compute the difference hash of an image: the image is reduced to
+// 9x8 grey pixels, and bit 63 - (8 * row + col) is set if the pixel
+// at (row, col + 1) is brighter than the one at (row, col).
+//
+// Parameters:
+//   img - pointer to the Image to hash
+//   hash - where to store the 64-bit hash
+//
+// Returns:
+//   IMG_SUCCESS if successful, IMG_ERR_MALLOC_FAILED if memory for
+//   the grey image couldn't be allocated
+int img_dhash(struct Image *img, uint64_t *hash);
+
+// Compute the DCT-based perceptual hash of an image: the image is
+// reduced to 32x32 grey pixels, and bit 63 - (8 * v + u) is set if
+// the (u, v) coefficient of its 8x8 lowest frequency DCT coefficients
+// is above their median.
+//
+// Parameters:
+//   img - pointer to the Image to hash
+//   hash - where to store the 64-bit hash
+//
+// Returns:
+//   IMG_SUCCESS if successful, IMG_ERR_MALLOC_FAILED if memory for
+//   the grey image couldn't be allocated
+int img_phash(struct Image *img, uint64_t *hash);
+
+// Hash a PNG file. The file is shrunk while it is decoded (see
+// img_read_squashed), so the full-size image is never stored.
+//
+// Parameters:
+//   filename - name of the PNG file
+//   kind - IMG_HASH_DHASH or IMG_HASH_PHASH
+//   hash - where to store the hash
+//
+// Returns:
+//   IMG_SUCCESS if successful, otherwise one of the
+//   IMG_ERR_* values
+int img_hash_file(const char *filename, int kind, uint64_t *hash);
+
+// Hash every .png file in a directory, spreading the files across
+// threads.
+//
+// Parameters:
+//   dirname - directory to scan
+//   kind - IMG_HASH_DHASH or IMG_HASH_PHASH
+//   num_threads - number of threads (values below 1 are treated as 1)
+//   hashes - set to a malloc'ed array of results, sorted by filename;
+//            free it with img_hash_free
+//   count - set to the number of entries in *hashes
+//
+// Returns:
+//   IMG_SUCCESS if successful, IMG_ERR_COULD_NOT_OPEN if the directory
+//   can't be read, or IMG_ERR_MALLOC_FAILED
+int img_hash_dir(const char *dirname, int kind, int num_threads, struct ImageHash **hashes, int *count);
+
+// Free the results of img_hash_dir.
+//
+// Parameters:
+//   hashes - array returned by img_hash_dir
+//   count - number of entries in the array
+void img_hash_free(struct ImageHash *hashes, int count);
+
+// Count the bits that differ between two hashes.
+//
+// Parameters:
+//   a - first hash
+//   b - second hash
+//
+// Returns:
+//   the Hamming distance between a and b (0 to 64)
+int img_hash_distance(uint64_t a, uint64_t b);
+
+#endif
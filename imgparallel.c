@@ -0,0 +1,138 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "imgproc.h"
+#include "imgparallel.h"
+
+// Each band is at least this many times as tall as the halo rows
+// above and below it, so the halo rows (which every band computes and
+// throws away) add at most 1/BAND_HALO_RATIO to the work
+#define BAND_HALO_RATIO 4
+
+// A kernel applied to bands: returns nonzero if successful
+typedef int (*BandKernel)(struct Image *input_img, struct Image *output_img, int32_t dist);
+
+// Items shared by the threads of img_parallel_for
+struct ParallelWork {
+  int count;
+  int next;                // next item to take
+  ImgItemFn fn;
+  void *arg;
+};
+
+static void *parallel_worker(void *arg) {
+  struct ParallelWork *work = arg;
+  for (;;) {
+    int item = __atomic_fetch_add(&work->next, 1, __ATOMIC_RELAXED);
+    if (item >= work->count) {
+      return NULL;
+    }
+    work->fn(work->arg, item);
+  }
+}
+
+void img_parallel_for(int count, int num_threads, ImgItemFn fn, void *arg) {
+  struct ParallelWork work = { count, 0, fn, arg };
+  if (num_threads > count) {
+    num_threads = count;
+  }
+  pthread_t *threads = num_threads > 1 ? malloc((num_threads - 1) * sizeof(pthread_t)) : NULL;
+  int started = 0;
+  while (threads != NULL && started < num_threads - 1
+         && pthread_create(&threads[started], NULL, parallel_worker, &work) == 0) {
+    started++;
+  }
+  parallel_worker(&work);
+  for (int t = 0; t < started; t++) {
+    pthread_join(threads[t], NULL);
+  }
+  free(threads);
+}
+
+// One band of rows processed by a single thread
+struct ParallelBand {
+  BandKernel kernel;
+  int32_t dist;
+  struct Image in;         // view of the band and its halo rows
+  uint32_t *out;           // the band's first output row
+  int32_t skip;            // halo rows above the band
+  int32_t rows;            // rows of the band
+  int ok;
+};
+
+// ImgItemFn applying the kernel to a band of an array of bands
+static void run_band(void *arg, int t) {
+  struct ParallelBand *band = (struct ParallelBand *) arg + t;
+  struct Image scratch = { band->in.width, band->in.height, NULL };
+  scratch.data = malloc((size_t) scratch.width * scratch.height * sizeof(uint32_t));
+  band->ok = scratch.data != NULL && band->kernel(&band->in, &scratch, band->dist);
+  if (band->ok) {
+    memcpy(band->out, scratch.data + (size_t) band->skip * scratch.width,
+           (size_t) band->rows * scratch.width * sizeof(uint32_t));
+  }
+  free(scratch.data);
+}
+
+// Apply a kernel whose window reaches halo rows above and below each
+// output row, splitting the rows into bands as evenly as possible
+// (and into fewer bands than threads if they would be too short).
+// Returns IMG_SUCCESS if successful, otherwise one of the IMG_ERR_*
+// values.
+static int run_bands(struct Image *input_img, struct Image *output_img, BandKernel kernel, int32_t dist,
+                     int32_t halo, int num_threads) {
+  int32_t width = input_img->width;
+  int32_t height = input_img->height;
+  int32_t min_rows = 2 * halo * BAND_HALO_RATIO;
+  if (min_rows > 0 && num_threads > height / min_rows) {
+    num_threads = height / min_rows;
+  }
+  if (num_threads > height) {
+    num_threads = height;
+  }
+  if (num_threads <= 1) {
+    return kernel(input_img, output_img, dist) ? IMG_SUCCESS : IMG_ERR_MALLOC_FAILED;
+  }
+
+  struct ParallelBand *bands = calloc(num_threads, sizeof(struct ParallelBand));
+  if (bands == NULL) {
+    return IMG_ERR_MALLOC_FAILED;
+  }
+  int32_t row = 0;
+  for (int t = 0; t < num_threads; t++) {
+    int32_t rows = height / num_threads + (t < height % num_threads);
+    int32_t top = row - halo > 0 ? row - halo : 0;
+    int32_t end = row + rows + halo < height ? row + rows + halo : height;
+    bands[t].kernel = kernel;
+    bands[t].dist = dist;
+    bands[t].in.width = width;
+    bands[t].in.height = end - top;
+    bands[t].in.data = input_img->data + (size_t) top * width;
+    bands[t].out = output_img->data + (size_t) row * width;
+    bands[t].skip = row - top;
+    bands[t].rows = rows;
+    row += rows;
+  }
+
+  img_parallel_for(num_threads, num_threads, run_band, bands);
+  int ok = 1;
+  for (int t = 0; t < num_threads; t++) {
+    ok = ok && bands[t].ok;
+  }
+  free(bands);
+  return ok ? IMG_SUCCESS : IMG_ERR_MALLOC_FAILED;
+}
+
+// imgproc_sobel as a BandKernel (its window reaches one row)
+static int sobel_kernel(struct Image *input_img, struct Image *output_img, int32_t dist) {
+  (void) dist;
+  imgproc_sobel(input_img, output_img);
+  return 1;
+}
+
+int img_parallel_median(struct Image *input_img, struct Image *output_img, int32_t median_dist, int num_threads) {
+  return run_bands(input_img, output_img, imgproc_median, median_dist, median_dist, num_threads);
+}
+
+int img_parallel_sobel(struct Image *input_img, struct Image *output_img, int num_threads) {
+  return run_bands(input_img, output_img, sobel_kernel, 0, 1, num_threads);
+}
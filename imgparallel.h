@@ -0,0 +1,61 @@
+#ifndef IMGPARALLEL_H
+#define IMGPARALLEL_H
+
+#include "image.h"
+
+// Function called by img_parallel_for for each item
+typedef void (*ImgItemFn)(void *arg, int item);
+
+// Call fn(arg, item) for every item from 0 to count - 1, on a group
+// of threads: the calling thread and up to num_threads - 1 started for
+// the call. Each thread takes the next item not yet taken until there
+// are none left, so items of uneven cost keep every thread busy.
+// Threads that can't be started are done without; every item is
+// processed even if none can. Returns once every item is done.
+//
+// Parameters:
+//   count - number of items
+//   num_threads - number of threads to use (values below 1 are
+//                 treated as 1, and no more threads than items are
+//                 used)
+//   fn - function to call for each item
+//   arg - argument passed to fn
+void img_parallel_for(int count, int num_threads, ImgItemFn fn, void *arg);
+
+// Multithreaded versions of imgproc kernels whose output pixels depend
+// on a neighbourhood of input pixels. The image's rows are split into
+// bands, one per thread. Each thread applies the kernel to a view of
+// its band together with the rows above and below it that the
+// kernel's window reaches into, writing into a scratch buffer of its
+// own, and then copies the band's rows to the output. Fewer threads
+// than requested are used when the bands would be less than 8 times
+// as tall as the window's radius, so that the extra rows add at most
+// a quarter to the work. The results are the same as those of the
+// imgproc_* functions.
+
+// Apply a median filter like imgproc_median, on several threads.
+//
+// Parameters:
+//   input_img - pointer to the input Image
+//   output_img - pointer to the output Image (same dimensions)
+//   median_dist - median filter distance; must not be negative
+//   num_threads - largest number of threads to use (values below 1
+//                 are treated as 1)
+//
+// Returns:
+//   IMG_SUCCESS if successful, otherwise one of the IMG_ERR_* values
+int img_parallel_median(struct Image *input_img, struct Image *output_img, int32_t median_dist, int num_threads);
+
+// Compute a Sobel edge map like imgproc_sobel, on several threads.
+//
+// Parameters:
+//   input_img - pointer to the input Image
+//   output_img - pointer to the output Image (same dimensions)
+//   num_threads - largest number of threads to use (values below 1
+//                 are treated as 1)
+//
+// Returns:
+//   IMG_SUCCESS if successful, otherwise one of the IMG_ERR_* values
+int img_parallel_sobel(struct Image *input_img, struct Image *output_img, int num_threads);
+
+#endif
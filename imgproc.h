@@ -44,6 +44,29 @@
 //! @param yfac factor to downsize the image vertically; guaranteed to be positive
 void imgproc_squash( struct Image *input_img, struct Image *output_img, int32_t xfac, int32_t yfac );
 
+//! Transform the input image by shrinking it down both
+//! horizontally and vertically like imgproc_squash, but instead of
+//! sampling one pixel of each xfac x yfac block of input pixels,
+//! each output pixel is the average of the whole block. This
+//! avoids the aliasing of imgproc_squash without blurring the
+//! full-size image first.
+//!
+//! The output image is input_img->width / xfac pixels wide and
+//! input_img->height / yfac pixels tall; input pixels in partial
+//! blocks at the right and bottom edges are ignored. As in
+//! imgproc_expand, every component (including alpha) is averaged
+//! using purely integer arithmetic with no rounding. The input is
+//! read once, one row at a time, while a row of per-block sums is
+//! accumulated.
+//!
+//! @param input_img pointer to the input Image
+//! @param output_img pointer to the output Image (in which the
+//!                   transformed pixels should be stored)
+//! @param xfac factor to downsize the image horizontally; must be positive
+//! @param yfac factor to downsize the image vertically; must be positive
+//! @return 1 if successful, 0 if the block sums could not be allocated
+int imgproc_squash_avg( struct Image *input_img, struct Image *output_img, int32_t xfac, int32_t yfac );
+
 //! Transform the color component values in each input pixel
 //! by applying a rotation on the values of the color components
 //! I.e. the old pixel's red component value will be used for
@@ -129,6 +152,245 @@ void imgproc_blur( struct Image *input_img, struct Image *output_img, int32_t bl
 //!                   transformed pixels should be stored)
 void imgproc_expand( struct Image *input_img, struct Image *output_img);
 
+//! Transform the input image by expanding it by a factor of n (a
+//! power of two) both horizontally and vertically. The result is
+//! exactly the image produced by calling imgproc_expand log2(n)
+//! times in a row, but the intermediate images are never stored
+//! in full: each output row is computed as soon as the (at most
+//! two) rows of each intermediate image it depends on are known,
+//! keeping only two rows of every intermediate image. Each output
+//! pixel is written exactly once.
+//!
+//! @param input_img pointer to the input Image
+//! @param output_img pointer to the output Image (in which the
+//!                   transformed pixels should be stored); must be
+//!                   n times as wide and as tall as input_img
+//! @param n expansion factor; must be a power of two of at least 2
+//! @return 1 if successful, 0 if n is not a valid factor or the
+//!         intermediate rows could not be allocated
+int imgproc_expand_n( struct Image *input_img, struct Image *output_img, int32_t n );
+
+//! Transform the input image using a median filter.
+//!
+//! Each pixel of the output image has each of its color components
+//! set to the median of that component over the pixels within
+//! median_dist pixels horizontally and vertically of the pixel's
+//! location in the original image. As with imgproc_blur, pixel
+//! positions outside the image are ignored, and the alpha value of
+//! each output pixel is identical to the corresponding input pixel.
+//! When the window holds an even number of pixels, the upper of the
+//! two middle values is used.
+//!
+//! Runs in constant time per pixel regardless of median_dist.
+//!
+//! @param input_img pointer to the input Image
+//! @param output_img pointer to the output Image (in which the
+//!                   transformed pixels should be stored)
+//! @param median_dist all pixels whose x/y coordinates are within
+//!                    this many pixels of the x/y coordinates of the
+//!                    original pixel are included in the medians;
+//!                    must not be negative
+//! @return 1 if successful, 0 if the histograms could not be allocated
+int imgproc_median( struct Image *input_img, struct Image *output_img, int32_t median_dist );
+
+//! Transform the input image by eroding it: each color component of
+//! an output pixel is the minimum of that component over the pixels
+//! within dist pixels horizontally and vertically of its location.
+//!
+//! The window is the same square of pixels used by imgproc_blur:
+//! pixel positions outside the image are ignored, and the alpha value
+//! of each output pixel is identical to the corresponding input pixel.
+//! Runs in time independent of dist (see morphPass).
+//!
+//! @param input_img pointer to the input Image
+//! @param output_img pointer to the output Image (in which the
+//!                   transformed pixels should be stored)
+//! @param dist all pixels whose x/y coordinates are within this many
+//!             pixels of the x/y coordinates of the original pixel are
+//!             considered; must not be negative
+//! @return 1 if successful, 0 if the scratch buffers could not be allocated
+int imgproc_erode( struct Image *input_img, struct Image *output_img, int32_t dist );
+
+//! Transform the input image by dilating it: each color component of
+//! an output pixel is the maximum of that component over the pixels
+//! within dist pixels horizontally and vertically of its location.
+//!
+//! The window is the same square of pixels used by imgproc_blur:
+//! pixel positions outside the image are ignored, and the alpha value
+//! of each output pixel is identical to the corresponding input pixel.
+//! Runs in time independent of dist (see morphPass).
+//!
+//! @param input_img pointer to the input Image
+//! @param output_img pointer to the output Image (in which the
+//!                   transformed pixels should be stored)
+//! @param dist all pixels whose x/y coordinates are within this many
+//!             pixels of the x/y coordinates of the original pixel are
+//!             considered; must not be negative
+//! @return 1 if successful, 0 if the scratch buffers could not be allocated
+int imgproc_dilate( struct Image *input_img, struct Image *output_img, int32_t dist );
+
+//! Transform the input image into a map of its edges using the Sobel
+//! operator.
+//!
+//! The horizontal and vertical Sobel gradients gx and gy are computed
+//! over the 3x3 neighbourhood of each pixel's luma
+//! ((77*red + 150*green + 29*blue) / 256), with pixels outside the
+//! image replaced by the nearest edge pixel. Each output pixel is grey
+//! with all three color components equal to |gx| + |gy|, capped at
+//! 255, and the alpha value of the corresponding input pixel.
+//!
+//! @param input_img pointer to the input Image
+//! @param output_img pointer to the output Image (in which the
+//!                   transformed pixels should be stored)
+void imgproc_sobel( struct Image *input_img, struct Image *output_img );
+
+//! Transform the input image by transposing it: the pixel at row i,
+//! column j of the input image becomes the pixel at row j, column i
+//! of the output image, which is as wide as the input image is tall
+//! and vice versa.
+//!
+//! @param input_img pointer to the input Image
+//! @param output_img pointer to the output Image (in which the
+//!                   transformed pixels should be stored)
+void imgproc_transpose( struct Image *input_img, struct Image *output_img );
+
+//! Transform the input image by rotating it clockwise by 90, 180 or
+//! 270 degrees. For 90 and 270 degrees, the output image is as wide as
+//! the input image is tall and vice versa.
+//!
+//! @param input_img pointer to the input Image
+//! @param output_img pointer to the output Image (in which the
+//!                   transformed pixels should be stored)
+//! @param degrees clockwise rotation: 90, 180 or 270
+//! @return 1 if successful, 0 if degrees is not one of the allowed values
+int imgproc_rotate( struct Image *input_img, struct Image *output_img, int32_t degrees );
+
+//! Transform the input image by flipping it, either horizontally
+//! (mirroring left and right) or vertically (mirroring top and bottom).
+//!
+//! @param input_img pointer to the input Image
+//! @param output_img pointer to the output Image (in which the
+//!                   transformed pixels should be stored)
+//! @param horizontal nonzero to flip horizontally, 0 to flip vertically
+void imgproc_flip( struct Image *input_img, struct Image *output_img, int32_t horizontal );
+
+//! Transform the input image to greyscale: every color component of
+//! an output pixel is set to the luma of the corresponding input pixel
+//! computed with the BT.601 or BT.709 weights (in 14-bit fixed point).
+//! Alpha values are kept.
+//!
+//! @param input_img pointer to the input Image
+//! @param output_img pointer to the output Image (in which the
+//!                   transformed pixels should be stored)
+//! @param standard 601 or 709
+//! @return 1 if successful, 0 if standard is not 601 or 709
+int imgproc_grayscale( struct Image *input_img, struct Image *output_img, int32_t standard );
+
+//! Transform the input image from RGB to full-range YCbCr using the
+//! BT.601 or BT.709 matrix. Each output pixel stores Y in its red
+//! component, Cb in its green component, and Cr in its blue component;
+//! alpha values are kept.
+//!
+//! @param input_img pointer to the input Image
+//! @param output_img pointer to the output Image (in which the
+//!                   transformed pixels should be stored)
+//! @param standard 601 or 709
+//! @return 1 if successful, 0 if standard is not 601 or 709
+int imgproc_rgb_to_ycbcr( struct Image *input_img, struct Image *output_img, int32_t standard );
+
+//! Transform the input image from full-range YCbCr (packed as by
+//! imgproc_rgb_to_ycbcr) back to RGB using the BT.601 or BT.709
+//! matrix. Alpha values are kept.
+//!
+//! @param input_img pointer to the input Image
+//! @param output_img pointer to the output Image (in which the
+//!                   transformed pixels should be stored)
+//! @param standard 601 or 709
+//! @return 1 if successful, 0 if standard is not 601 or 709
+int imgproc_ycbcr_to_rgb( struct Image *input_img, struct Image *output_img, int32_t standard );
+
+//! Convert the input image to planar full-range YCbCr, as consumed by
+//! video encoders.
+//!
+//! The Y plane always has one byte per pixel, stored row by row. If
+//! subsample is 0 the Cb and Cr planes are the same size (4:4:4);
+//! otherwise they are subsampled 4:2:0, with (width + 1) / 2 columns
+//! and (height + 1) / 2 rows, each chroma sample being the average of
+//! a 2x2 block of converted pixels. Blocks cut off by the right or
+//! bottom edge of an odd-sized image average only the pixels inside
+//! it, exactly as imgproc_expand does.
+//!
+//! @param input_img pointer to the input Image
+//! @param y_plane buffer receiving width * height Y samples
+//! @param cb_plane buffer receiving the Cb samples
+//! @param cr_plane buffer receiving the Cr samples
+//! @param standard 601 or 709
+//! @param subsample nonzero for 4:2:0 chroma planes, 0 for 4:4:4
+//! @return 1 if successful, 0 if standard is not 601 or 709
+int imgproc_ycbcr_planes( struct Image *input_img, uint8_t *y_plane, uint8_t *cb_plane, uint8_t *cr_plane,
+                          int32_t standard, int32_t subsample );
+
+//! Compute 256-bin histograms of the red, green, blue, and alpha
+//! components of the input image in a single pass over its pixels.
+//!
+//! hist[c * 256 + v] is set to the number of pixels whose component c
+//! (0 = red, 1 = green, 2 = blue, 3 = alpha) equals v. The pass
+//! spreads consecutive pixels across several sub-histograms that are
+//! summed at the end, so that runs of similar pixels do not serialize
+//! on increments of the same bin.
+//!
+//! @param input_img pointer to the input Image
+//! @param hist array of 4 * 256 counts to fill in
+void imgproc_histogram( struct Image *input_img, uint32_t *hist );
+
+//! Transform the input image by passing the red, green, and blue
+//! components of every pixel through a lookup table. Alpha values
+//! are kept. img_write_lut applies a table while writing instead.
+//!
+//! @param input_img pointer to the input Image
+//! @param output_img pointer to the output Image (in which the
+//!                   transformed pixels should be stored)
+//! @param lut 3 * 256 entry table: lut[v], lut[256 + v] and
+//!            lut[512 + v] replace red, green and blue values of v
+void imgproc_apply_lut( struct Image *input_img, struct Image *output_img, const uint8_t *lut );
+
+//! Build the lookup table imgproc_autolevels applies: each of the
+//! red, green, and blue channels is stretched linearly so that its
+//! lowest value present maps to 0 and its highest to 255. A channel
+//! with a single value is left unchanged.
+//!
+//! @param hist histograms computed by imgproc_histogram
+//! @param lut 3 * 256 entry table to fill in (see imgproc_apply_lut)
+void imgproc_autolevels_lut( const uint32_t *hist, uint8_t *lut );
+
+//! Build the lookup table imgproc_equalize applies: each value of
+//! the red, green, and blue channels maps to its rounded position in
+//! the channel's cumulative distribution, scaled so that the lowest
+//! value present maps to 0 and the highest to 255. A channel with a
+//! single value is left unchanged.
+//!
+//! @param hist histograms computed by imgproc_histogram
+//! @param lut 3 * 256 entry table to fill in (see imgproc_apply_lut)
+void imgproc_equalize_lut( const uint32_t *hist, uint8_t *lut );
+
+//! Transform the input image by stretching the contrast of each of
+//! its red, green, and blue channels to the full 0..255 range (see
+//! imgproc_autolevels_lut). Alpha values are kept.
+//!
+//! @param input_img pointer to the input Image
+//! @param output_img pointer to the output Image (in which the
+//!                   transformed pixels should be stored)
+void imgproc_autolevels( struct Image *input_img, struct Image *output_img );
+
+//! Transform the input image by equalizing the histogram of each of
+//! its red, green, and blue channels (see imgproc_equalize_lut).
+//! Alpha values are kept.
+//!
+//! @param input_img pointer to the input Image
+//! @param output_img pointer to the output Image (in which the
+//!                   transformed pixels should be stored)
+void imgproc_equalize( struct Image *input_img, struct Image *output_img );
+
 // TODO: add prototypes for your helper functions
 
 #endif // IMGPROC_H
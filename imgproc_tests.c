@@ -1,8 +1,21 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
 #include "tctest.h"
 #include "imgproc.h"
+#include "imgstats.h"
+#include "imghash.h"
+#include "pnglite.h"
+#include "imgtile.h"
+#include "imgtilestore.h"
+#include "imgbatch.h"
+#include "imgasync.h"
+#include "imgband.h"
+#include "imgshm.h"
+#include "imgparallel.h"
 
 
 
@@ -46,6 +59,21 @@ uint32_t getAlpha(uint32_t pixel);
 uint32_t createPixel(uint32_t red, uint32_t green, uint32_t blue, uint32_t alpha);
 uint32_t createAveragePixel(uint32_t pixel_one, uint32_t pixel_two);
 int32_t quadAveragePixel(uint32_t pixel_one, uint32_t pixel_two, uint32_t pixel_three, uint32_t pixel_four);
+void histogramAddPixel(uint32_t *hist, uint32_t pixel, int32_t delta);
+void histogramAdd(uint32_t *dst, const uint32_t *src);
+void histogramSubtract(uint32_t *dst, const uint32_t *src);
+uint32_t histogramMedian(const uint32_t *hist, uint32_t half);
+uint32_t maxPixel(uint32_t pixel_one, uint32_t pixel_two);
+void morphPass(const uint32_t *src, uint32_t *dst, int32_t n, int32_t stride, int32_t lanes,
+               int32_t dist, uint32_t flip, uint32_t *scratch);
+uint32_t lumaPixel(uint32_t pixel);
+uint32_t sobelPixel(struct Image *input_img, int row, int col);
+void transposeImage(struct Image *input_img, struct Image *output_img, int32_t mirror_rows, int32_t mirror_cols);
+void mirrorImage(struct Image *input_img, struct Image *output_img, int32_t mirror_rows, int32_t mirror_cols);
+const int32_t *colorMatrixFor(int32_t standard, const int32_t *bt601, const int32_t *bt709);
+uint32_t colorMatrixPixel(uint32_t pixel, const int32_t *matrix);
+void colorMatrixImage(struct Image *input_img, struct Image *output_img, const int32_t *matrix);
+void expandRow(const uint32_t *above, const uint32_t *below, int32_t in_w, uint32_t *out_row);
 
 // Functions to create and clean up a test fixture object
 TestObjs *setup( void );
@@ -54,8 +82,14 @@ void cleanup( TestObjs *objs );
 // Helper functions used by the test code
 void init_image_from_testdata(struct Image *img, struct TestImageData *test_data);
 struct Image *create_output_image( const struct Image *src_img );
+struct Image *create_transposed_output_image( const struct Image *src_img );
 bool images_equal( struct Image *a, struct Image *b );
 void destroy_img( struct Image *img );
+struct Image *create_random_image( int32_t width, int32_t height, uint32_t seed );
+uint32_t naive_median_pixel( struct Image *img, int row, int col, int dist );
+uint32_t naive_morph_pixel( struct Image *img, int row, int col, int dist, bool dilate );
+bool sobel_matches_naive( struct Image *img, struct Image *out_img );
+bool squash_avg_matches_naive( struct Image *img, struct Image *out_img, int xfac, int yfac );
 
 // Test functions
 void test_squash_basic( TestObjs *objs );
@@ -73,6 +107,47 @@ void test_alpha( TestObjs *objs );
 void test_createPix( TestObjs *objs );
 void test_createAvgPix( TestObjs *objs );
 void test_quadAvgPix( TestObjs *objs );
+void test_median_basic( TestObjs *objs );
+void test_histogram( TestObjs *objs );
+void test_histogramMedian( TestObjs *objs );
+void test_erode_dilate_basic( TestObjs *objs );
+void test_maxPixel( TestObjs *objs );
+void test_morphPass( TestObjs *objs );
+void test_sobel_basic( TestObjs *objs );
+void test_lumaPixel( TestObjs *objs );
+void test_transpose_basic( TestObjs *objs );
+void test_rotate_basic( TestObjs *objs );
+void test_flip_basic( TestObjs *objs );
+void test_grayscale_basic( TestObjs *objs );
+void test_ycbcr_basic( TestObjs *objs );
+void test_ycbcr_planes( TestObjs *objs );
+void test_colorMatrix( TestObjs *objs );
+void test_imgproc_histogram( TestObjs *objs );
+void test_img_stats( TestObjs *objs );
+void test_apply_lut( TestObjs *objs );
+void test_autolevels_lut( TestObjs *objs );
+void test_equalize_lut( TestObjs *objs );
+void test_autolevels_equalize_basic( TestObjs *objs );
+void test_img_hash( TestObjs *objs );
+void test_squash_avg_basic( TestObjs *objs );
+void test_expandRow( TestObjs *objs );
+void test_expand_n_basic( TestObjs *objs );
+void test_img_write_opaque( TestObjs *objs );
+void test_img_write_palette( TestObjs *objs );
+void test_img_raw_frames( TestObjs *objs );
+void test_large_outputs( TestObjs *objs );
+void test_tiled_image( TestObjs *objs );
+void test_tile_store( TestObjs *objs );
+void test_tile_store_spill( TestObjs *objs );
+void test_batch( TestObjs *objs );
+void test_async_jobs( TestObjs *objs );
+void test_cancellation( TestObjs *objs );
+void test_img_read_header( TestObjs *objs );
+void test_async_priority( TestObjs *objs );
+void test_shm_handoff( TestObjs *objs );
+void test_img_write_errors( TestObjs *objs );
+void test_parallel_median( TestObjs *objs );
+void test_parallel_sobel( TestObjs *objs );
 
 int main( int argc, char **argv ) {
   // allow the specific test to execute to be specified as the
@@ -102,6 +177,47 @@ int main( int argc, char **argv ) {
   TEST( test_createPix );
   TEST( test_createAvgPix );
   TEST( test_quadAvgPix );
+  TEST( test_median_basic );
+  TEST( test_histogram );
+  TEST( test_histogramMedian );
+  TEST( test_erode_dilate_basic );
+  TEST( test_maxPixel );
+  TEST( test_morphPass );
+  TEST( test_sobel_basic );
+  TEST( test_lumaPixel );
+  TEST( test_transpose_basic );
+  TEST( test_rotate_basic );
+  TEST( test_flip_basic );
+  TEST( test_grayscale_basic );
+  TEST( test_ycbcr_basic );
+  TEST( test_ycbcr_planes );
+  TEST( test_colorMatrix );
+  TEST( test_imgproc_histogram );
+  TEST( test_img_stats );
+  TEST( test_apply_lut );
+  TEST( test_autolevels_lut );
+  TEST( test_equalize_lut );
+  TEST( test_autolevels_equalize_basic );
+  TEST( test_img_hash );
+  TEST( test_squash_avg_basic );
+  TEST( test_expandRow );
+  TEST( test_expand_n_basic );
+  TEST( test_img_write_opaque );
+  TEST( test_img_write_palette );
+  TEST( test_img_raw_frames );
+  TEST( test_large_outputs );
+  TEST( test_tiled_image );
+  TEST( test_tile_store );
+  TEST( test_tile_store_spill );
+  TEST( test_batch );
+  TEST( test_async_jobs );
+  TEST( test_cancellation );
+  TEST( test_img_read_header );
+  TEST( test_async_priority );
+  TEST( test_shm_handoff );
+  TEST( test_img_write_errors );
+  TEST( test_parallel_median );
+  TEST( test_parallel_sobel );
 
   TEST_FINI();
 
@@ -159,6 +275,26 @@ struct Image *create_output_image( const struct Image *src_img ) {
   return img;
 }
 
+// Helper function to create a temporary output Image
+// with the width and height of a given one swapped
+struct Image *create_transposed_output_image( const struct Image *src_img ) {
+  struct Image *img;
+  img = malloc( sizeof( struct Image ) );
+  img_init( img, src_img->height, src_img->width );
+  return img;
+}
+
+// Helper function to create a width x height Image of pseudo-random
+// pixels (images with different seeds have different pixels)
+struct Image *create_random_image( int32_t width, int32_t height, uint32_t seed ) {
+  struct Image *img;
+  img = malloc( sizeof( struct Image ) );
+  img_init( img, width, height );
+  for ( int32_t i = 0; i < width * height; ++i )
+    img->data[i] = ( (uint32_t) i + seed ) * 2654435761u;
+  return img;
+}
+
 // Returns true IFF both Image objects are identical
 bool images_equal( struct Image *a, struct Image *b ) {
   if ( a->width != b->width || a->height != b->height )
@@ -180,6 +316,105 @@ void destroy_img( struct Image *img ) {
   free( img );
 }
 
+// Computes the expected imgproc_median result for one pixel by
+// counting every in-bounds pixel of the window directly
+uint32_t naive_median_pixel( struct Image *img, int row, int col, int dist ) {
+  uint32_t counts[3][256] = { { 0 } };
+  uint32_t total = 0;
+
+  for ( int i = row - dist; i <= row + dist; ++i )
+    for ( int j = col - dist; j <= col + dist; ++j ) {
+      if ( i < 0 || i >= img->height || j < 0 || j >= img->width )
+        continue;
+      uint32_t pixel = img->data[i*img->width + j];
+      counts[0][pixel >> 24]++;
+      counts[1][(pixel >> 16) & 0xFF]++;
+      counts[2][(pixel >> 8) & 0xFF]++;
+      total++;
+    }
+
+  uint32_t result = img->data[row*img->width + col] & 0xFF;
+  for ( int c = 0; c < 3; ++c ) {
+    uint32_t seen = 0, value = 0;
+    while ( ( seen += counts[c][value] ) <= total / 2 )
+      value++;
+    result |= value << ( 24 - 8*c );
+  }
+  return result;
+}
+
+// Computes the expected imgproc_erode (or imgproc_dilate) result for
+// one pixel by comparing every in-bounds pixel of the window directly
+uint32_t naive_morph_pixel( struct Image *img, int row, int col, int dist, bool dilate ) {
+  uint32_t best[3] = { dilate ? 0 : 255, dilate ? 0 : 255, dilate ? 0 : 255 };
+
+  for ( int i = row - dist; i <= row + dist; ++i )
+    for ( int j = col - dist; j <= col + dist; ++j ) {
+      if ( i < 0 || i >= img->height || j < 0 || j >= img->width )
+        continue;
+      uint32_t pixel = img->data[i*img->width + j];
+      for ( int c = 0; c < 3; ++c ) {
+        uint32_t value = ( pixel >> ( 24 - 8*c ) ) & 0xFF;
+        if ( dilate ? value > best[c] : value < best[c] )
+          best[c] = value;
+      }
+    }
+
+  return ( best[0] << 24 ) | ( best[1] << 16 ) | ( best[2] << 8 ) | ( img->data[row*img->width + col] & 0xFF );
+}
+
+// Returns true IFF out_img holds the imgproc_sobel result for img,
+// computed directly from the 3x3 Sobel kernels
+bool sobel_matches_naive( struct Image *img, struct Image *out_img ) {
+  static const int kx[3][3] = { { -1, 0, 1 }, { -2, 0, 2 }, { -1, 0, 1 } };
+  static const int ky[3][3] = { { -1, -2, -1 }, { 0, 0, 0 }, { 1, 2, 1 } };
+
+  for ( int i = 0; i < img->height; ++i )
+    for ( int j = 0; j < img->width; ++j ) {
+      int gx = 0, gy = 0;
+      for ( int k = -1; k <= 1; ++k )
+        for ( int l = -1; l <= 1; ++l ) {
+          int r = i + k < 0 ? 0 : ( i + k >= img->height ? img->height - 1 : i + k );
+          int c = j + l < 0 ? 0 : ( j + l >= img->width ? img->width - 1 : j + l );
+          uint32_t pixel = img->data[r*img->width + c];
+          int luma = ( 77 * ( pixel >> 24 ) + 150 * ( ( pixel >> 16 ) & 0xFF ) + 29 * ( ( pixel >> 8 ) & 0xFF ) ) >> 8;
+          gx += kx[k + 1][l + 1] * luma;
+          gy += ky[k + 1][l + 1] * luma;
+        }
+      uint32_t mag = abs( gx ) + abs( gy );
+      if ( mag > 255 )
+        mag = 255;
+      uint32_t expected = ( mag << 24 ) | ( mag << 16 ) | ( mag << 8 ) | ( img->data[i*img->width + j] & 0xFF );
+      if ( out_img->data[i*img->width + j] != expected )
+        return false;
+    }
+
+  return true;
+}
+
+// Returns true IFF out_img holds the imgproc_squash_avg result for img,
+// computed by averaging each xfac x yfac block directly
+bool squash_avg_matches_naive( struct Image *img, struct Image *out_img, int xfac, int yfac ) {
+  if ( out_img->width != img->width / xfac || out_img->height != img->height / yfac )
+    return false;
+
+  for ( int i = 0; i < out_img->height; ++i )
+    for ( int j = 0; j < out_img->width; ++j ) {
+      uint32_t expected = 0;
+      for ( int shift = 0; shift < 32; shift += 8 ) {
+        uint32_t sum = 0;
+        for ( int k = 0; k < yfac; ++k )
+          for ( int l = 0; l < xfac; ++l )
+            sum += ( img->data[( i*yfac + k )*img->width + j*xfac + l] >> shift ) & 0xFF;
+        expected |= ( sum / ( xfac * yfac ) ) << shift;
+      }
+      if ( out_img->data[i*out_img->width + j] != expected )
+        return false;
+    }
+
+  return true;
+}
+
 ////////////////////////////////////////////////////////////////////////
 // Test functions
 ////////////////////////////////////////////////////////////////////////
@@ -289,3 +524,1306 @@ void test_quadAvgPix( TestObjs *objs ) {
   ASSERT( quadAveragePixel(0x05000000, 0x00050000, 0x00000500, 0x00000005) == 0x01010101 );
 }
 
+void test_median_basic( TestObjs *objs ) {
+  // a median over just the pixel itself leaves the image unchanged
+  struct Image *out_img = create_output_image( &objs->smol );
+  ASSERT( imgproc_median( &objs->smol, out_img, 0 ) );
+  ASSERT( images_equal( out_img, &objs->smol ) );
+
+  // windows that are clipped by the border or cover the whole image
+  int dists[] = { 1, 2, 5, 40 };
+  for ( int d = 0; d < 4; ++d ) {
+    ASSERT( imgproc_median( &objs->smol, out_img, dists[d] ) );
+    for ( int i = 0; i < out_img->height; ++i )
+      for ( int j = 0; j < out_img->width; ++j )
+        ASSERT( out_img->data[i*out_img->width + j] == naive_median_pixel( &objs->smol, i, j, dists[d] ) );
+  }
+  destroy_img( out_img );
+}
+
+void test_histogram( TestObjs *objs ) {
+  (void) objs;
+  uint32_t a[768] = { 0 };
+  uint32_t b[768] = { 0 };
+
+  histogramAddPixel( a, 0x01020304, 1 );
+  histogramAddPixel( a, 0x01020304, 1 );
+  ASSERT( a[0x01] == 2 && a[256 + 0x02] == 2 && a[512 + 0x03] == 2 );
+  ASSERT( a[0x04] == 0 );
+  histogramAddPixel( a, 0x01020304, -1 );
+  ASSERT( a[0x01] == 1 && a[256 + 0x02] == 1 && a[512 + 0x03] == 1 );
+
+  histogramAddPixel( b, 0xFFFFFFFF, 1 );
+  histogramAdd( a, b );
+  ASSERT( a[0xFF] == 1 && a[256 + 0xFF] == 1 && a[512 + 0xFF] == 1 && a[0x01] == 1 );
+  histogramSubtract( a, b );
+  ASSERT( a[0xFF] == 0 && a[256 + 0xFF] == 0 && a[512 + 0xFF] == 0 && a[0x01] == 1 );
+}
+
+void test_histogramMedian( TestObjs *objs ) {
+  (void) objs;
+  uint32_t hist[256] = { 0 };
+  hist[3] = 1;
+  ASSERT( histogramMedian( hist, 0 ) == 3 );
+  // values 3, 7, 7, 200: index 2 of the sorted values is 7
+  hist[7] = 2;
+  hist[200] = 1;
+  ASSERT( histogramMedian( hist, 2 ) == 7 );
+  // values 3, 7, 7, 200, 200, 200: index 3 is 200
+  hist[200] = 3;
+  ASSERT( histogramMedian( hist, 3 ) == 200 );
+}
+
+
+void test_erode_dilate_basic( TestObjs *objs ) {
+  struct Image *out_img = create_output_image( &objs->smol );
+  ASSERT( imgproc_erode( &objs->smol, out_img, 0 ) );
+  ASSERT( images_equal( out_img, &objs->smol ) );
+  ASSERT( imgproc_dilate( &objs->smol, out_img, 0 ) );
+  ASSERT( images_equal( out_img, &objs->smol ) );
+
+  // windows that are clipped by the border or cover the whole image
+  int dists[] = { 1, 2, 5, 40 };
+  for ( int d = 0; d < 4; ++d ) {
+    ASSERT( imgproc_erode( &objs->smol, out_img, dists[d] ) );
+    for ( int i = 0; i < out_img->height; ++i )
+      for ( int j = 0; j < out_img->width; ++j )
+        ASSERT( out_img->data[i*out_img->width + j] == naive_morph_pixel( &objs->smol, i, j, dists[d], false ) );
+
+    ASSERT( imgproc_dilate( &objs->smol, out_img, dists[d] ) );
+    for ( int i = 0; i < out_img->height; ++i )
+      for ( int j = 0; j < out_img->width; ++j )
+        ASSERT( out_img->data[i*out_img->width + j] == naive_morph_pixel( &objs->smol, i, j, dists[d], true ) );
+  }
+  destroy_img( out_img );
+}
+
+void test_maxPixel( TestObjs *objs ) {
+  (void) objs;
+  ASSERT( maxPixel(0x00000000, 0xFFFFFFFF) == 0xFFFFFFFF );
+  ASSERT( maxPixel(0x10FF2001, 0xFF103002) == 0xFFFF3002 );
+}
+
+void test_morphPass( TestObjs *objs ) {
+  (void) objs;
+  uint32_t scratch[2 * 9];
+  uint32_t line[5] = { 0x01000000, 0x05000000, 0x02000000, 0x00000000, 0x03000000 };
+  uint32_t out[5];
+
+  // maximum over each pixel and its neighbours
+  morphPass( line, out, 5, 1, 1, 1, 0, scratch );
+  ASSERT( out[0] == 0x05000000 && out[1] == 0x05000000 && out[2] == 0x05000000 );
+  ASSERT( out[3] == 0x03000000 && out[4] == 0x03000000 );
+
+  // minimum over each pixel and its neighbours
+  morphPass( line, out, 5, 1, 1, 1, 0xFFFFFFFF, scratch );
+  ASSERT( out[0] == 0x01000000 && out[1] == 0x01000000 && out[2] == 0x00000000 );
+  ASSERT( out[3] == 0x00000000 && out[4] == 0x00000000 );
+}
+
+void test_sobel_basic( TestObjs *objs ) {
+  struct Image *out_img = create_output_image( &objs->smol );
+  imgproc_sobel( &objs->smol, out_img );
+  ASSERT( sobel_matches_naive( &objs->smol, out_img ) );
+  destroy_img( out_img );
+
+  // too narrow for an interior
+  out_img = create_output_image( &objs->smol_squash_3_1 );
+  imgproc_sobel( &objs->smol_squash_3_1, out_img );
+  ASSERT( sobel_matches_naive( &objs->smol_squash_3_1, out_img ) );
+  destroy_img( out_img );
+
+  // a flat image has no edges
+  uint32_t flat_pixels[16 * 4];
+  for ( int i = 0; i < 16 * 4; ++i )
+    flat_pixels[i] = 0x336699FF;
+  struct Image flat = { 16, 4, flat_pixels };
+  out_img = create_output_image( &flat );
+  imgproc_sobel( &flat, out_img );
+  for ( int i = 0; i < 16 * 4; ++i )
+    ASSERT( out_img->data[i] == 0x000000FF );
+  ASSERT( sobelPixel( &flat, 0, 0 ) == 0x000000FF );
+  destroy_img( out_img );
+}
+
+void test_lumaPixel( TestObjs *objs ) {
+  (void) objs;
+  ASSERT( lumaPixel(0x000000FF) == 0 );
+  ASSERT( lumaPixel(0xFFFFFF00) == 255 );
+  ASSERT( lumaPixel(0xFF000000) == 76 );
+  ASSERT( lumaPixel(0x00FF0000) == 149 );
+  ASSERT( lumaPixel(0x0000FF00) == 28 );
+}
+
+void test_transpose_basic( TestObjs *objs ) {
+  // smol has partial tiles; the 16x8 image has only whole ones
+  uint32_t tiled_pixels[16 * 8];
+  for ( int i = 0; i < 16 * 8; ++i )
+    tiled_pixels[i] = i * 0x01020304;
+  struct Image tiled = { 16, 8, tiled_pixels };
+  struct Image *inputs[] = { &objs->smol, &tiled };
+
+  for ( int n = 0; n < 2; ++n ) {
+    struct Image *in = inputs[n];
+    struct Image *out_img = create_transposed_output_image( in );
+    imgproc_transpose( in, out_img );
+    for ( int i = 0; i < in->height; ++i )
+      for ( int j = 0; j < in->width; ++j )
+        ASSERT( out_img->data[j*in->height + i] == in->data[i*in->width + j] );
+
+    transposeImage( in, out_img, 1, 1 );
+    for ( int i = 0; i < in->height; ++i )
+      for ( int j = 0; j < in->width; ++j )
+        ASSERT( out_img->data[(in->width - 1 - j)*in->height + (in->height - 1 - i)] == in->data[i*in->width + j] );
+    destroy_img( out_img );
+  }
+}
+
+void test_rotate_basic( TestObjs *objs ) {
+  struct Image *in = &objs->smol;
+  int h = in->height, w = in->width;
+
+  struct Image *out_img = create_transposed_output_image( in );
+  ASSERT( imgproc_rotate( in, out_img, 90 ) );
+  for ( int i = 0; i < h; ++i )
+    for ( int j = 0; j < w; ++j )
+      ASSERT( out_img->data[j*h + (h - 1 - i)] == in->data[i*w + j] );
+
+  ASSERT( imgproc_rotate( in, out_img, 270 ) );
+  for ( int i = 0; i < h; ++i )
+    for ( int j = 0; j < w; ++j )
+      ASSERT( out_img->data[(w - 1 - j)*h + i] == in->data[i*w + j] );
+
+  ASSERT( !imgproc_rotate( in, out_img, 45 ) );
+  destroy_img( out_img );
+
+  out_img = create_output_image( in );
+  ASSERT( imgproc_rotate( in, out_img, 180 ) );
+  for ( int i = 0; i < h; ++i )
+    for ( int j = 0; j < w; ++j )
+      ASSERT( out_img->data[(h - 1 - i)*w + (w - 1 - j)] == in->data[i*w + j] );
+  destroy_img( out_img );
+}
+
+void test_flip_basic( TestObjs *objs ) {
+  struct Image *in = &objs->smol;
+  int h = in->height, w = in->width;
+  struct Image *out_img = create_output_image( in );
+
+  imgproc_flip( in, out_img, 1 );
+  for ( int i = 0; i < h; ++i )
+    for ( int j = 0; j < w; ++j )
+      ASSERT( out_img->data[i*w + (w - 1 - j)] == in->data[i*w + j] );
+
+  imgproc_flip( in, out_img, 0 );
+  for ( int i = 0; i < h; ++i )
+    for ( int j = 0; j < w; ++j )
+      ASSERT( out_img->data[(h - 1 - i)*w + j] == in->data[i*w + j] );
+
+  mirrorImage( in, out_img, 0, 0 );
+  ASSERT( images_equal( out_img, in ) );
+  destroy_img( out_img );
+}
+
+void test_grayscale_basic( TestObjs *objs ) {
+  struct Image *in = &objs->smol;
+  struct Image *out_img = create_output_image( in );
+  static const double weights[2][3] = { { 0.299, 0.587, 0.114 }, { 0.2126, 0.7152, 0.0722 } };
+  static const int32_t standards[2] = { 601, 709 };
+
+  for ( int s = 0; s < 2; ++s ) {
+    ASSERT( imgproc_grayscale( in, out_img, standards[s] ) );
+    for ( int i = 0; i < in->width * in->height; ++i ) {
+      uint32_t pixel = in->data[i], grey = out_img->data[i];
+      double luma = weights[s][0] * ( pixel >> 24 ) + weights[s][1] * ( ( pixel >> 16 ) & 0xFF )
+        + weights[s][2] * ( ( pixel >> 8 ) & 0xFF );
+      double diff = ( grey >> 24 ) - luma;
+      ASSERT( diff < 1.0 && diff > -1.0 );
+      ASSERT( ( grey >> 24 ) == ( ( grey >> 16 ) & 0xFF ) && ( grey >> 24 ) == ( ( grey >> 8 ) & 0xFF ) );
+      ASSERT( ( grey & 0xFF ) == ( pixel & 0xFF ) );
+    }
+  }
+
+  ASSERT( !imgproc_grayscale( in, out_img, 2020 ) );
+  destroy_img( out_img );
+}
+
+void test_ycbcr_basic( TestObjs *objs ) {
+  // five pixels: one group of four plus one left over
+  uint32_t pixels[5] = { 0xFFFFFFFF, 0x000000FF, 0xFF000080, 0x00FF0000, 0x0000FF40 };
+  struct Image img = { 5, 1, pixels };
+  struct Image *out_img = create_output_image( &img );
+
+  ASSERT( imgproc_rgb_to_ycbcr( &img, out_img, 601 ) );
+  ASSERT( out_img->data[0] == 0xFF8080FF );
+  ASSERT( out_img->data[1] == 0x008080FF );
+  ASSERT( out_img->data[2] == 0x4C55FF80 ); // Cr of pure red is clamped to 255
+  ASSERT( out_img->data[3] == 0x962C1500 );
+  ASSERT( out_img->data[4] == 0x1DFF6B40 );
+  ASSERT( !imgproc_rgb_to_ycbcr( &img, out_img, 0 ) );
+  ASSERT( !imgproc_ycbcr_to_rgb( &img, out_img, 0 ) );
+  destroy_img( out_img );
+
+  // converting there and back loses at most a few levels
+  struct Image *in = &objs->smol;
+  struct Image *ycc_img = create_output_image( in );
+  out_img = create_output_image( in );
+  for ( int standard = 601; standard <= 709; standard += 108 ) {
+    ASSERT( imgproc_rgb_to_ycbcr( in, ycc_img, standard ) );
+    ASSERT( imgproc_ycbcr_to_rgb( ycc_img, out_img, standard ) );
+    for ( int i = 0; i < in->width * in->height; ++i )
+      for ( int shift = 0; shift < 32; shift += 8 ) {
+        int diff = (int) ( ( in->data[i] >> shift ) & 0xFF ) - (int) ( ( out_img->data[i] >> shift ) & 0xFF );
+        ASSERT( diff <= 2 && diff >= -2 );
+      }
+  }
+  destroy_img( ycc_img );
+  destroy_img( out_img );
+}
+
+void test_ycbcr_planes( TestObjs *objs ) {
+  // smol has an odd width and height, so the 4:2:0 planes have
+  // partial blocks along the right and bottom edges
+  struct Image *in = &objs->smol;
+  int w = in->width, h = in->height, cw = ( w + 1 ) / 2, ch = ( h + 1 ) / 2;
+  struct Image *ycc_img = create_output_image( in );
+  uint8_t *y_plane = malloc( w * h ), *cb_plane = malloc( w * h ), *cr_plane = malloc( w * h );
+
+  ASSERT( imgproc_rgb_to_ycbcr( in, ycc_img, 709 ) );
+  ASSERT( imgproc_ycbcr_planes( in, y_plane, cb_plane, cr_plane, 709, 0 ) );
+  for ( int i = 0; i < w * h; ++i ) {
+    ASSERT( y_plane[i] == getRed( ycc_img->data[i] ) );
+    ASSERT( cb_plane[i] == getGreen( ycc_img->data[i] ) );
+    ASSERT( cr_plane[i] == getBlue( ycc_img->data[i] ) );
+  }
+
+  ASSERT( imgproc_ycbcr_planes( in, y_plane, cb_plane, cr_plane, 709, 1 ) );
+  for ( int i = 0; i < w * h; ++i )
+    ASSERT( y_plane[i] == getRed( ycc_img->data[i] ) );
+  for ( int i = 0; i < ch; ++i )
+    for ( int j = 0; j < cw; ++j ) {
+      int bottom = 2*i + 1 < h ? 2*i + 1 : 2*i, right = 2*j + 1 < w ? 2*j + 1 : 2*j;
+      uint32_t sum_cb = 0, sum_cr = 0;
+      int rows[4] = { 2*i, 2*i, bottom, bottom }, cols[4] = { 2*j, right, 2*j, right };
+      for ( int k = 0; k < 4; ++k ) {
+        sum_cb += getGreen( getPixel( ycc_img, rows[k], cols[k] ) );
+        sum_cr += getBlue( getPixel( ycc_img, rows[k], cols[k] ) );
+      }
+      ASSERT( cb_plane[i*cw + j] == sum_cb / 4 );
+      ASSERT( cr_plane[i*cw + j] == sum_cr / 4 );
+    }
+
+  ASSERT( !imgproc_ycbcr_planes( in, y_plane, cb_plane, cr_plane, 1, 1 ) );
+  free( y_plane );
+  free( cb_plane );
+  free( cr_plane );
+  destroy_img( ycc_img );
+}
+
+void test_colorMatrix( TestObjs *objs ) {
+  // swaps red and blue, and adds 1 to green (with the rounding term)
+  static const int32_t swap[13] = {
+    0, 0, 16384,  0, 16384, 0,  16384, 0, 0,
+    8192, 16384 + 8192, 8192,  0
+  };
+  static const int32_t other[13] = { 0 };
+  ASSERT( colorMatrixPixel( 0x102030FF, swap ) == 0x302110FF );
+  ASSERT( colorMatrixPixel( 0x00FF0080, swap ) == 0x00FF0080 ); // green clamped to 255
+  ASSERT( colorMatrixFor( 601, swap, other ) == swap );
+  ASSERT( colorMatrixFor( 709, swap, other ) == other );
+  ASSERT( colorMatrixFor( 700, swap, other ) == NULL );
+
+  // the whole-image conversion matches the per-pixel one
+  struct Image *in = &objs->smol;
+  struct Image *out_img = create_output_image( in );
+  colorMatrixImage( in, out_img, swap );
+  for ( int i = 0; i < in->width * in->height; ++i )
+    ASSERT( out_img->data[i] == colorMatrixPixel( in->data[i], swap ) );
+  destroy_img( out_img );
+}
+
+void test_imgproc_histogram( TestObjs *objs ) {
+  struct Image *in = &objs->smol;
+  uint32_t hist[4 * 256], expected[4 * 256] = { 0 };
+
+  for ( int i = 0; i < in->width * in->height; ++i ) {
+    uint32_t pixel = in->data[i];
+    expected[pixel >> 24]++;
+    expected[256 + ( ( pixel >> 16 ) & 0xFF )]++;
+    expected[512 + ( ( pixel >> 8 ) & 0xFF )]++;
+    expected[768 + ( pixel & 0xFF )]++;
+  }
+  imgproc_histogram( in, hist );
+  for ( int b = 0; b < 4 * 256; ++b )
+    ASSERT( hist[b] == expected[b] );
+
+  // five identical pixels land in different sub-histograms
+  uint32_t pixels[5] = { 0x10203040, 0x10203040, 0x10203040, 0x10203040, 0x10203040 };
+  struct Image img = { 5, 1, pixels };
+  imgproc_histogram( &img, hist );
+  ASSERT( hist[0x10] == 5 && hist[256 + 0x20] == 5 && hist[512 + 0x30] == 5 && hist[768 + 0x40] == 5 );
+  ASSERT( hist[0x11] == 0 && hist[768 + 0xFF] == 0 );
+}
+
+void test_img_stats( TestObjs *objs ) {
+  uint32_t pixels[4] = { 0x000000FF, 0x00FF00FF, 0x40FF00FF, 0xC0FF00FF };
+  struct Image img = { 2, 2, pixels };
+  struct ImageStats *stats = malloc( sizeof( struct ImageStats ) );
+
+  ASSERT( img_stats( &img, 2, stats ) == IMG_SUCCESS );
+  ASSERT( stats->count == 4 );
+  ASSERT( stats->min[0] == 0 && stats->max[0] == 0xC0 );
+  ASSERT( stats->mean[0] == 64.0 );
+  ASSERT( stats->min[1] == 0 && stats->max[1] == 255 );
+  ASSERT( stats->stddev[2] == 0.0 && stats->mean[3] == 255.0 );
+  ASSERT( stats->hist[1][255] == 3 && stats->hist[1][0] == 1 );
+
+  // the result does not depend on how the rows are split up
+  struct ImageStats *single = malloc( sizeof( struct ImageStats ) );
+  ASSERT( img_stats( &objs->smol, 1, single ) == IMG_SUCCESS );
+  ASSERT( img_stats( &objs->smol, 4, stats ) == IMG_SUCCESS );
+  ASSERT( memcmp( single, stats, sizeof( struct ImageStats ) ) == 0 );
+  ASSERT( img_stats( &objs->smol, 100, stats ) == IMG_SUCCESS );
+  ASSERT( memcmp( single, stats, sizeof( struct ImageStats ) ) == 0 );
+
+  free( single );
+  free( stats );
+}
+
+void test_apply_lut( TestObjs *objs ) {
+  (void) objs;
+  // red inverted, green doubled (saturating), blue unchanged
+  uint8_t lut[3 * 256];
+  for ( int v = 0; v < 256; ++v ) {
+    lut[v] = 255 - v;
+    lut[256 + v] = v < 128 ? 2 * v : 255;
+    lut[512 + v] = v;
+  }
+
+  uint32_t pixels[5] = { 0x00000000, 0xFF4080FF, 0x10F00180, 0x7F7F7F7F, 0x01020304 };
+  struct Image img = { 5, 1, pixels };
+  struct Image *out_img = create_output_image( &img );
+  imgproc_apply_lut( &img, out_img, lut );
+  ASSERT( out_img->data[0] == 0xFF000000 );
+  ASSERT( out_img->data[1] == 0x008080FF );
+  ASSERT( out_img->data[2] == 0xEFFF0180 );
+  ASSERT( out_img->data[3] == 0x80FE7F7F );
+  ASSERT( out_img->data[4] == 0xFE040304 );
+  destroy_img( out_img );
+}
+
+void test_autolevels_lut( TestObjs *objs ) {
+  (void) objs;
+  uint32_t hist[4 * 256] = { 0 };
+  uint8_t lut[3 * 256];
+
+  hist[10] = 3;       // red spans 10..20
+  hist[20] = 1;
+  hist[256 + 7] = 5;  // green has a single value
+  hist[512] = 1;      // blue already spans 0..255
+  hist[512 + 255] = 1;
+  imgproc_autolevels_lut( hist, lut );
+
+  ASSERT( lut[0] == 0 && lut[10] == 0 && lut[11] == 26 && lut[15] == 128 );
+  ASSERT( lut[19] == 230 && lut[20] == 255 && lut[255] == 255 );
+  for ( int v = 0; v < 256; ++v ) {
+    ASSERT( lut[256 + v] == v );
+    ASSERT( lut[512 + v] == v );
+  }
+}
+
+void test_equalize_lut( TestObjs *objs ) {
+  (void) objs;
+  uint32_t hist[4 * 256] = { 0 };
+  uint8_t lut[3 * 256];
+
+  hist[100] = 1;      // red: three equally common values
+  hist[101] = 1;
+  hist[200] = 1;
+  hist[256 + 50] = 9; // green has a single value
+  hist[512 + 0] = 1;  // blue: one dark pixel, three bright ones
+  hist[512 + 10] = 3;
+  imgproc_equalize_lut( hist, lut );
+
+  ASSERT( lut[99] == 0 && lut[100] == 0 && lut[101] == 128 && lut[150] == 128 && lut[200] == 255 );
+  ASSERT( lut[256 + 50] == 50 && lut[256 + 51] == 51 );
+  ASSERT( lut[512 + 0] == 0 && lut[512 + 5] == 0 && lut[512 + 10] == 255 );
+}
+
+void test_autolevels_equalize_basic( TestObjs *objs ) {
+  struct Image *in = &objs->smol;
+  struct Image *out_img = create_output_image( in );
+  struct Image *expected_img = create_output_image( in );
+  uint32_t hist[4 * 256];
+  uint8_t lut[3 * 256];
+
+  imgproc_histogram( in, hist );
+  imgproc_autolevels_lut( hist, lut );
+  imgproc_apply_lut( in, expected_img, lut );
+  imgproc_autolevels( in, out_img );
+  ASSERT( images_equal( out_img, expected_img ) );
+
+  // every channel now reaches both ends of the range
+  imgproc_histogram( out_img, hist );
+  for ( int c = 0; c < 3; ++c )
+    ASSERT( hist[c * 256] != 0 && hist[c * 256 + 255] != 0 );
+
+  imgproc_histogram( in, hist );
+  imgproc_equalize_lut( hist, lut );
+  imgproc_apply_lut( in, expected_img, lut );
+  imgproc_equalize( in, out_img );
+  ASSERT( images_equal( out_img, expected_img ) );
+
+  destroy_img( out_img );
+  destroy_img( expected_img );
+}
+
+void test_img_hash( TestObjs *objs ) {
+  (void) objs;
+  // brightness increasing to the right sets every dhash bit
+  uint32_t gradient_pixels[18 * 8];
+  for ( int i = 0; i < 18 * 8; ++i ) {
+    uint32_t v = ( i % 18 ) * 14;
+    gradient_pixels[i] = ( v << 24 ) | ( v << 16 ) | ( v << 8 ) | 0xFF;
+  }
+  struct Image gradient = { 18, 8, gradient_pixels };
+  uint64_t hash, small_hash;
+  ASSERT( img_dhash( &gradient, &hash ) == IMG_SUCCESS );
+  ASSERT( hash == 0xFFFFFFFFFFFFFFFFULL );
+
+  struct Image *flipped = create_output_image( &gradient );
+  imgproc_flip( &gradient, flipped, 1 );
+  ASSERT( img_dhash( flipped, &hash ) == IMG_SUCCESS );
+  ASSERT( hash == 0 );
+  destroy_img( flipped );
+
+  // shrinking an image barely changes its hashes
+  uint32_t *blob_pixels = malloc( 128 * 64 * sizeof( uint32_t ) );
+  for ( int i = 0; i < 64; ++i )
+    for ( int j = 0; j < 128; ++j ) {
+      int dx = j - 40, dy = i - 24;
+      uint32_t v = dx*dx + 2*dy*dy < 400 ? 220 : 30 + j;
+      blob_pixels[i*128 + j] = ( v << 24 ) | ( ( v / 2 ) << 16 ) | ( v << 8 ) | 0xFF;
+    }
+  struct Image blob = { 128, 64, blob_pixels };
+  uint32_t small_pixels[64 * 32];
+  struct Image small = { 64, 32, small_pixels };
+  imgproc_squash( &blob, &small, 2, 2 );
+  ASSERT( img_dhash( &blob, &hash ) == IMG_SUCCESS && img_dhash( &small, &small_hash ) == IMG_SUCCESS );
+  ASSERT( img_hash_distance( hash, small_hash ) <= 4 );
+  ASSERT( img_phash( &blob, &hash ) == IMG_SUCCESS && img_phash( &small, &small_hash ) == IMG_SUCCESS );
+  ASSERT( img_hash_distance( hash, small_hash ) <= 4 );
+  ASSERT( img_phash( &blob, &small_hash ) == IMG_SUCCESS && small_hash == hash );
+  free( blob_pixels );
+
+  ASSERT( img_hash_distance( 0, 0 ) == 0 );
+  ASSERT( img_hash_distance( 0xF0F0, 0x0FF0 ) == 8 );
+  ASSERT( img_hash_distance( 0, ~0ULL ) == 64 );
+}
+
+void test_squash_avg_basic( TestObjs *objs ) {
+  static const int factors[][2] = { { 2, 2 }, { 3, 1 }, { 1, 3 }, { 4, 3 }, { 2, 5 } };
+  struct Image *out_img;
+
+  for ( unsigned f = 0; f < sizeof( factors ) / sizeof( factors[0] ); ++f ) {
+    int xfac = factors[f][0], yfac = factors[f][1];
+    out_img = malloc( sizeof( struct Image ) );
+    img_init( out_img, objs->smol.width / xfac, objs->smol.height / yfac );
+    ASSERT( imgproc_squash_avg( &objs->smol, out_img, xfac, yfac ) );
+    ASSERT( squash_avg_matches_naive( &objs->smol, out_img, xfac, yfac ) );
+    destroy_img( out_img );
+  }
+
+  // a 1x1 block is just a copy
+  out_img = create_output_image( &objs->smol );
+  imgproc_squash_avg( &objs->smol, out_img, 1, 1 );
+  ASSERT( images_equal( out_img, &objs->smol ) );
+  destroy_img( out_img );
+
+  // odd widths exercise the single-pixel tail of the 2x2 case
+  struct Image *odd = create_random_image( 23, 9, 0 );
+  for ( int xfac = 1; xfac <= 5; ++xfac ) {
+    out_img = malloc( sizeof( struct Image ) );
+    img_init( out_img, odd->width / xfac, odd->height / 2 );
+    ASSERT( imgproc_squash_avg( odd, out_img, xfac, 2 ) );
+    ASSERT( squash_avg_matches_naive( odd, out_img, xfac, 2 ) );
+    destroy_img( out_img );
+  }
+  destroy_img( odd );
+}
+
+void test_expandRow( TestObjs *objs ) {
+  (void) objs;
+  uint32_t above[3] = { 0x10203040, 0x20304050, 0xFF00FF00 };
+  uint32_t below[3] = { 0x30405060, 0x40506071, 0x00FF00FF };
+  uint32_t out_row[6];
+
+  // an even row repeats the input pixels and averages neighbors
+  expandRow( above, NULL, 3, out_row );
+  ASSERT( out_row[0] == 0x10203040 && out_row[1] == 0x18283848 );
+  ASSERT( out_row[2] == 0x20304050 && out_row[3] == 0x8F189F28 );
+  ASSERT( out_row[4] == 0xFF00FF00 && out_row[5] == 0xFF00FF00 );
+
+  // an odd row averages with the row below it
+  expandRow( above, below, 3, out_row );
+  ASSERT( out_row[0] == 0x20304050 && out_row[1] == 0x28384858 );
+  ASSERT( out_row[2] == 0x30405060 && out_row[3] == 0x575F6770 );
+  ASSERT( out_row[4] == 0x7F7F7F7F && out_row[5] == 0x7F7F7F7F );
+}
+
+void test_expand_n_basic( TestObjs *objs ) {
+  struct Image *in = &objs->smol;
+
+  for ( int32_t n = 2; n <= 16; n *= 2 ) {
+    // expected result: imgproc_expand applied log2(n) times
+    struct Image *expected = create_output_image( in );
+    memcpy( expected->data, in->data, in->width * in->height * sizeof( uint32_t ) );
+    for ( int32_t f = 2; f <= n; f *= 2 ) {
+      struct Image *next = malloc( sizeof( struct Image ) );
+      img_init( next, expected->width * 2, expected->height * 2 );
+      imgproc_expand( expected, next );
+      destroy_img( expected );
+      expected = next;
+    }
+
+    struct Image *out_img = malloc( sizeof( struct Image ) );
+    img_init( out_img, in->width * n, in->height * n );
+    ASSERT( imgproc_expand_n( in, out_img, n ) );
+    ASSERT( images_equal( out_img, expected ) );
+    destroy_img( out_img );
+    destroy_img( expected );
+  }
+
+  // n must be a power of two of at least 2
+  struct Image *out_img = create_output_image( in );
+  ASSERT( !imgproc_expand_n( in, out_img, 1 ) );
+  ASSERT( !imgproc_expand_n( in, out_img, 0 ) );
+  ASSERT( !imgproc_expand_n( in, out_img, 6 ) );
+  destroy_img( out_img );
+}
+
+void test_img_write_opaque( TestObjs *objs ) {
+  const char *filename = "/tmp/imgproc_tests_opaque.png";
+  struct Image *copy = create_output_image( &objs->smol );
+  memcpy( copy->data, objs->smol.data, objs->smol.width * objs->smol.height * sizeof( uint32_t ) );
+
+  for ( int translucent = 0; translucent <= 1; ++translucent ) {
+    // a single translucent pixel (in the last block checked) keeps the alpha channel
+    if ( translucent )
+      copy->data[copy->width * copy->height - 1] &= 0xFFFFFF80;
+
+    ASSERT( img_write( filename, copy ) == IMG_SUCCESS );
+
+    png_t png;
+    ASSERT( png_open_file_read( &png, filename ) == PNG_NO_ERROR );
+    ASSERT( png.color_type == ( translucent ? PNG_TRUECOLOR_ALPHA : PNG_TRUECOLOR ) );
+    png_close_file( &png );
+
+    struct Image read_back;
+    ASSERT( img_read( filename, &read_back ) == IMG_SUCCESS );
+    ASSERT( images_equal( &read_back, copy ) );
+    img_cleanup( &read_back );
+  }
+
+  remove( filename );
+  destroy_img( copy );
+}
+
+void test_img_write_palette( TestObjs *objs ) {
+  (void) objs;
+  const char *filename = "/tmp/imgproc_tests_palette.png";
+  uint32_t pixels[32 * 32];
+  struct Image img = { 32, 32, pixels };
+
+  for ( int num_colors = 1; num_colors <= 257; num_colors += 128 ) {
+    // runs of equal pixels, including translucent and fully transparent ones
+    for ( int i = 0; i < 32 * 32; ++i )
+      pixels[i] = ( i / 3 ) % num_colors == 0 ? 0 : ( ( i / 3 ) % num_colors ) * 0x01020304U;
+
+    ASSERT( img_write_palette( filename, &img ) == IMG_SUCCESS );
+
+    png_t png;
+    ASSERT( png_open_file_read( &png, filename ) == PNG_NO_ERROR );
+    ASSERT( png.color_type == ( num_colors <= 256 ? PNG_INDEXED : PNG_TRUECOLOR_ALPHA ) );
+    png_close_file( &png );
+
+    struct Image read_back;
+    ASSERT( img_read( filename, &read_back ) == IMG_SUCCESS );
+    ASSERT( images_equal( &read_back, &img ) );
+    img_cleanup( &read_back );
+  }
+
+  remove( filename );
+}
+
+void test_img_raw_frames( TestObjs *objs ) {
+  FILE *stream = tmpfile();
+  ASSERT( stream != NULL );
+
+  // two frames, the second one with 2000 pixels (more than one chunk)
+  struct Image *big = create_random_image( 50, 40, 0 );
+  ASSERT( img_write_raw( stream, &objs->smol ) == IMG_SUCCESS );
+  ASSERT( img_write_raw( stream, big ) == IMG_SUCCESS );
+
+  // pixels are stored as red, green, blue, alpha bytes
+  unsigned char bytes[4];
+  rewind( stream );
+  ASSERT( fread( bytes, 1, 4, stream ) == 4 );
+  uint32_t first = objs->smol.data[0];
+  ASSERT( bytes[0] == first >> 24 && bytes[1] == ( ( first >> 16 ) & 0xFF )
+          && bytes[2] == ( ( first >> 8 ) & 0xFF ) && bytes[3] == ( first & 0xFF ) );
+
+  // frames are read back into reused Images
+  struct Image *frame = create_output_image( &objs->smol );
+  struct Image *big_frame = create_output_image( big );
+  rewind( stream );
+  ASSERT( img_read_raw( stream, frame ) == IMG_SUCCESS );
+  ASSERT( images_equal( frame, &objs->smol ) );
+  ASSERT( img_read_raw( stream, big_frame ) == IMG_SUCCESS );
+  ASSERT( images_equal( big_frame, big ) );
+  ASSERT( img_read_raw( stream, frame ) == IMG_END_OF_STREAM );
+
+  // a partial frame is an error
+  rewind( stream );
+  ASSERT( img_read_raw( stream, big_frame ) == IMG_SUCCESS );
+  ASSERT( img_read_raw( stream, big_frame ) == IMG_ERR_TRUNCATED );
+
+  fclose( stream );
+  destroy_img( frame );
+  destroy_img( big_frame );
+  destroy_img( big );
+}
+
+void test_large_outputs( TestObjs *objs ) {
+  (void) objs;
+  // big enough for the non-temporal store paths (more than 8MB of output)
+  struct Image *in = create_random_image( 1501, 1400, 0 );
+
+  struct Image *out_img = create_output_image( in );
+  imgproc_color_rot( in, out_img );
+  for ( int i = 0; i < in->width * in->height; ++i ) {
+    uint32_t p = in->data[i];
+    ASSERT( out_img->data[i] == ( ( ( p >> 8 ) & 0xFF ) << 24 | ( p >> 24 ) << 16 | ( ( p >> 16 ) & 0xFF ) << 8 | ( p & 0xFF ) ) );
+  }
+
+  imgproc_squash( in, out_img, 1, 1 );
+  ASSERT( images_equal( out_img, in ) );
+  destroy_img( out_img );
+
+  // imgproc_expand matches expandRow row by row
+  out_img = malloc( sizeof( struct Image ) );
+  img_init( out_img, in->width * 2, in->height * 2 );
+  imgproc_expand( in, out_img );
+  uint32_t *row = malloc( out_img->width * sizeof( uint32_t ) );
+  for ( int i = 0; i < out_img->height; ++i ) {
+    const uint32_t *below = i % 2 != 0 && i / 2 + 1 < in->height ? &in->data[( i / 2 + 1 ) * in->width] : NULL;
+    expandRow( &in->data[( i / 2 ) * in->width], below, in->width, row );
+    ASSERT( memcmp( row, &out_img->data[i * out_img->width], out_img->width * sizeof( uint32_t ) ) == 0 );
+  }
+  free( row );
+  destroy_img( out_img );
+  destroy_img( in );
+}
+
+void test_tiled_image( TestObjs *objs ) {
+  // smol fits in one tile; the synthetic image has partial edge tiles
+  struct Image *odd = create_random_image( 150, 70, 0 );
+  struct Image *inputs[] = { &objs->smol, odd };
+
+  for ( int n = 0; n < 2; ++n ) {
+    struct Image *in = inputs[n];
+    struct TiledImage tin, tout;
+    ASSERT( img_to_tiled( in, &tin ) == IMG_SUCCESS );
+
+    // round trip
+    struct Image *out_img = create_output_image( in );
+    img_from_tiled( &tin, out_img );
+    ASSERT( images_equal( out_img, in ) );
+
+    // the largest window reaches past the neighboring tiles
+    int dists[] = { 0, 5, 70 };
+    for ( int k = 0; k < 3; ++k ) {
+      int d = dists[k];
+      imgproc_blur( in, out_img, d );
+      ASSERT( img_tiled_init( &tout, in->width, in->height ) == IMG_SUCCESS );
+      ASSERT( img_tiled_blur( &tin, &tout, d ) == IMG_SUCCESS );
+      struct Image *tiled_out = create_output_image( in );
+      img_from_tiled( &tout, tiled_out );
+      ASSERT( images_equal( tiled_out, out_img ) );
+      destroy_img( tiled_out );
+      img_tiled_cleanup( &tout );
+    }
+
+    ASSERT( imgproc_rotate( in, out_img, 180 ) );
+    ASSERT( img_tiled_init( &tout, in->width, in->height ) == IMG_SUCCESS );
+    ASSERT( img_tiled_rotate( &tin, &tout, 180 ) == IMG_SUCCESS );
+    ASSERT( img_tiled_rotate( &tin, &tout, 45 ) == IMG_ERR_INVALID_ARGUMENT );
+    struct Image *tiled_out = create_output_image( in );
+    img_from_tiled( &tout, tiled_out );
+    ASSERT( images_equal( tiled_out, out_img ) );
+    destroy_img( tiled_out );
+    img_tiled_cleanup( &tout );
+    destroy_img( out_img );
+
+    for ( int degrees = 90; degrees <= 270; degrees += 180 ) {
+      out_img = create_transposed_output_image( in );
+      ASSERT( imgproc_rotate( in, out_img, degrees ) );
+      ASSERT( img_tiled_init( &tout, in->height, in->width ) == IMG_SUCCESS );
+      ASSERT( img_tiled_rotate( &tin, &tout, degrees ) == IMG_SUCCESS );
+      tiled_out = create_transposed_output_image( in );
+      img_from_tiled( &tout, tiled_out );
+      ASSERT( images_equal( tiled_out, out_img ) );
+      destroy_img( tiled_out );
+      img_tiled_cleanup( &tout );
+      destroy_img( out_img );
+    }
+
+    out_img = malloc( sizeof( struct Image ) );
+    img_init( out_img, in->width / 3, in->height / 2 );
+    imgproc_squash( in, out_img, 3, 2 );
+    ASSERT( img_tiled_init( &tout, out_img->width, out_img->height ) == IMG_SUCCESS );
+    img_tiled_squash( &tin, &tout, 3, 2 );
+    tiled_out = malloc( sizeof( struct Image ) );
+    img_init( tiled_out, out_img->width, out_img->height );
+    img_from_tiled( &tout, tiled_out );
+    ASSERT( images_equal( tiled_out, out_img ) );
+    destroy_img( tiled_out );
+    img_tiled_cleanup( &tout );
+    destroy_img( out_img );
+
+    img_tiled_cleanup( &tin );
+  }
+  destroy_img( odd );
+}
+
+void test_tile_store( TestObjs *objs ) {
+  (void) objs;
+  // a smooth gradient on the left, noise on the right
+  struct Image *in = create_random_image( 150, 70, 0 );
+  for ( int i = 0; i < in->height; ++i )
+    for ( int j = 0; j < 100; ++j )
+      in->data[i*in->width + j] = createPixel( 2*j, i, 128, 255 );
+
+  struct TiledImage tin, tout, check;
+  ASSERT( img_to_tiled( in, &tin ) == IMG_SUCCESS );
+  struct TileStore store;
+  ASSERT( img_tilestore_from_tiled( &tin, &store, 1 ) == IMG_SUCCESS );
+  ASSERT( store.cache_size == IMG_TILESTORE_MIN_CACHE );
+  ASSERT( store.stats.raw_bytes == 3 * 2 * IMG_TILE_SIZE * IMG_TILE_SIZE * sizeof( uint32_t ) );
+  ASSERT( store.stats.compressed_bytes < store.stats.raw_bytes );
+  ASSERT( store.stats.compressions == 6 );
+
+  // round trip
+  ASSERT( img_tiled_init( &check, in->width, in->height ) == IMG_SUCCESS );
+  ASSERT( img_tilestore_to_tiled( &store, &check ) == IMG_SUCCESS );
+  ASSERT( memcmp( check.data, tin.data, 6 * IMG_TILE_SIZE * IMG_TILE_SIZE * sizeof( uint32_t ) ) == 0 );
+  ASSERT( store.stats.decompressions == 6 );
+
+  // modified tiles are compressed again on eviction or flush
+  uint32_t *tile = img_tilestore_tile( &store, 1, 2, 1 );
+  ASSERT( tile != NULL );
+  tile[5] = 0x12345678;
+  ASSERT( img_tilestore_flush( &store ) == IMG_SUCCESS );
+  ASSERT( store.stats.compressions == 7 );
+  *img_tiled_pixel( &tin, 64, 133 ) = 0x12345678;
+  ASSERT( img_tilestore_to_tiled( &store, &check ) == IMG_SUCCESS );
+  ASSERT( memcmp( check.data, tin.data, 6 * IMG_TILE_SIZE * IMG_TILE_SIZE * sizeof( uint32_t ) ) == 0 );
+  img_tiled_cleanup( &check );
+
+  // rotating with the smallest cache matches img_tiled_rotate
+  for ( int degrees = 90; degrees <= 270; degrees += 90 ) {
+    int32_t w = degrees == 180 ? in->width : in->height;
+    int32_t h = degrees == 180 ? in->height : in->width;
+    struct TileStore rotated;
+    ASSERT( img_tilestore_init( &rotated, w, h, 0 ) == IMG_SUCCESS );
+    ASSERT( img_tilestore_rotate( &store, &rotated, degrees ) == IMG_SUCCESS );
+    ASSERT( img_tiled_init( &tout, w, h ) == IMG_SUCCESS );
+    ASSERT( img_tiled_rotate( &tin, &tout, degrees ) == IMG_SUCCESS );
+    ASSERT( img_tiled_init( &check, w, h ) == IMG_SUCCESS );
+    ASSERT( img_tilestore_to_tiled( &rotated, &check ) == IMG_SUCCESS );
+    ASSERT( memcmp( check.data, tout.data, 6 * IMG_TILE_SIZE * IMG_TILE_SIZE * sizeof( uint32_t ) ) == 0 );
+    img_tiled_cleanup( &check );
+    img_tiled_cleanup( &tout );
+    img_tilestore_cleanup( &rotated );
+  }
+  ASSERT( img_tilestore_rotate( &store, &store, 45 ) == IMG_ERR_INVALID_ARGUMENT );
+
+  img_tilestore_cleanup( &store );
+  img_tiled_cleanup( &tin );
+  destroy_img( in );
+}
+
+void test_tile_store_spill( TestObjs *objs ) {
+  (void) objs;
+  struct Image *in = create_random_image( 150, 70, 0 );
+
+  struct TileStore store;
+  ASSERT( img_tilestore_init_spill( &store, in->width, in->height, 0, "/tmp" ) == IMG_SUCCESS );
+  ASSERT( store.stats.compressed_bytes == 0 );
+
+  // tiles that were never written are opaque black
+  struct Image *region = malloc( sizeof( struct Image ) );
+  img_init( region, 50, 40 );
+  ASSERT( img_tilestore_read_region( &store, 10, 60, region ) == IMG_SUCCESS );
+  for ( int i = 0; i < region->width * region->height; ++i )
+    ASSERT( region->data[i] == 0x000000FF );
+  ASSERT( store.stats.spill_reads == 0 );
+
+  // all 6 tiles don't fit in the cache, so some are written back early
+  ASSERT( img_tilestore_write_region( &store, 0, 0, in ) == IMG_SUCCESS );
+  ASSERT( store.stats.spill_writes == 2 );
+  ASSERT( img_tilestore_flush( &store ) == IMG_SUCCESS );
+  ASSERT( store.stats.spill_writes == 6 );
+  ASSERT( store.stats.compressed_bytes == store.stats.raw_bytes );
+
+  ASSERT( img_tilestore_read_region( &store, 10, 60, region ) == IMG_SUCCESS );
+  for ( int i = 0; i < region->height; ++i )
+    for ( int j = 0; j < region->width; ++j )
+      ASSERT( region->data[i*region->width + j] == in->data[(10 + i)*in->width + 60 + j] );
+  ASSERT( img_tilestore_read_region( &store, 40, 60, region ) == IMG_ERR_INVALID_ARGUMENT );
+  destroy_img( region );
+
+  // rotating between spill-backed stores with the smallest caches
+  struct TileStore rotated;
+  ASSERT( img_tilestore_init_spill( &rotated, in->height, in->width, 0, "/tmp" ) == IMG_SUCCESS );
+  ASSERT( img_tilestore_rotate( &store, &rotated, 90 ) == IMG_SUCCESS );
+  struct Image *out_img = create_transposed_output_image( in );
+  struct Image *expected = create_transposed_output_image( in );
+  ASSERT( imgproc_rotate( in, expected, 90 ) );
+  ASSERT( img_tilestore_read_region( &rotated, 0, 0, out_img ) == IMG_SUCCESS );
+  ASSERT( images_equal( out_img, expected ) );
+  ASSERT( store.readahead == 1 );
+
+  destroy_img( expected );
+  destroy_img( out_img );
+  img_tilestore_cleanup( &rotated );
+  img_tilestore_cleanup( &store );
+  destroy_img( in );
+}
+
+void test_batch( TestObjs *objs ) {
+  (void) objs;
+  // enough 128x128 images that tasks span images, plus one larger
+  // image that is split over several tasks, and one invalid entry
+  enum { COUNT = 12 };
+  struct Image *inputs[COUNT], *outputs[COUNT], *expected[COUNT];
+  int32_t xfacs[COUNT], yfacs[COUNT], dists[COUNT];
+  int status[COUNT];
+  for ( int n = 0; n < COUNT; ++n ) {
+    int size = n == 5 ? 700 : 128;
+    inputs[n] = create_random_image( size, size + n, n );
+    xfacs[n] = 1 + n % 3;
+    yfacs[n] = 1 + n % 2;
+    dists[n] = n % 4;
+  }
+  xfacs[7] = 0;
+  dists[7] = -1;
+
+  for ( int n = 0; n < COUNT; ++n ) {
+    outputs[n] = malloc( sizeof( struct Image ) );
+    expected[n] = malloc( sizeof( struct Image ) );
+    int32_t xfac = xfacs[n] > 0 ? xfacs[n] : 1;
+    img_init( outputs[n], inputs[n]->width / xfac, inputs[n]->height / yfacs[n] );
+    img_init( expected[n], inputs[n]->width / xfac, inputs[n]->height / yfacs[n] );
+    imgproc_squash( inputs[n], expected[n], xfac, yfacs[n] );
+  }
+  ASSERT( img_batch_squash( inputs, outputs, xfacs, yfacs, COUNT, 3, NULL, status ) == IMG_SUCCESS );
+  for ( int n = 0; n < COUNT; ++n ) {
+    ASSERT( status[n] == ( n == 7 ? IMG_ERR_INVALID_ARGUMENT : IMG_SUCCESS ) );
+    if ( n != 7 )
+      ASSERT( images_equal( outputs[n], expected[n] ) );
+  }
+
+  for ( int n = 0; n < COUNT; ++n ) {
+    destroy_img( outputs[n] );
+    destroy_img( expected[n] );
+    outputs[n] = create_output_image( inputs[n] );
+    expected[n] = create_output_image( inputs[n] );
+    if ( n != 7 )
+      imgproc_blur( inputs[n], expected[n], dists[n] );
+  }
+  ASSERT( img_batch_blur( inputs, outputs, dists, COUNT, 3, NULL, status ) == IMG_SUCCESS );
+  for ( int n = 0; n < COUNT; ++n ) {
+    ASSERT( status[n] == ( n == 7 ? IMG_ERR_INVALID_ARGUMENT : IMG_SUCCESS ) );
+    if ( n != 7 )
+      ASSERT( images_equal( outputs[n], expected[n] ) );
+  }
+
+  for ( int n = 0; n < COUNT; ++n ) {
+    destroy_img( inputs[n] );
+    destroy_img( outputs[n] );
+    destroy_img( expected[n] );
+  }
+}
+
+// Argument of the compute jobs of test_async_jobs
+struct AsyncBlur {
+  struct Image *in, *out;
+};
+
+int async_blur( void *arg, const struct ImgCancel *cancel ) {
+  (void) cancel;
+  struct AsyncBlur *blur = arg;
+  imgproc_blur( blur->in, blur->out, 2 );
+  return IMG_SUCCESS;
+}
+
+void async_count( struct ImgJob *job, void *user ) {
+  (void) job;
+  __atomic_add_fetch( (int *) user, 1, __ATOMIC_SEQ_CST );
+}
+
+void test_async_jobs( TestObjs *objs ) {
+  struct ImgAsync *pool = img_async_create( 2, 2 );
+  ASSERT( pool != NULL );
+  int completed = 0;
+
+  // many compute jobs in flight at once
+  enum { COUNT = 20 };
+  struct AsyncBlur blurs[COUNT];
+  struct ImgJob *jobs[COUNT];
+  struct Image *expected = create_output_image( &objs->smol );
+  imgproc_blur( &objs->smol, expected, 2 );
+  for ( int n = 0; n < COUNT; ++n ) {
+    blurs[n].in = &objs->smol;
+    blurs[n].out = create_output_image( &objs->smol );
+    jobs[n] = img_async_compute( pool, async_blur, &blurs[n], NULL, async_count, &completed );
+    ASSERT( jobs[n] != NULL );
+  }
+  for ( int n = 0; n < COUNT; ++n ) {
+    ASSERT( img_job_wait( jobs[n] ) == IMG_SUCCESS );
+    int rc;
+    ASSERT( img_job_poll( jobs[n], &rc ) && rc == IMG_SUCCESS );
+    ASSERT( images_equal( blurs[n].out, expected ) );
+    ASSERT( img_job_take_image( jobs[n] ) == NULL );
+    img_job_release( jobs[n] );
+    destroy_img( blurs[n].out );
+  }
+  destroy_img( expected );
+
+  // write, then read back
+  const char *filename = "/tmp/imgproc_tests_async.png";
+  struct ImgJob *job = img_async_write( pool, filename, &objs->smol, NULL, async_count, &completed );
+  ASSERT( img_job_wait( job ) == IMG_SUCCESS );
+  img_job_release( job );
+  job = img_async_read( pool, filename, NULL, async_count, &completed );
+  ASSERT( img_job_wait( job ) == IMG_SUCCESS );
+  struct Image *read = img_job_take_image( job );
+  ASSERT( read != NULL && images_equal( read, &objs->smol ) );
+  ASSERT( img_job_take_image( job ) == NULL );
+  destroy_img( read );
+  img_job_release( job );
+  remove( filename );
+
+  // failures are reported through the handle; an unreleased handle
+  // outlives the pool
+  job = img_async_read( pool, "/tmp/imgproc_tests_no_such_file.png", NULL, async_count, &completed );
+  img_async_destroy( pool );
+  ASSERT( completed == COUNT + 3 );
+  ASSERT( img_job_wait( job ) == IMG_ERR_COULD_NOT_OPEN );
+  img_job_release( job );
+}
+
+void test_cancellation( TestObjs *objs ) {
+  struct ImgCancel cancel, expired;
+  ASSERT( !img_cancelled( NULL ) );
+  img_cancel_init( &cancel, 0 );
+  ASSERT( !img_cancelled( &cancel ) );
+  img_cancel_init( &expired, 1e-9 );
+  ASSERT( img_cancelled( &expired ) );
+
+  // several bands, with the blur windows reaching across band edges
+  struct Image *in = create_random_image( 600, 1500, 0 );
+  struct Image *out_img = create_output_image( in );
+  struct Image *expected = create_output_image( in );
+  imgproc_blur( in, expected, 2 );
+  ASSERT( img_band_blur( in, out_img, 2, &cancel ) == IMG_SUCCESS );
+  ASSERT( images_equal( out_img, expected ) );
+  ASSERT( img_band_blur( in, out_img, 2, &expired ) == IMG_ERR_CANCELLED );
+  destroy_img( out_img );
+  destroy_img( expected );
+
+  out_img = malloc( sizeof( struct Image ) );
+  expected = malloc( sizeof( struct Image ) );
+  img_init( out_img, in->width / 3, in->height / 2 );
+  img_init( expected, in->width / 3, in->height / 2 );
+  imgproc_squash( in, expected, 3, 2 );
+  ASSERT( img_band_squash( in, out_img, 3, 2, NULL ) == IMG_SUCCESS );
+  ASSERT( images_equal( out_img, expected ) );
+  ASSERT( img_band_squash( in, out_img, 3, 2, &expired ) == IMG_ERR_CANCELLED );
+
+  // batches report the images that didn't get done
+  int status;
+  int32_t xfac = 3, yfac = 2;
+  ASSERT( img_batch_squash( &in, &out_img, &xfac, &yfac, 1, 1, &expired, &status ) == IMG_ERR_CANCELLED );
+  ASSERT( status == IMG_ERR_CANCELLED );
+  ASSERT( img_batch_blur( &out_img, &expected, &yfac, 1, 1, &expired, &status ) == IMG_ERR_CANCELLED );
+  ASSERT( status == IMG_ERR_CANCELLED );
+  destroy_img( out_img );
+  destroy_img( expected );
+  destroy_img( in );
+
+  // the PNG codec
+  const char *filename = "/tmp/imgproc_tests_cancel.png";
+  struct Image read;
+  ASSERT( img_write_cancellable( filename, &objs->smol, &expired ) == IMG_ERR_CANCELLED );
+  ASSERT( img_write_cancellable( filename, &objs->smol, &cancel ) == IMG_SUCCESS );
+  ASSERT( img_read_cancellable( filename, &read, &expired ) == IMG_ERR_CANCELLED );
+  ASSERT( img_read_cancellable( filename, &read, &cancel ) == IMG_SUCCESS );
+  ASSERT( images_equal( &read, &objs->smol ) );
+  img_cleanup( &read );
+
+  // async jobs that are out of time don't run
+  struct ImgAsync *pool = img_async_create( 1, 1 );
+  struct ImgJobOptions options = { IMG_PRIORITY_NORMAL, 0, 1e-9 };
+  struct ImgJob *job = img_async_read( pool, filename, &options, NULL, NULL );
+  ASSERT( img_job_wait( job ) == IMG_ERR_CANCELLED );
+  ASSERT( img_job_take_image( job ) == NULL );
+  img_job_release( job );
+  job = img_async_read( pool, filename, NULL, NULL, NULL );
+  img_job_cancel( job );
+  int rc = img_job_wait( job );
+  ASSERT( rc == IMG_ERR_CANCELLED || rc == IMG_SUCCESS );
+  img_job_release( job );
+  img_async_destroy( pool );
+  remove( filename );
+}
+
+void test_img_read_header( TestObjs *objs ) {
+  const char *filename = "/tmp/imgproc_tests_header.png";
+  int32_t width, height;
+  int bpp;
+
+  // smol is opaque, so it's written without an alpha channel
+  ASSERT( img_write( filename, &objs->smol ) == IMG_SUCCESS );
+  ASSERT( img_read_header( filename, &width, &height, &bpp ) == IMG_SUCCESS );
+  ASSERT( width == objs->smol.width );
+  ASSERT( height == objs->smol.height );
+  ASSERT( bpp == 3 );
+  remove( filename );
+
+  ASSERT( img_read_header( filename, &width, &height, &bpp ) == IMG_ERR_COULD_NOT_OPEN );
+}
+
+// Shared state of the compute jobs of test_async_priority
+struct PriorityLog {
+  int order[8];       // ids of the jobs, in the order they ran
+  int count;
+  int started;        // set by the job holding up the queue
+  int release;        // set to let it finish
+};
+
+// Argument of a compute job of test_async_priority
+struct PriorityJob {
+  struct PriorityLog *log;
+  int id;
+};
+
+// Returns 1 once *flag is set, 0 if that takes more than 5 seconds.
+int wait_for_flag( int *flag ) {
+  struct ImgCancel limit;
+  img_cancel_init( &limit, 5.0 );
+  while ( !__atomic_load_n( flag, __ATOMIC_SEQ_CST ) ) {
+    if ( img_cancelled( &limit ) )
+      return 0;
+  }
+  return 1;
+}
+
+// Records the job's id
+int priority_record( void *arg, const struct ImgCancel *cancel ) {
+  (void) cancel;
+  struct PriorityJob *job = arg;
+  job->log->order[job->log->count++] = job->id;
+  return IMG_SUCCESS;
+}
+
+// Holds up the compute thread until released
+int priority_hold( void *arg, const struct ImgCancel *cancel ) {
+  (void) cancel;
+  struct PriorityLog *log = arg;
+  __atomic_store_n( &log->started, 1, __ATOMIC_SEQ_CST );
+  return wait_for_flag( &log->release ) ? IMG_SUCCESS : IMG_ERR_CANCELLED;
+}
+
+// Reaches checkpoints until a job has been recorded (which can only
+// happen at one of them, there being one compute thread)
+int priority_checkpoints( void *arg, const struct ImgCancel *cancel ) {
+  struct PriorityLog *log = arg;
+  __atomic_store_n( &log->started, 1, __ATOMIC_SEQ_CST );
+  struct ImgCancel limit;
+  img_cancel_init( &limit, 5.0 );
+  while ( log->count == 0 ) {
+    img_checkpoint( cancel );
+    if ( img_cancelled( &limit ) )
+      return IMG_ERR_CANCELLED;
+  }
+  return IMG_SUCCESS;
+}
+
+void test_async_priority( TestObjs *objs ) {
+  (void) objs;
+  struct ImgAsync *pool = img_async_create( 1, 1 );
+  ASSERT( pool != NULL );
+
+  // jobs queued behind a running one run by class, then deadline
+  struct PriorityLog log = { { 0 }, 0, 0, 0 };
+  struct ImgJob *hold = img_async_compute( pool, priority_hold, &log, NULL, NULL, NULL );
+  ASSERT( wait_for_flag( &log.started ) );
+  static const struct ImgJobOptions submitted[] = {
+    { IMG_PRIORITY_BULK, 0 }, { IMG_PRIORITY_NORMAL, 0 }, { IMG_PRIORITY_INTERACTIVE, 10 },
+    { IMG_PRIORITY_INTERACTIVE, 1 }, { IMG_PRIORITY_INTERACTIVE, 0 }, { IMG_PRIORITY_NORMAL, 5 },
+  };
+  enum { COUNT = sizeof( submitted ) / sizeof( submitted[0] ) };
+  static const int expected[COUNT] = { 3, 2, 4, 5, 1, 0 };
+  struct PriorityJob args[COUNT];
+  struct ImgJob *jobs[COUNT];
+  for ( int n = 0; n < COUNT; ++n ) {
+    args[n].log = &log;
+    args[n].id = n;
+    jobs[n] = img_async_compute( pool, priority_record, &args[n], &submitted[n], NULL, NULL );
+    ASSERT( jobs[n] != NULL );
+  }
+  __atomic_store_n( &log.release, 1, __ATOMIC_SEQ_CST );
+  ASSERT( img_job_wait( hold ) == IMG_SUCCESS );
+  img_job_release( hold );
+  for ( int n = 0; n < COUNT; ++n ) {
+    ASSERT( img_job_wait( jobs[n] ) == IMG_SUCCESS );
+    img_job_release( jobs[n] );
+  }
+  ASSERT( log.count == COUNT );
+  ASSERT( memcmp( log.order, expected, sizeof( expected ) ) == 0 );
+
+  // a more urgent job runs at a running job's checkpoint
+  struct PriorityLog preempted = { { 0 }, 0, 0, 0 };
+  struct ImgJobOptions bulk_options = { IMG_PRIORITY_BULK, 0, 0 };
+  struct ImgJob *bulk = img_async_compute( pool, priority_checkpoints, &preempted, &bulk_options, NULL, NULL );
+  ASSERT( wait_for_flag( &preempted.started ) );
+  struct PriorityJob urgent = { &preempted, 7 };
+  struct ImgJobOptions urgent_options = { IMG_PRIORITY_INTERACTIVE, 0.5, 0 };
+  struct ImgJob *job = img_async_compute( pool, priority_record, &urgent, &urgent_options, NULL, NULL );
+  ASSERT( img_job_wait( bulk ) == IMG_SUCCESS );
+  ASSERT( img_job_wait( job ) == IMG_SUCCESS );
+  ASSERT( preempted.count == 1 && preempted.order[0] == 7 );
+  img_job_release( bulk );
+  img_job_release( job );
+
+  // latency percentiles per class
+  struct ImgAsyncStats stats;
+  img_async_stats( pool, IMG_PRIORITY_INTERACTIVE, &stats );
+  ASSERT( stats.completed == 4 );
+  ASSERT( stats.p50 > 0 && stats.p50 <= stats.p90 && stats.p90 <= stats.p99 && stats.p99 <= stats.max );
+  img_async_stats( pool, IMG_PRIORITY_BULK, &stats );
+  ASSERT( stats.completed == 2 );
+  img_async_stats( pool, IMG_PRIORITY_NORMAL, &stats );
+  ASSERT( stats.completed == 3 );
+  img_async_destroy( pool );
+}
+
+void test_shm_handoff( TestObjs *objs ) {
+  int socks[2];
+  ASSERT( socketpair( AF_UNIX, SOCK_STREAM, 0, socks ) == 0 );
+
+  // the "client" allocates an input image and an output image in
+  // shared memory and sends both
+  struct Image in, out;
+  int in_fd, out_fd;
+  ASSERT( img_shm_init( &in, objs->smol.width, objs->smol.height, &in_fd ) == IMG_SUCCESS );
+  ASSERT( img_shm_init( &out, objs->smol.width, objs->smol.height, &out_fd ) == IMG_SUCCESS );
+  memcpy( in.data, objs->smol.data, objs->smol.width * objs->smol.height * sizeof( uint32_t ) );
+  ASSERT( img_shm_send( socks[0], &in, in_fd ) == IMG_SUCCESS );
+  ASSERT( img_shm_send( socks[0], &out, out_fd ) == IMG_SUCCESS );
+  close( in_fd );
+  close( out_fd );
+
+  // the "server" maps them and blurs one into the other; the client
+  // sees the result without any copying
+  struct Image server_in, server_out;
+  int fd;
+  ASSERT( img_shm_recv( socks[1], &server_in, NULL ) == IMG_SUCCESS );
+  ASSERT( img_shm_recv( socks[1], &server_out, &fd ) == IMG_SUCCESS );
+  ASSERT( fd >= 0 );
+  close( fd );
+  ASSERT( server_in.data != in.data && images_equal( &server_in, &objs->smol ) );
+  imgproc_blur( &server_in, &server_out, 3 );
+  ASSERT( images_equal( &out, &objs->smol_blur_3 ) );
+  img_shm_cleanup( &server_in );
+  img_shm_cleanup( &server_out );
+  ASSERT( server_in.data == NULL );
+
+  // a message without a descriptor, and a closed socket
+  struct Image received;
+  ASSERT( write( socks[0], "12345678", 8 ) == 8 );
+  ASSERT( img_shm_recv( socks[1], &received, NULL ) == IMG_ERR_TRUNCATED );
+  close( socks[0] );
+  ASSERT( img_shm_recv( socks[1], &received, NULL ) == IMG_END_OF_STREAM );
+  close( socks[1] );
+
+  // a descriptor that isn't a socket
+  int pipe_fds[2];
+  ASSERT( pipe( pipe_fds ) == 0 );
+  ASSERT( img_shm_recv( pipe_fds[0], &received, NULL ) == IMG_ERR_TRUNCATED );
+  close( pipe_fds[0] );
+  close( pipe_fds[1] );
+
+  ASSERT( img_shm_init( &received, 0, 5, &fd ) == IMG_ERR_INVALID_ARGUMENT );
+  img_shm_cleanup( &in );
+  img_shm_cleanup( &out );
+}
+
+void test_img_write_errors( TestObjs *objs ) {
+  // every write to /dev/full fails with ENOSPC: a small image only
+  // fails when the buffered file is closed, a large one while its
+  // chunks are written
+  ASSERT( img_write( "/dev/full", &objs->smol ) == IMG_ERR_COULD_NOT_WRITE );
+  ASSERT( img_write_palette( "/dev/full", &objs->smol ) == IMG_ERR_COULD_NOT_WRITE );
+
+  struct Image *large = create_random_image( 1000, 1000, 0 );
+  ASSERT( img_write( "/dev/full", large ) == IMG_ERR_COULD_NOT_WRITE );
+  destroy_img( large );
+}
+
+void test_parallel_median( TestObjs *objs ) {
+  struct Image *large = create_random_image( 37, 211, 0 );
+  struct Image *inputs[] = { &objs->smol, large };
+  static const int32_t dists[] = { 0, 1, 3, 12 };
+
+  for ( int k = 0; k < 2; ++k ) {
+    struct Image *expected = create_output_image( inputs[k] );
+    struct Image *out = create_output_image( inputs[k] );
+    for ( int d = 0; d < 4; ++d ) {
+      ASSERT( imgproc_median( inputs[k], expected, dists[d] ) );
+      // uneven bands, and more threads than there are bands tall
+      // enough for the filter's window
+      for ( int threads = 1; threads <= 7; threads += 2 ) {
+        memset( out->data, 0, out->width * out->height * sizeof( uint32_t ) );
+        ASSERT( img_parallel_median( inputs[k], out, dists[d], threads ) == IMG_SUCCESS );
+        ASSERT( images_equal( out, expected ) );
+      }
+    }
+    destroy_img( expected );
+    destroy_img( out );
+  }
+  destroy_img( large );
+}
+
+void test_parallel_sobel( TestObjs *objs ) {
+  struct Image *large = create_random_image( 37, 53, 0 );
+  struct Image *inputs[] = { &objs->smol, large };
+
+  for ( int k = 0; k < 2; ++k ) {
+    struct Image *expected = create_output_image( inputs[k] );
+    struct Image *out = create_output_image( inputs[k] );
+    imgproc_sobel( inputs[k], expected );
+    // uneven bands, and more threads than there are bands tall
+    // enough for the kernel's window
+    for ( int threads = 1; threads <= 7; threads += 2 ) {
+      memset( out->data, 0, out->width * out->height * sizeof( uint32_t ) );
+      ASSERT( img_parallel_sobel( inputs[k], out, threads ) == IMG_SUCCESS );
+      ASSERT( images_equal( out, expected ) );
+    }
+    destroy_img( expected );
+    destroy_img( out );
+  }
+  destroy_img( large );
+}
@@ -0,0 +1,141 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include "imgshm.h"
+
+// Message sent with a shared image's file descriptor
+struct ShmHeader {
+  int32_t width, height;
+};
+
+// Returns the size in bytes of an image's pixel data, or 0 if the
+// dimensions are invalid.
+static size_t image_bytes(int32_t width, int32_t height) {
+  if (width <= 0 || height <= 0 || (size_t) width > SIZE_MAX / sizeof(uint32_t) / (size_t) height) {
+    return 0;
+  }
+  return (size_t) width * height * sizeof(uint32_t);
+}
+
+int img_shm_init(struct Image *img, int32_t width, int32_t height, int *fd) {
+  size_t bytes = image_bytes(width, height);
+  if (bytes == 0) {
+    return IMG_ERR_INVALID_ARGUMENT;
+  }
+  int memfd = memfd_create("imgproc", MFD_CLOEXEC);
+  if (memfd < 0) {
+    return IMG_ERR_MALLOC_FAILED;
+  }
+  int rc = ftruncate(memfd, bytes) == 0 ? img_shm_map(img, width, height, memfd) : IMG_ERR_MALLOC_FAILED;
+  if (rc != IMG_SUCCESS) {
+    close(memfd);
+    return rc;
+  }
+  *fd = memfd;
+  return IMG_SUCCESS;
+}
+
+int img_shm_map(struct Image *img, int32_t width, int32_t height, int fd) {
+  size_t bytes = image_bytes(width, height);
+  struct stat st;
+  if (bytes == 0 || fstat(fd, &st) != 0 || (size_t) st.st_size < bytes) {
+    return IMG_ERR_INVALID_ARGUMENT;
+  }
+  void *data = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (data == MAP_FAILED) {
+    return IMG_ERR_MALLOC_FAILED;
+  }
+  img->width = width;
+  img->height = height;
+  img->data = data;
+  return IMG_SUCCESS;
+}
+
+int img_shm_send(int sock, const struct Image *img, int fd) {
+  struct ShmHeader header = { img->width, img->height };
+  struct iovec iov = { &header, sizeof(header) };
+  union {
+    char buf[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr align;
+  } control;
+  memset(&control, 0, sizeof(control));
+
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+  ssize_t sent;
+  do {
+    sent = sendmsg(sock, &msg, MSG_NOSIGNAL);
+  } while (sent < 0 && errno == EINTR);
+  return sent == (ssize_t) sizeof(header) ? IMG_SUCCESS : IMG_ERR_COULD_NOT_WRITE;
+}
+
+int img_shm_recv(int sock, struct Image *img, int *fd) {
+  struct ShmHeader header;
+  struct iovec iov = { &header, sizeof(header) };
+  union {
+    char buf[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr align;
+  } control;
+  memset(&control, 0, sizeof(control));
+
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+
+  ssize_t received;
+  do {
+    received = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+  } while (received < 0 && errno == EINTR);
+  if (received < 0) {
+    return IMG_ERR_TRUNCATED;
+  }
+  if (received == 0) {
+    return IMG_END_OF_STREAM;
+  }
+
+  int memfd = -1;
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS
+      && cmsg->cmsg_len == CMSG_LEN(sizeof(int))) {
+    memcpy(&memfd, CMSG_DATA(cmsg), sizeof(int));
+  }
+  if (received != (ssize_t) sizeof(header) || memfd < 0 || (msg.msg_flags & MSG_CTRUNC)) {
+    if (memfd >= 0) {
+      close(memfd);
+    }
+    return IMG_ERR_TRUNCATED;
+  }
+
+  int rc = img_shm_map(img, header.width, header.height, memfd);
+  if (rc != IMG_SUCCESS || fd == NULL) {
+    close(memfd);
+  } else {
+    *fd = memfd;
+  }
+  return rc;
+}
+
+void img_shm_cleanup(struct Image *img) {
+  size_t bytes = image_bytes(img->width, img->height);
+  if (img->data != NULL && bytes > 0) {
+    munmap(img->data, bytes);
+  }
+  img->data = NULL;
+}
@@ -0,0 +1,85 @@
+#ifndef IMGSHM_H
+#define IMGSHM_H
+
+#include "image.h"
+
+// Images in shared memory, for handing full-resolution pixel data
+// between processes without copying or re-encoding it.
+//
+// An image allocated with img_shm_init lives in an anonymous memory
+// file (memfd_create). Its file descriptor can be sent over a Unix
+// domain socket with img_shm_send (as SCM_RIGHTS ancillary data,
+// along with the image's dimensions); the receiver maps the same
+// pages with img_shm_recv. Both processes then see each other's
+// writes to the pixels, so e.g. a decoder can fill an image and pass
+// it to an encoder, or a client can pass an input image and an output
+// image to a server that transforms one into the other.
+//
+// Shared images must be freed with img_shm_cleanup, not img_cleanup.
+
+// Allocate an image in a new shared memory file.
+//
+// Parameters:
+//   img - pointer to Image struct to initialize
+//   width - image width; must be positive
+//   height - image height; must be positive
+//   fd - receives the memory file's descriptor (to pass to
+//        img_shm_send, and to close when no longer needed; the
+//        mapping stays valid after it's closed)
+//
+// Returns:
+//   IMG_SUCCESS if successful, IMG_ERR_INVALID_ARGUMENT if the
+//   dimensions are invalid, IMG_ERR_MALLOC_FAILED if the memory
+//   couldn't be allocated
+int img_shm_init(struct Image *img, int32_t width, int32_t height, int *fd);
+
+// Map the shared memory file of an image created by another process.
+//
+// Parameters:
+//   img - pointer to Image struct to initialize
+//   width - image width
+//   height - image height
+//   fd - descriptor of the memory file (not closed)
+//
+// Returns:
+//   IMG_SUCCESS if successful, IMG_ERR_INVALID_ARGUMENT if the
+//   dimensions are invalid or the file is too small for them,
+//   IMG_ERR_MALLOC_FAILED if it couldn't be mapped
+int img_shm_map(struct Image *img, int32_t width, int32_t height, int fd);
+
+// Send a shared image's memory file and dimensions over a Unix domain
+// socket.
+//
+// Parameters:
+//   sock - connected Unix domain socket
+//   img - pointer to the Image (for its dimensions)
+//   fd - descriptor of the image's memory file
+//
+// Returns:
+//   IMG_SUCCESS if successful, IMG_ERR_COULD_NOT_WRITE otherwise
+int img_shm_send(int sock, const struct Image *img, int fd);
+
+// Receive a shared image sent with img_shm_send and map it.
+//
+// Parameters:
+//   sock - connected Unix domain socket
+//   img - pointer to Image struct to initialize
+//   fd - receives the descriptor of the image's memory file (to close
+//        when no longer needed, or pass on), or NULL to close it at
+//        once
+//
+// Returns:
+//   IMG_SUCCESS if an image was received, IMG_END_OF_STREAM if the
+//   other end closed the socket, IMG_ERR_TRUNCATED if the message
+//   couldn't be received, was incomplete or had no file descriptor,
+//   otherwise one of the img_shm_map errors
+int img_shm_recv(int sock, struct Image *img, int *fd);
+
+// Unmap a shared image (the memory is freed once no process maps it
+// and no descriptor refers to it).
+//
+// Parameters:
+//   img - pointer to the Image
+void img_shm_cleanup(struct Image *img);
+
+#endif
@@ -0,0 +1,101 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "imgproc.h"
+#include "imgparallel.h"
+#include "imgstats.h"
+
+// One band of rows histogrammed by a single thread
+struct StatsBand {
+  struct Image img;        // view of the band's rows
+  uint32_t hist[4 * 256];
+};
+
+// ImgItemFn histogramming a band of an array of bands
+static void stats_band(void *arg, int t) {
+  struct StatsBand *band = (struct StatsBand *) arg + t;
+  imgproc_histogram(&band->img, band->hist);
+}
+
+int img_stats(struct Image *img, int num_threads, struct ImageStats *stats) {
+  if (num_threads > img->height) {
+    num_threads = img->height;
+  }
+  if (num_threads < 1) {
+    num_threads = 1;
+  }
+
+  struct StatsBand *bands = calloc(num_threads, sizeof(struct StatsBand));
+  if (bands == NULL) {
+    return IMG_ERR_MALLOC_FAILED;
+  }
+
+  // split the rows as evenly as possible
+  int32_t row = 0;
+  for (int t = 0; t < num_threads; t++) {
+    int32_t rows = img->height / num_threads + (t < img->height % num_threads);
+    bands[t].img.width = img->width;
+    bands[t].img.height = rows;
+    bands[t].img.data = img->data + (size_t) row * img->width;
+    row += rows;
+  }
+
+  img_parallel_for(num_threads, num_threads, stats_band, bands);
+
+  // reduce the band histograms
+  memset(stats, 0, sizeof(*stats));
+  stats->count = (uint64_t) img->width * img->height;
+  for (int t = 0; t < num_threads; t++) {
+    for (int c = 0; c < 4; c++) {
+      for (int v = 0; v < 256; v++) {
+        stats->hist[c][v] += bands[t].hist[c * 256 + v];
+      }
+    }
+  }
+  free(bands);
+
+  // derive the remaining statistics from the histograms
+  for (int c = 0; c < 4; c++) {
+    uint64_t sum = 0, sum_sq = 0;
+    int first = -1, last = -1;
+    for (int v = 0; v < 256; v++) {
+      uint64_t n = stats->hist[c][v];
+      if (n != 0) {
+        if (first < 0) {
+          first = v;
+        }
+        last = v;
+      }
+      sum += n * v;
+      sum_sq += n * v * v;
+    }
+
+    if (stats->count > 0) {
+      double mean = (double) sum / stats->count;
+      double variance = (double) sum_sq / stats->count - mean * mean;
+      stats->min[c] = first;
+      stats->max[c] = last;
+      stats->mean[c] = mean;
+      stats->stddev[c] = variance > 0.0 ? sqrt(variance) : 0.0;
+    }
+  }
+
+  return IMG_SUCCESS;
+}
+
+void img_stats_write_json(FILE *out, const struct ImageStats *stats) {
+  static const char *channel_names[4] = { "red", "green", "blue", "alpha" };
+
+  fprintf(out, "{\n  \"pixels\": %llu", (unsigned long long) stats->count);
+  for (int c = 0; c < 4; c++) {
+    fprintf(out, ",\n  \"%s\": {\n", channel_names[c]);
+    fprintf(out, "    \"min\": %u,\n    \"max\": %u,\n", stats->min[c], stats->max[c]);
+    fprintf(out, "    \"mean\": %.4f,\n    \"stddev\": %.4f,\n", stats->mean[c], stats->stddev[c]);
+    fprintf(out, "    \"histogram\": [");
+    for (int v = 0; v < 256; v++) {
+      fprintf(out, v == 0 ? "%u" : ", %u", stats->hist[c][v]);
+    }
+    fprintf(out, "]\n  }");
+  }
+  fprintf(out, "\n}\n");
+}
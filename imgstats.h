@@ -0,0 +1,44 @@
+#ifndef IMGSTATS_H
+#define IMGSTATS_H
+
+#include <stdio.h>
+#include "image.h"
+
+// Per-channel statistics of an image. Channel index 0 is red,
+// 1 is green, 2 is blue, and 3 is alpha.
+struct ImageStats {
+  uint64_t count;          // number of pixels
+  uint32_t hist[4][256];   // hist[c][v] = number of pixels with value v in channel c
+  uint32_t min[4];
+  uint32_t max[4];
+  double mean[4];
+  double stddev[4];        // population standard deviation
+};
+
+// Compute the histograms, minimum, maximum, mean and standard
+// deviation of every channel of an image. The image's rows are split
+// into bands that are histogrammed (by imgproc_histogram) on separate
+// threads; the band histograms are then summed and the remaining
+// statistics are derived from the totals, so every pixel is read
+// exactly once.
+//
+// Parameters:
+//   img - pointer to the Image to analyze
+//   num_threads - number of threads to use (values below 1 are
+//                 treated as 1, and no more threads than the image
+//                 has rows are used)
+//   stats - pointer to the ImageStats to fill in
+//
+// Returns:
+//   IMG_SUCCESS if successful, otherwise one of the
+//   IMG_ERR_* values
+int img_stats(struct Image *img, int num_threads, struct ImageStats *stats);
+
+// Write statistics as a JSON object with one member per channel.
+//
+// Parameters:
+//   out - stream to write to
+//   stats - pointer to the statistics to write
+void img_stats_write_json(FILE *out, const struct ImageStats *stats);
+
+#endif
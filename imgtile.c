@@ -0,0 +1,234 @@
+#include <stdlib.h>
+#include <string.h>
+#include "imgtile.h"
+
+// Number of pixels in a tile
+#define TILE_PIXELS (IMG_TILE_SIZE * IMG_TILE_SIZE)
+
+int img_tiled_init(struct TiledImage *img, int32_t width, int32_t height) {
+  int32_t tiles_x = (width + IMG_TILE_SIZE - 1) / IMG_TILE_SIZE;
+  int32_t tiles_y = (height + IMG_TILE_SIZE - 1) / IMG_TILE_SIZE;
+  size_t num_pixels = (size_t) tiles_x * tiles_y * TILE_PIXELS;
+
+  uint32_t *pixel_data = malloc((num_pixels > 0 ? num_pixels : 1) * sizeof(uint32_t));
+  if (pixel_data == NULL) {
+    return IMG_ERR_MALLOC_FAILED;
+  }
+  for (size_t i = 0; i < num_pixels; i++) {
+    pixel_data[i] = 0x000000FFU;
+  }
+
+  img->width = width;
+  img->height = height;
+  img->tiles_x = tiles_x;
+  img->tiles_y = tiles_y;
+  img->data = pixel_data;
+  return IMG_SUCCESS;
+}
+
+int img_to_tiled(const struct Image *src, struct TiledImage *dst) {
+  int rc = img_tiled_init(dst, src->width, src->height);
+  if (rc != IMG_SUCCESS) {
+    return rc;
+  }
+
+  // copy each tile row by row: a run of up to IMG_TILE_SIZE
+  // consecutive pixels on both sides
+  for (int32_t i = 0; i < src->height; i++) {
+    for (int32_t tj = 0; tj < src->width; tj += IMG_TILE_SIZE) {
+      int32_t n = src->width - tj < IMG_TILE_SIZE ? src->width - tj : IMG_TILE_SIZE;
+      memcpy(img_tiled_pixel(dst, i, tj), &src->data[(size_t) i * src->width + tj], n * sizeof(uint32_t));
+    }
+  }
+  return IMG_SUCCESS;
+}
+
+void img_from_tiled(const struct TiledImage *src, struct Image *dst) {
+  for (int32_t i = 0; i < src->height; i++) {
+    for (int32_t tj = 0; tj < src->width; tj += IMG_TILE_SIZE) {
+      int32_t n = src->width - tj < IMG_TILE_SIZE ? src->width - tj : IMG_TILE_SIZE;
+      memcpy(&dst->data[(size_t) i * dst->width + tj], img_tiled_pixel(src, i, tj), n * sizeof(uint32_t));
+    }
+  }
+}
+
+int img_tiled_rotate(const struct TiledImage *src, struct TiledImage *dst, int32_t degrees) {
+  if (degrees != 90 && degrees != 180 && degrees != 270) {
+    return IMG_ERR_INVALID_ARGUMENT;
+  }
+
+  int32_t rows = src->height;
+  int32_t cols = src->width;
+  for (int32_t ti = 0; ti < dst->height; ti += IMG_TILE_SIZE) {
+    int32_t i_end = ti + IMG_TILE_SIZE < dst->height ? ti + IMG_TILE_SIZE : dst->height;
+    for (int32_t tj = 0; tj < dst->width; tj += IMG_TILE_SIZE) {
+      int32_t j_end = tj + IMG_TILE_SIZE < dst->width ? tj + IMG_TILE_SIZE : dst->width;
+
+      // output pixel (i, j) comes from input pixel (src_row, src_col);
+      // as j increases, the input pixel moves up a column (90), left
+      // along a row (180), or down a column (270) with a fixed step
+      // until it crosses into the next input tile
+      for (int32_t i = ti; i < i_end; i++) {
+        uint32_t *out = img_tiled_pixel(dst, i, tj);
+        for (int32_t j = tj; j < j_end; ) {
+          int32_t src_row, src_col, n, step;
+          if (degrees == 90) {
+            src_row = rows - 1 - j;
+            src_col = i;
+            n = src_row % IMG_TILE_SIZE + 1;
+            step = -IMG_TILE_SIZE;
+          } else if (degrees == 180) {
+            src_row = rows - 1 - i;
+            src_col = cols - 1 - j;
+            n = src_col % IMG_TILE_SIZE + 1;
+            step = -1;
+          } else {
+            src_row = j;
+            src_col = cols - 1 - i;
+            n = IMG_TILE_SIZE - src_row % IMG_TILE_SIZE;
+            step = IMG_TILE_SIZE;
+          }
+          if (n > j_end - j) {
+            n = j_end - j;
+          }
+          const uint32_t *in = img_tiled_pixel(src, src_row, src_col);
+          for (int32_t k = 0; k < n; k++) {
+            out[j - tj + k] = *in;
+            in += step;
+          }
+          j += n;
+        }
+      }
+    }
+  }
+  return IMG_SUCCESS;
+}
+
+void img_tiled_squash(const struct TiledImage *src, struct TiledImage *dst, int32_t xfac, int32_t yfac) {
+  for (int32_t ti = 0; ti < dst->height; ti += IMG_TILE_SIZE) {
+    int32_t i_end = ti + IMG_TILE_SIZE < dst->height ? ti + IMG_TILE_SIZE : dst->height;
+    for (int32_t tj = 0; tj < dst->width; tj += IMG_TILE_SIZE) {
+      int32_t j_end = tj + IMG_TILE_SIZE < dst->width ? tj + IMG_TILE_SIZE : dst->width;
+
+      for (int32_t i = ti; i < i_end; i++) {
+        uint32_t *out = img_tiled_pixel(dst, i, tj);
+        for (int32_t j = tj; j < j_end; j++) {
+          out[j - tj] = *img_tiled_pixel(src, i * yfac, j * xfac);
+        }
+      }
+    }
+  }
+}
+
+// Adds sign times the red, green, and blue values of the pixels in
+// columns col_begin .. col_end - 1 of a row to the per-column sums
+// (3 per column, starting with column col_begin)
+static void add_row_to_column_sums(const struct TiledImage *img, int32_t row, int32_t col_begin,
+                                   int32_t col_end, int32_t sign, int32_t *sums) {
+  for (int32_t tj = col_begin; tj < col_end; ) {
+    // the pixels up to the end of the tile are consecutive
+    int32_t n = IMG_TILE_SIZE - tj % IMG_TILE_SIZE;
+    if (n > col_end - tj) {
+      n = col_end - tj;
+    }
+    const uint32_t *p = img_tiled_pixel(img, row, tj);
+    int32_t *s = &sums[3 * (tj - col_begin)];
+    for (int32_t k = 0; k < n; k++) {
+      s[3 * k] += sign * (int32_t) (p[k] >> 24);
+      s[3 * k + 1] += sign * (int32_t) ((p[k] >> 16) & 0xFF);
+      s[3 * k + 2] += sign * (int32_t) ((p[k] >> 8) & 0xFF);
+    }
+    tj += n;
+  }
+}
+
+int img_tiled_blur(const struct TiledImage *src, struct TiledImage *dst, int32_t blur_dist) {
+  int32_t rows = src->height;
+  int32_t cols = src->width;
+  int32_t d = blur_dist;
+
+  // red, green, and blue sums of the window rows for each column of
+  // the window columns of a column of tiles
+  int32_t *col_sums = malloc(3 * ((size_t) IMG_TILE_SIZE + 2 * (size_t) d) * sizeof(int32_t));
+  if (col_sums == NULL) {
+    return IMG_ERR_MALLOC_FAILED;
+  }
+
+  // the tiles are visited a column of tiles at a time, top to bottom,
+  // so the column sums carry over from one tile to the next
+  for (int32_t tj = 0; tj < cols; tj += IMG_TILE_SIZE) {
+    int32_t j_end = tj + IMG_TILE_SIZE < cols ? tj + IMG_TILE_SIZE : cols;
+
+    // columns that are in the window of some pixel of the tile column
+    int32_t wc_begin = tj - d > 0 ? tj - d : 0;
+    int32_t wc_end = j_end + d < cols ? j_end + d : cols;
+    memset(col_sums, 0, 3 * (size_t) (wc_end - wc_begin) * sizeof(int32_t));
+
+    // window rows of the first row of the image
+    int32_t top = 0;
+    int32_t bottom = d < rows - 1 ? d : rows - 1;
+    for (int32_t r = top; r <= bottom; r++) {
+      add_row_to_column_sums(src, r, wc_begin, wc_end, 1, col_sums);
+    }
+
+    for (int32_t ti = 0; ti < rows; ti += IMG_TILE_SIZE) {
+      int32_t i_end = ti + IMG_TILE_SIZE < rows ? ti + IMG_TILE_SIZE : rows;
+      for (int32_t i = ti; i < i_end; i++) {
+        if (i > 0) {
+          // slide the window rows down by one
+          if (i + d < rows) {
+            add_row_to_column_sums(src, i + d, wc_begin, wc_end, 1, col_sums);
+            bottom = i + d;
+          }
+          if (i - d - 1 >= 0) {
+            add_row_to_column_sums(src, i - d - 1, wc_begin, wc_end, -1, col_sums);
+            top = i - d;
+          }
+        }
+        int32_t num_rows = bottom - top + 1;
+
+        // window columns of the first pixel of the row
+        int32_t left = tj - d > 0 ? tj - d : 0;
+        int32_t right = tj + d < cols - 1 ? tj + d : cols - 1;
+        int32_t red = 0, green = 0, blue = 0;
+        for (int32_t c = left; c <= right; c++) {
+          red += col_sums[3 * (c - wc_begin)];
+          green += col_sums[3 * (c - wc_begin) + 1];
+          blue += col_sums[3 * (c - wc_begin) + 2];
+        }
+
+        const uint32_t *in = img_tiled_pixel(src, i, tj);
+        uint32_t *out = img_tiled_pixel(dst, i, tj);
+        for (int32_t j = tj; j < j_end; j++) {
+          if (j > tj) {
+            // slide the window columns right by one
+            if (j + d < cols) {
+              int32_t c = j + d - wc_begin;
+              red += col_sums[3 * c];
+              green += col_sums[3 * c + 1];
+              blue += col_sums[3 * c + 2];
+              right = j + d;
+            }
+            if (j - d - 1 >= 0) {
+              int32_t c = j - d - 1 - wc_begin;
+              red -= col_sums[3 * c];
+              green -= col_sums[3 * c + 1];
+              blue -= col_sums[3 * c + 2];
+              left = j - d;
+            }
+          }
+          int32_t total = num_rows * (right - left + 1);
+          out[j - tj] = ((uint32_t) (red / total) << 24) | ((uint32_t) (green / total) << 16)
+            | ((uint32_t) (blue / total) << 8) | (in[j - tj] & 0xFF);
+        }
+      }
+    }
+  }
+
+  free(col_sums);
+  return IMG_SUCCESS;
+}
+
+void img_tiled_cleanup(struct TiledImage *img) {
+  free(img->data);
+}
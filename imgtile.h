@@ -0,0 +1,115 @@
+#ifndef IMGTILE_H
+#define IMGTILE_H
+
+#include "image.h"
+
+// Width and height (in pixels) of the tiles of a TiledImage
+#define IMG_TILE_SIZE  64
+
+// An image stored as IMG_TILE_SIZE x IMG_TILE_SIZE tiles: the tiles are
+// stored one after the other in row-major order, and the pixels of each
+// tile are stored in row-major order. Tiles at the right and bottom edges
+// are padded to the full tile size. Every pixel of a tile is within 16KB
+// of every other one, so kernels that walk columns (or visit pixels in
+// any 2D pattern) touch far fewer cache lines and pages than they do on
+// a row-major Image.
+struct TiledImage {
+  int32_t width;
+  int32_t height;
+  int32_t tiles_x;    // number of tile columns
+  int32_t tiles_y;    // number of tile rows
+  uint32_t *data;
+};
+
+// Returns a pointer to the pixel at (row, col) of a TiledImage.
+static inline uint32_t *img_tiled_pixel(const struct TiledImage *img, int32_t row, int32_t col) {
+  size_t tile = (size_t) (row / IMG_TILE_SIZE) * img->tiles_x + col / IMG_TILE_SIZE;
+  return &img->data[tile * IMG_TILE_SIZE * IMG_TILE_SIZE
+                    + (row % IMG_TILE_SIZE) * IMG_TILE_SIZE + col % IMG_TILE_SIZE];
+}
+
+// Initialize a TiledImage of the specified dimensions, with every
+// pixel (including the padding) opaque black.
+//
+// Parameters:
+//   img - pointer to TiledImage instance to initialize
+//   width - image width (number of pixel columns)
+//   height - image height (number of pixel rows)
+//
+// Returns:
+//   IMG_SUCCESS if successful, otherwise one of the
+//   IMG_ERR_* values
+int img_tiled_init(struct TiledImage *img, int32_t width, int32_t height);
+
+// Convert a row-major Image to a newly initialized TiledImage.
+//
+// Parameters:
+//   src - pointer to the Image to convert
+//   dst - pointer to the TiledImage to initialize with the pixels of src
+//
+// Returns:
+//   IMG_SUCCESS if successful, otherwise one of the
+//   IMG_ERR_* values
+int img_to_tiled(const struct Image *src, struct TiledImage *dst);
+
+// Convert a TiledImage back to row-major order.
+//
+// Parameters:
+//   src - pointer to the TiledImage to convert
+//   dst - pointer to an Image with the same dimensions as src (e.g.
+//         set up by img_init) to store the pixels in
+void img_from_tiled(const struct TiledImage *src, struct Image *dst);
+
+// Rotate a TiledImage clockwise, tile by tile: each output tile is
+// gathered from the (at most four) input tiles it comes from. The
+// result is the same as that of imgproc_rotate.
+//
+// Parameters:
+//   src - pointer to the TiledImage to rotate
+//   dst - pointer to a TiledImage with the rotated dimensions
+//   degrees - clockwise rotation: 90, 180 or 270
+//
+// Returns:
+//   IMG_SUCCESS if successful, IMG_ERR_INVALID_ARGUMENT if degrees
+//   is not one of the allowed values
+int img_tiled_rotate(const struct TiledImage *src, struct TiledImage *dst, int32_t degrees);
+
+// Shrink a TiledImage by keeping every xfac'th pixel of every yfac'th
+// row, tile by tile. The result is the same as that of imgproc_squash.
+//
+// Parameters:
+//   src - pointer to the TiledImage to shrink
+//   dst - pointer to a TiledImage that is src->width / xfac pixels
+//         wide and src->height / yfac pixels tall
+//   xfac - factor to downsize the image horizontally; must be positive
+//   yfac - factor to downsize the image vertically; must be positive
+void img_tiled_squash(const struct TiledImage *src, struct TiledImage *dst, int32_t xfac, int32_t yfac);
+
+// Blur a TiledImage, tile by tile. The result is the same as that of
+// imgproc_blur, but the window sums are updated incrementally: column
+// sums slide down each column of tiles (carrying over from one tile
+// to the next), and row sums slide along the rows of a tile. Each
+// column sum also covers the blur_dist columns on either side of the
+// tile, and each row of a tile starts a new row sum over 2 * blur_dist
+// + 1 columns, so the work per pixel is proportional to about
+// 1 + blur_dist / 32 (rather than to blur_dist squared, as in
+// imgproc_blur).
+//
+// Parameters:
+//   src - pointer to the TiledImage to blur
+//   dst - pointer to a TiledImage with the same dimensions as src
+//   blur_dist - all pixels within this many pixels horizontally and
+//               vertically are averaged; must not be negative
+//
+// Returns:
+//   IMG_SUCCESS if successful, otherwise one of the
+//   IMG_ERR_* values
+int img_tiled_blur(const struct TiledImage *src, struct TiledImage *dst, int32_t blur_dist);
+
+// De-allocate the pixels of a TiledImage (but not the struct itself).
+//
+// Parameters:
+//   img - pointer to TiledImage object to clean up
+void img_tiled_cleanup(struct TiledImage *img);
+
+#endif
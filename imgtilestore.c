@@ -0,0 +1,490 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "imgtilestore.h"
+
+// Number of pixels in a tile
+#define TILE_PIXELS (IMG_TILE_SIZE * IMG_TILE_SIZE)
+
+// Size of an uncompressed tile in bytes
+#define TILE_BYTES (TILE_PIXELS * sizeof(uint32_t))
+
+// Longest literal or run encoded by one header byte: headers below
+// 128 are followed by (header + 1) literal differences, headers from
+// 128 up are followed by one difference repeated (header - 127) times
+#define MAX_RUN 128
+
+// The high bit of every byte of a pixel
+#define HIGH_BITS 0x80808080U
+
+// Returns the time in seconds since an arbitrary starting point.
+static double seconds_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Byte-wise a - b (each of the four bytes wraps around on its own).
+static uint32_t byte_sub(uint32_t a, uint32_t b) {
+  return ((a | HIGH_BITS) - (b & ~HIGH_BITS)) ^ ((a ^ ~b) & HIGH_BITS);
+}
+
+// Byte-wise a + b (each of the four bytes wraps around on its own).
+static uint32_t byte_add(uint32_t a, uint32_t b) {
+  return ((a & ~HIGH_BITS) + (b & ~HIGH_BITS)) ^ ((a ^ b) & HIGH_BITS);
+}
+
+// Encode the differences between consecutive pixels of a tile.
+// Returns the number of bytes written to out (which must have room
+// for TILE_BYTES bytes), or TILE_BYTES if the encoding wouldn't be
+// smaller than the tile itself.
+static uint32_t encode_tile(const uint32_t *pixels, uint8_t *out) {
+  uint32_t diffs[TILE_PIXELS];
+  uint32_t prev = 0;
+  for (int i = 0; i < TILE_PIXELS; i++) {
+    diffs[i] = byte_sub(pixels[i], prev);
+    prev = pixels[i];
+  }
+
+  uint32_t pos = 0;
+  int i = 0;
+  while (i < TILE_PIXELS) {
+    int run = 1;
+    while (i + run < TILE_PIXELS && run < MAX_RUN && diffs[i + run] == diffs[i]) {
+      run++;
+    }
+    if (run >= 2) {
+      if (pos + 1 + sizeof(uint32_t) >= TILE_BYTES) {
+        return TILE_BYTES;
+      }
+      out[pos++] = (uint8_t) (127 + run);
+      memcpy(&out[pos], &diffs[i], sizeof(uint32_t));
+      pos += sizeof(uint32_t);
+      i += run;
+    } else {
+      // literals continue up to the next pair of equal differences
+      int n = 1;
+      while (i + n < TILE_PIXELS && n < MAX_RUN
+             && !(i + n + 1 < TILE_PIXELS && diffs[i + n + 1] == diffs[i + n])) {
+        n++;
+      }
+      if (pos + 1 + n * sizeof(uint32_t) >= TILE_BYTES) {
+        return TILE_BYTES;
+      }
+      out[pos++] = (uint8_t) (n - 1);
+      memcpy(&out[pos], &diffs[i], n * sizeof(uint32_t));
+      pos += n * sizeof(uint32_t);
+      i += n;
+    }
+  }
+  return pos;
+}
+
+// Decode a tile encoded by encode_tile.
+static void decode_tile(const uint8_t *in, uint32_t size, uint32_t *pixels) {
+  if (size == TILE_BYTES) {
+    memcpy(pixels, in, TILE_BYTES);
+    return;
+  }
+
+  uint32_t prev = 0;
+  uint32_t pos = 0;
+  int i = 0;
+  while (pos < size) {
+    uint8_t header = in[pos++];
+    if (header >= MAX_RUN) {
+      uint32_t diff;
+      memcpy(&diff, &in[pos], sizeof(uint32_t));
+      pos += sizeof(uint32_t);
+      for (int n = header - 127; n > 0; n--) {
+        prev = byte_add(prev, diff);
+        pixels[i++] = prev;
+      }
+    } else {
+      for (int n = header + 1; n > 0; n--) {
+        uint32_t diff;
+        memcpy(&diff, &in[pos], sizeof(uint32_t));
+        pos += sizeof(uint32_t);
+        prev = byte_add(prev, diff);
+        pixels[i++] = prev;
+      }
+    }
+  }
+}
+
+// Replace the compressed data of a tile with the compression of the
+// given pixels.
+// Returns IMG_SUCCESS, or IMG_ERR_MALLOC_FAILED.
+static int compress_tile(struct TileStore *store, int32_t tile, const uint32_t *pixels) {
+  double start = seconds_now();
+  uint8_t encoded[TILE_BYTES];
+  uint32_t size = encode_tile(pixels, encoded);
+
+  uint8_t *data = malloc(size);
+  if (data == NULL) {
+    return IMG_ERR_MALLOC_FAILED;
+  }
+  memcpy(data, size == TILE_BYTES ? (const uint8_t *) pixels : encoded, size);
+
+  free(store->tiles[tile]);
+  store->stats.compressed_bytes += size;
+  store->stats.compressed_bytes -= store->tile_sizes[tile];
+  store->tiles[tile] = data;
+  store->tile_sizes[tile] = size;
+  store->stats.compressions++;
+  store->stats.compress_seconds += seconds_now() - start;
+  return IMG_SUCCESS;
+}
+
+// Write a tile to its place in the spill file.
+// Returns IMG_SUCCESS, or IMG_ERR_COULD_NOT_WRITE.
+static int spill_tile(struct TileStore *store, int32_t tile, const uint32_t *pixels) {
+  double start = seconds_now();
+  if (pwrite(store->spill_fd, pixels, TILE_BYTES, (off_t) tile * TILE_BYTES) != (ssize_t) TILE_BYTES) {
+    return IMG_ERR_COULD_NOT_WRITE;
+  }
+  if (store->tile_sizes[tile] == 0) {
+    store->tile_sizes[tile] = TILE_BYTES;
+    store->stats.compressed_bytes += TILE_BYTES;
+  }
+  store->stats.spill_writes++;
+  store->stats.compress_seconds += seconds_now() - start;
+  return IMG_SUCCESS;
+}
+
+// Save the pixels of a tile: compress it, or write it to the spill
+// file of a spill-backed store.
+// Returns IMG_SUCCESS, or one of the IMG_ERR_* values.
+static int save_tile(struct TileStore *store, int32_t tile, const uint32_t *pixels) {
+  return store->spill_fd >= 0 ? spill_tile(store, tile, pixels) : compress_tile(store, tile, pixels);
+}
+
+// Load the pixels of a tile: decompress it, or read it from the spill
+// file of a spill-backed store.
+// Returns IMG_SUCCESS, or IMG_ERR_TRUNCATED if the spill file couldn't
+// be read.
+static int load_tile(struct TileStore *store, int32_t tile, uint32_t *pixels) {
+  double start = seconds_now();
+  if (store->spill_fd < 0) {
+    decode_tile(store->tiles[tile], store->tile_sizes[tile], pixels);
+    store->stats.decompressions++;
+  } else if (store->tile_sizes[tile] == 0) {
+    for (int i = 0; i < TILE_PIXELS; i++) {
+      pixels[i] = 0x000000FFU;
+    }
+  } else {
+    if (pread(store->spill_fd, pixels, TILE_BYTES, (off_t) tile * TILE_BYTES) != (ssize_t) TILE_BYTES) {
+      return IMG_ERR_TRUNCATED;
+    }
+    store->stats.spill_reads++;
+
+    // ask for the next tile of the traversal in the background
+    int64_t next = (int64_t) tile + store->readahead;
+    if (next >= 0 && next < (int64_t) store->tiles_x * store->tiles_y && store->tile_sizes[next] != 0) {
+      posix_fadvise(store->spill_fd, (off_t) next * TILE_BYTES, TILE_BYTES, POSIX_FADV_WILLNEED);
+    }
+  }
+  store->stats.decompress_seconds += seconds_now() - start;
+  return IMG_SUCCESS;
+}
+
+// Allocate the tile table and the cache of a TileStore; the tiles
+// themselves are left empty.
+// Returns IMG_SUCCESS, or IMG_ERR_MALLOC_FAILED.
+static int alloc_store(struct TileStore *store, int32_t width, int32_t height, int32_t cache_size) {
+  if (cache_size < IMG_TILESTORE_MIN_CACHE) {
+    cache_size = IMG_TILESTORE_MIN_CACHE;
+  }
+  store->width = width;
+  store->height = height;
+  store->tiles_x = (width + IMG_TILE_SIZE - 1) / IMG_TILE_SIZE;
+  store->tiles_y = (height + IMG_TILE_SIZE - 1) / IMG_TILE_SIZE;
+  size_t num_tiles = (size_t) store->tiles_x * store->tiles_y;
+
+  store->tiles = calloc(num_tiles > 0 ? num_tiles : 1, sizeof(uint8_t *));
+  store->tile_sizes = calloc(num_tiles > 0 ? num_tiles : 1, sizeof(uint32_t));
+  store->cache = calloc(cache_size, sizeof(struct TileSlot));
+  store->cache_size = cache_size;
+  store->clock = 0;
+  store->spill_fd = -1;
+  store->readahead = 1;
+  store->error = IMG_SUCCESS;
+  memset(&store->stats, 0, sizeof(store->stats));
+  store->stats.raw_bytes = num_tiles * TILE_BYTES;
+  if (store->tiles == NULL || store->tile_sizes == NULL || store->cache == NULL) {
+    img_tilestore_cleanup(store);
+    return IMG_ERR_MALLOC_FAILED;
+  }
+
+  for (int32_t k = 0; k < cache_size; k++) {
+    store->cache[k].tile = -1;
+    store->cache[k].pixels = malloc(TILE_BYTES);
+    if (store->cache[k].pixels == NULL) {
+      img_tilestore_cleanup(store);
+      return IMG_ERR_MALLOC_FAILED;
+    }
+  }
+  return IMG_SUCCESS;
+}
+
+int img_tilestore_init(struct TileStore *store, int32_t width, int32_t height, int32_t cache_size) {
+  int rc = alloc_store(store, width, height, cache_size);
+  if (rc != IMG_SUCCESS) {
+    return rc;
+  }
+
+  uint32_t *blank = store->cache[0].pixels;
+  for (int i = 0; i < TILE_PIXELS; i++) {
+    blank[i] = 0x000000FFU;
+  }
+  int32_t num_tiles = store->tiles_x * store->tiles_y;
+  for (int32_t t = 0; t < num_tiles; t++) {
+    rc = compress_tile(store, t, blank);
+    if (rc != IMG_SUCCESS) {
+      img_tilestore_cleanup(store);
+      return rc;
+    }
+  }
+  return IMG_SUCCESS;
+}
+
+int img_tilestore_init_spill(struct TileStore *store, int32_t width, int32_t height, int32_t cache_size,
+                             const char *spill_dir) {
+  int rc = alloc_store(store, width, height, cache_size);
+  if (rc != IMG_SUCCESS) {
+    return rc;
+  }
+
+  char path[4096];
+  snprintf(path, sizeof(path), "%s/imgtile-XXXXXX", spill_dir);
+  store->spill_fd = mkstemp(path);
+  if (store->spill_fd < 0) {
+    img_tilestore_cleanup(store);
+    return IMG_ERR_COULD_NOT_OPEN;
+  }
+  unlink(path);
+
+  // no tile has been written yet
+  store->stats.compressed_bytes = 0;
+  return IMG_SUCCESS;
+}
+
+int img_tilestore_from_tiled(const struct TiledImage *src, struct TileStore *store, int32_t cache_size) {
+  int rc = alloc_store(store, src->width, src->height, cache_size);
+  if (rc != IMG_SUCCESS) {
+    return rc;
+  }
+
+  int32_t num_tiles = store->tiles_x * store->tiles_y;
+  for (int32_t t = 0; t < num_tiles; t++) {
+    rc = compress_tile(store, t, &src->data[(size_t) t * TILE_PIXELS]);
+    if (rc != IMG_SUCCESS) {
+      img_tilestore_cleanup(store);
+      return rc;
+    }
+  }
+  return IMG_SUCCESS;
+}
+
+int img_tilestore_to_tiled(struct TileStore *store, struct TiledImage *dst) {
+  for (int32_t tr = 0; tr < store->tiles_y; tr++) {
+    for (int32_t tc = 0; tc < store->tiles_x; tc++) {
+      const uint32_t *pixels = img_tilestore_tile(store, tr, tc, 0);
+      if (pixels == NULL) {
+        return store->error;
+      }
+      memcpy(&dst->data[((size_t) tr * dst->tiles_x + tc) * TILE_PIXELS], pixels, TILE_BYTES);
+    }
+  }
+  return IMG_SUCCESS;
+}
+
+uint32_t *img_tilestore_tile(struct TileStore *store, int32_t tile_row, int32_t tile_col, int write) {
+  int32_t tile = tile_row * store->tiles_x + tile_col;
+  store->clock++;
+
+  // find the tile in the cache, or else the least recently used slot
+  struct TileSlot *victim = &store->cache[0];
+  for (int32_t k = 0; k < store->cache_size; k++) {
+    struct TileSlot *slot = &store->cache[k];
+    if (slot->tile == tile) {
+      slot->last_used = store->clock;
+      slot->dirty |= write;
+      store->stats.hits++;
+      return slot->pixels;
+    }
+    if (slot->tile < 0 || (victim->tile >= 0 && slot->last_used < victim->last_used)) {
+      victim = slot;
+    }
+  }
+
+  if (victim->tile >= 0 && victim->dirty) {
+    int rc = save_tile(store, victim->tile, victim->pixels);
+    if (rc != IMG_SUCCESS) {
+      store->error = rc;
+      return NULL;
+    }
+    victim->dirty = 0;
+  }
+
+  int rc = load_tile(store, tile, victim->pixels);
+  if (rc != IMG_SUCCESS) {
+    victim->tile = -1;
+    store->error = rc;
+    return NULL;
+  }
+  victim->tile = tile;
+  victim->dirty = write;
+  victim->last_used = store->clock;
+  return victim->pixels;
+}
+
+int img_tilestore_flush(struct TileStore *store) {
+  for (int32_t k = 0; k < store->cache_size; k++) {
+    struct TileSlot *slot = &store->cache[k];
+    if (slot->tile >= 0 && slot->dirty) {
+      int rc = save_tile(store, slot->tile, slot->pixels);
+      if (rc != IMG_SUCCESS) {
+        return rc;
+      }
+      slot->dirty = 0;
+    }
+  }
+  return IMG_SUCCESS;
+}
+
+int img_tilestore_rotate(struct TileStore *src, struct TileStore *dst, int32_t degrees) {
+  if (degrees != 90 && degrees != 180 && degrees != 270) {
+    return IMG_ERR_INVALID_ARGUMENT;
+  }
+
+  // successive output tiles of a row come from successive input tiles
+  // up a column (90), left along a row (180), or down a column (270)
+  int32_t readahead = src->readahead;
+  src->readahead = degrees == 90 ? -src->tiles_x : (degrees == 180 ? -1 : src->tiles_x);
+  dst->readahead = 1;
+
+  int32_t rows = src->height;
+  int32_t cols = src->width;
+  int rc = IMG_SUCCESS;
+  for (int32_t ti = 0; rc == IMG_SUCCESS && ti < dst->height; ti += IMG_TILE_SIZE) {
+    int32_t i_end = ti + IMG_TILE_SIZE < dst->height ? ti + IMG_TILE_SIZE : dst->height;
+    for (int32_t tj = 0; rc == IMG_SUCCESS && tj < dst->width; tj += IMG_TILE_SIZE) {
+      int32_t j_end = tj + IMG_TILE_SIZE < dst->width ? tj + IMG_TILE_SIZE : dst->width;
+      uint32_t *out_tile = img_tilestore_tile(dst, ti / IMG_TILE_SIZE, tj / IMG_TILE_SIZE, 1);
+      if (out_tile == NULL) {
+        rc = dst->error;
+        break;
+      }
+
+      // same walk as img_tiled_rotate: each run of output pixels comes
+      // from one input tile, stepping by a fixed amount
+      for (int32_t i = ti; rc == IMG_SUCCESS && i < i_end; i++) {
+        uint32_t *out = &out_tile[(i - ti) * IMG_TILE_SIZE];
+        for (int32_t j = tj; j < j_end; ) {
+          int32_t src_row, src_col, n, step;
+          if (degrees == 90) {
+            src_row = rows - 1 - j;
+            src_col = i;
+            n = src_row % IMG_TILE_SIZE + 1;
+            step = -IMG_TILE_SIZE;
+          } else if (degrees == 180) {
+            src_row = rows - 1 - i;
+            src_col = cols - 1 - j;
+            n = src_col % IMG_TILE_SIZE + 1;
+            step = -1;
+          } else {
+            src_row = j;
+            src_col = cols - 1 - i;
+            n = IMG_TILE_SIZE - src_row % IMG_TILE_SIZE;
+            step = IMG_TILE_SIZE;
+          }
+          if (n > j_end - j) {
+            n = j_end - j;
+          }
+          const uint32_t *in = img_tilestore_tile(src, src_row / IMG_TILE_SIZE, src_col / IMG_TILE_SIZE, 0);
+          if (in == NULL) {
+            rc = src->error;
+            break;
+          }
+          in += (src_row % IMG_TILE_SIZE) * IMG_TILE_SIZE + src_col % IMG_TILE_SIZE;
+          for (int32_t k = 0; k < n; k++) {
+            out[j - tj + k] = *in;
+            in += step;
+          }
+          j += n;
+        }
+      }
+    }
+  }
+  src->readahead = readahead;
+  return rc == IMG_SUCCESS ? img_tilestore_flush(dst) : rc;
+}
+
+// Copy the pixels of a region of a TileStore to or from an Image.
+// Returns IMG_SUCCESS, or one of the IMG_ERR_* values.
+static int copy_region(struct TileStore *store, int32_t row, int32_t col, struct Image *img, int write) {
+  if (row < 0 || col < 0 || row + img->height > store->height || col + img->width > store->width) {
+    return IMG_ERR_INVALID_ARGUMENT;
+  }
+
+  // one tile at a time, so each tile is loaded once
+  for (int32_t ti = row - row % IMG_TILE_SIZE; ti < row + img->height; ti += IMG_TILE_SIZE) {
+    int32_t i_begin = ti > row ? ti : row;
+    int32_t i_end = ti + IMG_TILE_SIZE < row + img->height ? ti + IMG_TILE_SIZE : row + img->height;
+    for (int32_t tj = col - col % IMG_TILE_SIZE; tj < col + img->width; tj += IMG_TILE_SIZE) {
+      int32_t j_begin = tj > col ? tj : col;
+      int32_t j_end = tj + IMG_TILE_SIZE < col + img->width ? tj + IMG_TILE_SIZE : col + img->width;
+      uint32_t *tile = img_tilestore_tile(store, ti / IMG_TILE_SIZE, tj / IMG_TILE_SIZE, write);
+      if (tile == NULL) {
+        return store->error;
+      }
+
+      size_t bytes = (j_end - j_begin) * sizeof(uint32_t);
+      for (int32_t i = i_begin; i < i_end; i++) {
+        uint32_t *in_tile = &tile[(i - ti) * IMG_TILE_SIZE + (j_begin - tj)];
+        uint32_t *in_img = &img->data[(size_t) (i - row) * img->width + (j_begin - col)];
+        if (write) {
+          memcpy(in_tile, in_img, bytes);
+        } else {
+          memcpy(in_img, in_tile, bytes);
+        }
+      }
+    }
+  }
+  return IMG_SUCCESS;
+}
+
+int img_tilestore_read_region(struct TileStore *store, int32_t row, int32_t col, struct Image *dst) {
+  return copy_region(store, row, col, dst, 0);
+}
+
+int img_tilestore_write_region(struct TileStore *store, int32_t row, int32_t col, const struct Image *src) {
+  return copy_region(store, row, col, (struct Image *) src, 1);
+}
+
+void img_tilestore_cleanup(struct TileStore *store) {
+  if (store->tiles != NULL) {
+    for (int32_t t = 0; t < store->tiles_x * store->tiles_y; t++) {
+      free(store->tiles[t]);
+    }
+  }
+  if (store->cache != NULL) {
+    for (int32_t k = 0; k < store->cache_size; k++) {
+      free(store->cache[k].pixels);
+    }
+  }
+  if (store->spill_fd >= 0) {
+    close(store->spill_fd);
+    store->spill_fd = -1;
+  }
+  free(store->tiles);
+  free(store->tile_sizes);
+  free(store->cache);
+  store->tiles = NULL;
+  store->tile_sizes = NULL;
+  store->cache = NULL;
+}
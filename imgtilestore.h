@@ -0,0 +1,213 @@
+#ifndef IMGTILESTORE_H
+#define IMGTILESTORE_H
+
+#include "imgtile.h"
+
+// Smallest number of decompressed tiles a TileStore keeps: enough to
+// hold every input tile that a tile of a rotated image comes from
+#define IMG_TILESTORE_MIN_CACHE  4
+
+// A decompressed tile held in a TileStore's cache
+struct TileSlot {
+  int32_t tile;        // index of the tile, -1 if the slot is unused
+  int32_t dirty;       // nonzero if the pixels were written since decompression
+  uint64_t last_used;  // value of the store's clock at the last access
+  uint32_t *pixels;    // IMG_TILE_SIZE * IMG_TILE_SIZE pixels
+};
+
+// Counters describing how well a TileStore's tiles compress and
+// what accessing them costs.
+struct TileStoreStats {
+  uint64_t raw_bytes;          // size of the tiles if they were not compressed
+  uint64_t compressed_bytes;   // size of the compressed tiles
+  uint64_t compressions;       // number of tiles compressed
+  uint64_t decompressions;     // number of tiles decompressed
+  uint64_t hits;               // tile accesses served from the cache
+  uint64_t spill_reads;        // tiles read from the spill file
+  uint64_t spill_writes;       // tiles written to the spill file
+  double compress_seconds;     // time spent compressing tiles
+  double decompress_seconds;   // time spent decompressing tiles
+};
+
+// An image stored as compressed IMG_TILE_SIZE x IMG_TILE_SIZE tiles
+// (tiles are laid out like those of a TiledImage). Each tile is
+// compressed on its own: the pixels are replaced by their byte-wise
+// differences from the previous pixel of the tile, and runs of equal
+// differences are run-length encoded, so flat areas and smooth
+// gradients shrink to a few bytes. A tile that doesn't get smaller is
+// stored uncompressed. Tiles are decompressed when they are accessed
+// into a small cache of recently used tiles; a modified tile is
+// compressed again when it is evicted or the store is flushed.
+//
+// A spill-backed TileStore (see img_tilestore_init_spill) keeps its
+// tiles uncompressed in a temporary file instead, so only the cache
+// has to fit in memory: tiles are read from the file when they are
+// accessed and written back when they are evicted or flushed. A tile
+// that has never been written back is opaque black and takes no
+// space. On a miss, the tile readahead tiles further along is
+// requested from the operating system in the background, so kernels
+// that set readahead to the tile step of their traversal order find
+// the next tile already in the page cache.
+//
+// Rotation (img_tilestore_rotate) is the only operation that works
+// on a TileStore directly, one tile at a time. Every other imgproc_*
+// operation needs the whole image in memory: convert the store with
+// img_tilestore_to_tiled (and then img_from_tiled), or copy regions
+// out and back with img_tilestore_read_region and
+// img_tilestore_write_region, which is how a caller can band a
+// kernel through a spill-backed store.
+struct TileStore {
+  int32_t width;
+  int32_t height;
+  int32_t tiles_x;               // number of tile columns
+  int32_t tiles_y;               // number of tile rows
+  uint8_t **tiles;               // compressed tiles (NULL if spill-backed)
+  uint32_t *tile_sizes;          // sizes (in bytes) of the compressed tiles
+                                 // (of the tiles in the spill file)
+  int spill_fd;                  // spill file descriptor, -1 if in memory
+  int32_t readahead;             // tile index step of the traversal order
+  int32_t error;                 // IMG_ERR_* value of the last failed access
+  struct TileSlot *cache;
+  int32_t cache_size;            // number of slots in the cache
+  uint64_t clock;                // incremented on every access
+  struct TileStoreStats stats;
+};
+
+// Initialize a TileStore of the specified dimensions, with every
+// pixel opaque black.
+//
+// Parameters:
+//   store - pointer to TileStore instance to initialize
+//   width - image width (number of pixel columns)
+//   height - image height (number of pixel rows)
+//   cache_size - number of decompressed tiles to keep (values below
+//                IMG_TILESTORE_MIN_CACHE are raised to it)
+//
+// Returns:
+//   IMG_SUCCESS if successful, otherwise one of the
+//   IMG_ERR_* values
+int img_tilestore_init(struct TileStore *store, int32_t width, int32_t height, int32_t cache_size);
+
+// Initialize a spill-backed TileStore of the specified dimensions,
+// with every pixel opaque black. The spill file is created in (and
+// immediately unlinked from) the given directory, so it is removed
+// when the store is cleaned up or the program exits.
+//
+// Parameters:
+//   store - pointer to TileStore instance to initialize
+//   width - image width (number of pixel columns)
+//   height - image height (number of pixel rows)
+//   cache_size - number of tiles to keep in memory (values below
+//                IMG_TILESTORE_MIN_CACHE are raised to it)
+//   spill_dir - directory for the spill file (should be on a local disk)
+//
+// Returns:
+//   IMG_SUCCESS if successful, otherwise one of the
+//   IMG_ERR_* values
+int img_tilestore_init_spill(struct TileStore *store, int32_t width, int32_t height, int32_t cache_size,
+                             const char *spill_dir);
+
+// Initialize a TileStore holding the pixels of a TiledImage.
+//
+// Parameters:
+//   src - pointer to the TiledImage to compress
+//   store - pointer to TileStore instance to initialize
+//   cache_size - number of decompressed tiles to keep (values below
+//                IMG_TILESTORE_MIN_CACHE are raised to it)
+//
+// Returns:
+//   IMG_SUCCESS if successful, otherwise one of the
+//   IMG_ERR_* values
+int img_tilestore_from_tiled(const struct TiledImage *src, struct TileStore *store, int32_t cache_size);
+
+// Decompress all of the tiles of a TileStore into a TiledImage.
+//
+// Parameters:
+//   store - pointer to the TileStore to decompress
+//   dst - pointer to a TiledImage with the same dimensions as store
+//         (e.g. set up by img_tiled_init) to store the pixels in
+//
+// Returns:
+//   IMG_SUCCESS if successful, otherwise one of the
+//   IMG_ERR_* values
+int img_tilestore_to_tiled(struct TileStore *store, struct TiledImage *dst);
+
+// Get the decompressed pixels of a tile (IMG_TILE_SIZE rows of
+// IMG_TILE_SIZE pixels). The pointer stays valid until
+// IMG_TILESTORE_MIN_CACHE other tiles of the store have been accessed.
+//
+// Parameters:
+//   store - pointer to the TileStore
+//   tile_row - row of the tile (0 .. tiles_y - 1)
+//   tile_col - column of the tile (0 .. tiles_x - 1)
+//   write - nonzero if the caller will modify the pixels
+//
+// Returns:
+//   pointer to the pixels, or NULL if the tile couldn't be read or an
+//   evicted tile couldn't be written back (store->error tells why)
+uint32_t *img_tilestore_tile(struct TileStore *store, int32_t tile_row, int32_t tile_col, int write);
+
+// Copy a rectangular region of a TileStore to an Image, so that any
+// imgproc_* operation can be applied to part of an image that doesn't
+// fit in memory.
+//
+// Parameters:
+//   store - pointer to the TileStore
+//   row - row of the top left pixel of the region
+//   col - column of the top left pixel of the region
+//   dst - pointer to an Image as large as the region (which must lie
+//         within the store)
+//
+// Returns:
+//   IMG_SUCCESS if successful, otherwise one of the
+//   IMG_ERR_* values
+int img_tilestore_read_region(struct TileStore *store, int32_t row, int32_t col, struct Image *dst);
+
+// Copy an Image into a rectangular region of a TileStore.
+//
+// Parameters:
+//   store - pointer to the TileStore
+//   row - row of the top left pixel of the region
+//   col - column of the top left pixel of the region
+//   src - pointer to an Image as large as the region (which must lie
+//         within the store)
+//
+// Returns:
+//   IMG_SUCCESS if successful, otherwise one of the
+//   IMG_ERR_* values
+int img_tilestore_write_region(struct TileStore *store, int32_t row, int32_t col, const struct Image *src);
+
+// Compress every modified tile in the cache of a TileStore (or write
+// it to the spill file), so that the stored tiles (and the
+// statistics) are up to date.
+//
+// Parameters:
+//   store - pointer to the TileStore
+//
+// Returns:
+//   IMG_SUCCESS if successful, otherwise one of the
+//   IMG_ERR_* values
+int img_tilestore_flush(struct TileStore *store);
+
+// Rotate a TileStore clockwise, tile by tile, like img_tiled_rotate.
+// Only the tiles in use are decompressed at any time.
+//
+// Parameters:
+//   src - pointer to the TileStore to rotate
+//   dst - pointer to a TileStore with the rotated dimensions
+//   degrees - clockwise rotation: 90, 180 or 270
+//
+// Returns:
+//   IMG_SUCCESS if successful, IMG_ERR_INVALID_ARGUMENT if degrees
+//   is not one of the allowed values, otherwise one of the
+//   IMG_ERR_* values
+int img_tilestore_rotate(struct TileStore *src, struct TileStore *dst, int32_t degrees);
+
+// De-allocate the tiles and the cache of a TileStore (but not the
+// struct itself), and close its spill file.
+//
+// Parameters:
+//   store - pointer to TileStore object to clean up
+void img_tilestore_cleanup(struct TileStore *store);
+
+#endif
@@ -3,6 +3,7 @@
 */
 #define DO_CRC_CHECKS 1
 #define USE_ZLIB 1
+#define PNG_CANCEL_ROWS 64	/* rows compressed between polls of the cancel callback */
 
 #if USE_ZLIB
 #include <zlib.h>
@@ -184,7 +185,7 @@ static int png_read_ihdr(png_t* png)
 	png->filter_method = ihdr[15];
 	png->interlace_method = ihdr[16];
 
-	if(png->color_type == PNG_INDEXED)
+	if(png->color_type == PNG_INDEXED && png->depth != 8)
 		return PNG_NOT_SUPPORTED;
 
 	if(png->depth != 8 && png->depth != 16)
@@ -202,9 +203,11 @@ static int png_write_ihdr(png_t* png)
 	unsigned char *p = ihdr;
 	unsigned crc;
 
-	file_write(png, "\x89\x50\x4E\x47\x0D\x0A\x1A\x0A", 1, 8);
+	if(file_write(png, "\x89\x50\x4E\x47\x0D\x0A\x1A\x0A", 1, 8) != 8)
+		return PNG_FILE_ERROR;
 
-	file_write_ul(png, 13);
+	if(file_write_ul(png, 13) != PNG_NO_ERROR)
+		return PNG_FILE_ERROR;
 
 	*p = 'I';			p++;
 	*p = 'H';			p++;
@@ -218,14 +221,13 @@ static int png_write_ihdr(png_t* png)
 	*p = 0;				p++;
 	*p = 0;				p++;
 
-	file_write(png, ihdr, 1, 13+4);
+	if(file_write(png, ihdr, 1, 13+4) != 13+4)
+		return PNG_FILE_ERROR;
 
 	crc = crc32(0L, 0, 0);
 	crc = crc32(crc, ihdr, 13+4);
 
-	file_write_ul(png, crc);
-
-	return PNG_NO_ERROR;
+	return file_write_ul(png, crc);
 }
 
 void png_print_info(png_t* png)
@@ -272,6 +274,8 @@ int png_open_read(png_t* png, png_read_callback_t read_fun, void* user_pointer)
 	result = png_read_ihdr(png);
 
 	png->bpp = (unsigned char)png_get_bpp(png);
+	png->palette_size = 0;
+	png->cancel_fun = 0;
 
 	return result;
 }
@@ -281,6 +285,8 @@ int png_open_write(png_t* png, png_write_callback_t write_fun, void* user_pointe
 	png->write_fun = write_fun;
 	png->read_fun = 0;
 	png->user_pointer = user_pointer;
+	png->palette_size = 0;
+	png->cancel_fun = 0;
 
 	if(!write_fun && !user_pointer)
 		return PNG_WRONG_ARGUMENTS;
@@ -320,7 +326,9 @@ int png_open_file(png_t *png, const char* filename)
 
 int png_close_file(png_t* png)
 {
-	fclose(png->user_pointer);
+	/* fclose flushes buffered output, so a failed write can surface here */
+	if(fclose(png->user_pointer) != 0)
+		return PNG_FILE_ERROR;
 
 	return PNG_NO_ERROR;
 }
@@ -450,6 +458,59 @@ static int png_inflate(png_t* png, unsigned char* data, int len)
 	return PNG_NO_ERROR;
 }
 
+static int png_unfilter_row(png_t* png);
+
+static int png_inflate_rows(png_t* png, unsigned char* data, int len)
+{
+	int result;
+	int rc;
+#if USE_ZLIB
+	z_stream *stream = png->zs;
+#else
+	zl_stream *stream = png->zs;
+#endif
+
+	if(!stream)
+		return PNG_MEMORY_ERROR;
+
+	stream->next_in = data;
+	stream->avail_in = len;
+
+	/* inflate into the one-row buffer, unfiltering each row as it fills up */
+	while(stream->avail_in != 0)
+	{
+#if USE_ZLIB
+		result = inflate(stream, Z_SYNC_FLUSH);
+#else
+		result = z_inflate(stream);
+#endif
+
+		if(result != Z_STREAM_END && result != Z_OK)
+		{
+			printf("%s\n", stream->msg);
+			return PNG_ZLIB_ERROR;
+		}
+
+		if(stream->avail_out == 0)
+		{
+			rc = png_unfilter_row(png);
+			if(rc != PNG_NO_ERROR)
+				return rc;
+
+			stream->next_out = png->png_data;
+			stream->avail_out = png->png_datalen;
+		}
+
+		if(result == Z_STREAM_END)
+			break;
+	}
+
+	if(stream->avail_in != 0)
+		return PNG_ZLIB_ERROR;
+
+	return PNG_NO_ERROR;
+}
+
 static int png_deflate(png_t* png, char* outdata, int outlen, int *outwritten)
 {
 	int result;
@@ -480,30 +541,72 @@ static int png_write_idats(png_t* png, unsigned char* data)
 	unsigned char *chunk;
 	unsigned long written;
 	unsigned long crc;
-	unsigned size = png->width * png->height * png->bpp + png->height;
-	unsigned chunk_size = compressBound(size);
+	unsigned row_size = png->width * png->bpp + 1;
+	unsigned size = row_size * png->height;
+	unsigned chunk_size;
+	unsigned row;
+	int result = Z_OK;
+	z_stream stream;
 
 	(void)png_init_deflate;
 	(void)png_end_deflate;
 	(void)png_deflate;
 
-	chunk = png_alloc(chunk_size + 4);
+	memset(&stream, 0, sizeof(stream));
+	if(deflateInit(&stream, Z_DEFAULT_COMPRESSION) != Z_OK)
+		return PNG_ZLIB_ERROR;
+
+	chunk_size = deflateBound(&stream, size);
+	chunk = png_alloc(chunk_size + 8);
+	if(!chunk)
+	{
+		deflateEnd(&stream);
+		return PNG_MEMORY_ERROR;
+	}
 	memcpy(chunk, "IDAT", 4);
 
-	written = chunk_size;
-	compress(chunk+4, &written, data, size);
+	/* compress PNG_CANCEL_ROWS rows at a time, so a cancel callback is polled regularly */
+	stream.next_out = chunk+4;
+	stream.avail_out = chunk_size;
+	for(row = 0; result == Z_OK; row += PNG_CANCEL_ROWS)
+	{
+		unsigned rows = png->height - row < PNG_CANCEL_ROWS ? png->height - row : PNG_CANCEL_ROWS;
+
+		if(png->cancel_fun && png->cancel_fun(png->cancel_user_pointer))
+		{
+			deflateEnd(&stream);
+			png_free(chunk);
+			return PNG_CANCELLED;
+		}
+
+		/* the output buffer holds all of the output, so finishing ends the stream */
+		stream.next_in = data + (size_t)row * row_size;
+		stream.avail_in = rows * row_size;
+		result = deflate(&stream, row + rows >= png->height ? Z_FINISH : Z_NO_FLUSH);
+		if(result != Z_OK && result != Z_STREAM_END)
+		{
+			deflateEnd(&stream);
+			png_free(chunk);
+			return PNG_ZLIB_ERROR;
+		}
+	}
+	written = chunk_size - stream.avail_out;
+	deflateEnd(&stream);
 
 	crc = crc32(0L, Z_NULL, 0);
 	crc = crc32(crc, chunk, written+4);
 	set_ul(chunk+written+4, crc);
-	file_write_ul(png, written);
-	file_write(png, chunk, 1, written+8);
+	if(file_write_ul(png, written) != PNG_NO_ERROR || file_write(png, chunk, 1, written+8) != written+8)
+	{
+		png_free(chunk);
+		return PNG_FILE_ERROR;
+	}
 	png_free(chunk);
 
-	file_write_ul(png, 0);
-	file_write(png, "IEND", 1, 4);
 	crc = crc32(0L, (const unsigned char *)"IEND", 4);
-	file_write_ul(png, crc);
+	if(file_write_ul(png, 0) != PNG_NO_ERROR || file_write(png, "IEND", 1, 4) != 4
+	   || file_write_ul(png, crc) != PNG_NO_ERROR)
+		return PNG_FILE_ERROR;
 
 	return PNG_NO_ERROR;
 }
@@ -550,9 +653,59 @@ static int png_read_idat(png_t* png, unsigned length)
 	file_read_ul(png);
 #endif
 
+	if(png->row_fun)
+		return png_inflate_rows(png, png->readbuf, length);
+
 	return png_inflate(png, png->readbuf, length);
 }
 
+/* reads the PLTE and tRNS chunks of an indexed png into png->palette */
+static int png_read_palette_chunk(png_t* png, unsigned type, unsigned length)
+{
+	unsigned char chunk[4 + 256 * 3];
+	unsigned i;
+#if DO_CRC_CHECKS
+	unsigned orig_crc;
+	unsigned calc_crc;
+#endif
+
+	if(length > 256 * 3 || (type == *(unsigned int*)"PLTE" && length % 3 != 0))
+		return PNG_CRC_ERROR;
+
+	memcpy(chunk, &type, 4);
+	if(file_read(png, chunk + 4, 1, length) != length)
+		return PNG_FILE_ERROR;
+
+#if DO_CRC_CHECKS
+	file_read_ul(png, &orig_crc);
+
+	calc_crc = crc32(0L, Z_NULL, 0);
+	calc_crc = crc32(calc_crc, chunk, length + 4);
+
+	if(orig_crc != calc_crc)
+		return PNG_CRC_ERROR;
+#else
+	file_read_ul(png);
+#endif
+
+	if(type == *(unsigned int*)"PLTE")
+	{
+		png->palette_size = length / 3;
+		for(i = 0; i < png->palette_size; i++)
+		{
+			memcpy(&png->palette[i * 4], &chunk[4 + i * 3], 3);
+			png->palette[i * 4 + 3] = 255;
+		}
+	}
+	else
+	{
+		for(i = 0; i < length && i < png->palette_size; i++)
+			png->palette[i * 4 + 3] = chunk[4 + i];
+	}
+
+	return PNG_NO_ERROR;
+}
+
 static int png_process_chunk(png_t* png)
 {
 	int result = PNG_NO_ERROR;
@@ -568,7 +721,10 @@ static int png_process_chunk(png_t* png)
 	{
 		if(!png->png_data) /* first IDAT */
 		{
-			png->png_datalen = png->width * png->height * png->bpp + png->height;
+			if(png->row_fun) /* png_get_rows only needs room for one filtered row */
+				png->png_datalen = png->width * png->bpp + 1;
+			else
+				png->png_datalen = png->width * png->height * png->bpp + png->height;
 			png->png_data = png_alloc(png->png_datalen);
 		}
 
@@ -588,6 +744,10 @@ static int png_process_chunk(png_t* png)
 	{
 		return PNG_DONE;
 	}
+	else if(png->color_type == PNG_INDEXED && (type == *(unsigned int*)"PLTE" || type == *(unsigned int*)"tRNS"))
+	{
+		return png_read_palette_chunk(png, type, length);
+	}
 	else
 	{
 		file_read(png, 0, 1, length + 4); /* unknown chunk */
@@ -767,10 +927,104 @@ static int png_unfilter(png_t* png, unsigned char* data)
 	return PNG_NO_ERROR;
 }
 
+static int png_unfilter_row(png_t* png)
+{
+	unsigned i;
+	unsigned rowlen = png->width * png->bpp;
+	unsigned char *filtered = png->png_data + 1;
+	unsigned char *out = png->row_buf + (png->row % 2) * rowlen;
+	unsigned char *prev_line = png->row ? png->row_buf + ((png->row + 1) % 2) * rowlen : 0;
+	int stride = png->bpp;
+
+	if(png->row >= png->height) /* more data than the header says */
+		return PNG_NO_ERROR;
+
+	if(png->depth == 16)
+	{
+		for(i = 0; i < rowlen; i+=2)
+		{
+			*(short*)(filtered+i) = (filtered[i] << 8) | filtered[i+1];
+		}
+	}
+
+	switch(png->png_data[0])
+	{
+	case 0: /* none */
+		memcpy(out, filtered, rowlen);
+		break;
+	case 1: /* sub */
+		png_filter_sub(stride, filtered, out, rowlen);
+		break;
+	case 2: /* up */
+		png_filter_up(stride, filtered, out, prev_line, rowlen);
+		break;
+	case 3: /* average */
+		png_filter_average(stride, filtered, out, prev_line, rowlen);
+		break;
+	case 4: /* paeth */
+		png_filter_paeth(stride, filtered, out, prev_line, rowlen);
+		break;
+	default:
+		return PNG_UNKNOWN_FILTER;
+	}
+
+	png->row_fun(png->row, out, png->row_user_pointer);
+	png->row++;
+
+	return PNG_NO_ERROR;
+}
+
+int png_get_rows(png_t* png, png_row_callback_t row_fun, void* user_pointer)
+{
+	int result = PNG_NO_ERROR;
+
+	png->zs = NULL;
+	png->png_datalen = 0;
+	png->png_data = NULL;
+	png->readbuf = NULL;
+	png->readbuflen = 0;
+	png->row_fun = row_fun;
+	png->row_user_pointer = user_pointer;
+	png->row = 0;
+	png->row_buf = png_alloc(2 * png->width * png->bpp);
+
+	if(!png->row_buf)
+		return PNG_MEMORY_ERROR;
+
+	while(result == PNG_NO_ERROR)
+	{
+		if(png->cancel_fun && png->cancel_fun(png->cancel_user_pointer))
+			result = PNG_CANCELLED;
+		else
+			result = png_process_chunk(png);
+	}
+
+	if (png->readbuf)
+	{
+		png_free(png->readbuf);
+		png->readbuflen = 0;
+	}
+	if (png->zs)
+	{
+		png_end_inflate(png);
+	}
+
+	png_free(png->row_buf);
+	png_free(png->png_data);
+	png->row_buf = NULL;
+	png->row_fun = NULL;
+
+	if(result != PNG_DONE)
+		return result;
+
+	return png->row == png->height ? PNG_NO_ERROR : PNG_EOF_ERROR;
+}
+
 int png_get_data(png_t* png, unsigned char* data)
 {
 	int result = PNG_NO_ERROR;
 
+	png->row_fun = NULL;
 	png->zs = NULL;
 	png->png_datalen = 0;
 	png->png_data = NULL;
@@ -779,7 +1033,10 @@ int png_get_data(png_t* png, unsigned char* data)
 
 	while(result == PNG_NO_ERROR)
 	{
-		result = png_process_chunk(png);
+		if(png->cancel_fun && png->cancel_fun(png->cancel_user_pointer))
+			result = PNG_CANCELLED;
+		else
+			result = png_process_chunk(png);
 	}
 
 	if (png->readbuf)
@@ -805,10 +1062,62 @@ int png_get_data(png_t* png, unsigned char* data)
 	return result;
 }
 
+/* writes the PLTE chunk (and the tRNS chunk, if needed) of an indexed png */
+static int png_write_palette(png_t* png)
+{
+	unsigned char chunk[4 + 256 * 3];
+	unsigned i;
+	unsigned num_alpha = 0;
+	unsigned crc;
+
+	memcpy(chunk, "PLTE", 4);
+	for(i = 0; i < png->palette_size; i++)
+	{
+		memcpy(&chunk[4 + i * 3], &png->palette[i * 4], 3);
+		if(png->palette[i * 4 + 3] != 255)
+			num_alpha = i + 1;	/* entries after the last translucent one default to opaque */
+	}
+
+	crc = crc32(0L, Z_NULL, 0);
+	crc = crc32(crc, chunk, 4 + png->palette_size * 3);
+	if(file_write_ul(png, png->palette_size * 3) != PNG_NO_ERROR
+	   || file_write(png, chunk, 1, 4 + png->palette_size * 3) != 4 + png->palette_size * 3
+	   || file_write_ul(png, crc) != PNG_NO_ERROR)
+		return PNG_FILE_ERROR;
+
+	if(num_alpha == 0)
+		return PNG_NO_ERROR;
+
+	memcpy(chunk, "tRNS", 4);
+	for(i = 0; i < num_alpha; i++)
+		chunk[4 + i] = png->palette[i * 4 + 3];
+
+	crc = crc32(0L, Z_NULL, 0);
+	crc = crc32(crc, chunk, 4 + num_alpha);
+	if(file_write_ul(png, num_alpha) != PNG_NO_ERROR
+	   || file_write(png, chunk, 1, 4 + num_alpha) != 4 + num_alpha
+	   || file_write_ul(png, crc) != PNG_NO_ERROR)
+		return PNG_FILE_ERROR;
+
+	return PNG_NO_ERROR;
+}
+
+int png_set_palette(png_t* png, const unsigned char* rgba, unsigned num_colors)
+{
+	if(num_colors < 1 || num_colors > 256)
+		return PNG_WRONG_ARGUMENTS;
+
+	memcpy(png->palette, rgba, num_colors * 4);
+	png->palette_size = num_colors;
+
+	return PNG_NO_ERROR;
+}
+
 int png_set_data(png_t* png, unsigned width, unsigned height, char depth, int color, unsigned char* data)
 {
 	//int i;
 	unsigned i;
+	int result;
 	unsigned char *filtered;
 	png->width = width;
 	png->height = height;
@@ -817,6 +1126,8 @@ int png_set_data(png_t* png, unsigned width, unsigned height, char depth, int co
 	png->bpp = png_get_bpp(png);
 
 	filtered = png_alloc(width * height * png->bpp + height);
+	if(!filtered)
+		return PNG_MEMORY_ERROR;
 
 	for(i = 0; i < png->height; i++)
 	{
@@ -825,11 +1136,22 @@ int png_set_data(png_t* png, unsigned width, unsigned height, char depth, int co
 	}
 
 	png_filter(png, filtered);
-	png_write_ihdr(png);
-	png_write_idats(png, filtered);
+	result = png_write_ihdr(png);
+	if(result == PNG_NO_ERROR && png->color_type == PNG_INDEXED)
+		result = png_write_palette(png);
+	if(result == PNG_NO_ERROR)
+		result = png_write_idats(png, filtered);
 
 	png_free(filtered);
 
+	return result;
+}
+
+int png_set_cancel(png_t* png, png_cancel_callback_t cancel_fun, void* user_pointer)
+{
+	png->cancel_fun = cancel_fun;
+	png->cancel_user_pointer = user_pointer;
+
 	return PNG_NO_ERROR;
 }
 
@@ -859,6 +1181,8 @@ char* png_error_string(int error)
 		return "PNG done";
 	case PNG_NOT_SUPPORTED:
 		return "The PNG is unsupported by pnglite, too bad for you!";
+	case PNG_CANCELLED:
+		return "The operation was cancelled.";
 	case PNG_WRONG_ARGUMENTS:
 		return "Wrong combination of arguments passed to png_open. You must use either a read_function or supply a file pointer to use.";
 	default:
@@ -57,7 +57,8 @@ enum
 	PNG_ZLIB_ERROR			= -7,
 	PNG_UNKNOWN_FILTER		= -8,
 	PNG_NOT_SUPPORTED		= -9,
-	PNG_WRONG_ARGUMENTS		= -10
+	PNG_WRONG_ARGUMENTS		= -10,
+	PNG_CANCELLED			= -11
 };
 
 /*
@@ -80,7 +81,9 @@ enum
 typedef unsigned (*png_write_callback_t)(void* input, size_t size, size_t numel, void* user_pointer);
 typedef unsigned (*png_read_callback_t)(void* output, size_t size, size_t numel, void* user_pointer);
 typedef void (*png_free_t)(void* p);
+typedef void (*png_row_callback_t)(unsigned row, const unsigned char* data, void* user_pointer);
 typedef void * (*png_alloc_t)(size_t s);
+typedef int (*png_cancel_callback_t)(void* user_pointer);
 
 typedef struct
 {
@@ -103,6 +106,15 @@ typedef struct
 
 	unsigned char*			readbuf;
 	unsigned			readbuflen;
+
+	png_row_callback_t		row_fun;		/* set while png_get_rows is decoding */
+	void*				row_user_pointer;
+	unsigned char*			row_buf;		/* current and previous unfiltered rows */
+	unsigned			row;			/* index of the next row to decode */
+	unsigned char			palette[256 * 4];	/* RGBA entries of an indexed png (PLTE and tRNS) */
+	unsigned			palette_size;
+	png_cancel_callback_t		cancel_fun;		/* polled between chunks and row bands, may be 0 */
+	void*				cancel_user_pointer;
 } png_t;
 
 /*
@@ -215,8 +227,63 @@ char* png_error_string(int error);
 
 int png_get_data(png_t* png, unsigned char* data);
 
+/*
+	Function: png_get_rows
+
+	This function decodes the opened png file one row at a time, calling row_fun with the index and the
+	unfiltered data (width*(bytes per pixel) bytes) of each row in order. Only two rows are kept in memory,
+	so a large image can be processed without storing all of its pixels. The row data is only valid until
+	row_fun returns.
+
+	Parameters:
+		row_fun - Callback receiving each row.
+		user_pointer - User pointer to be passed to row_fun.
+
+	Returns:
+		PNG_NO_ERROR on success, otherwise an error code.
+*/
+
+int png_get_rows(png_t* png, png_row_callback_t row_fun, void* user_pointer);
+
 int png_set_data(png_t* png, unsigned width, unsigned height, char depth, int color, unsigned char* data);
 
+/*
+	Function: png_set_cancel
+
+	This function sets a callback that png_get_data and png_get_rows call before each chunk they read, and
+	png_set_data calls before compressing each band of rows. When it returns nonzero, the operation stops
+	and returns PNG_CANCELLED. png_open_read and png_open_write clear the callback.
+
+	Parameters:
+		png - png struct opened for reading or writing.
+		cancel_fun - Callback returning nonzero to cancel, or 0 for none.
+		user_pointer - User pointer to be passed to cancel_fun.
+
+	Returns:
+		PNG_NO_ERROR
+*/
+
+int png_set_cancel(png_t* png, png_cancel_callback_t cancel_fun, void* user_pointer);
+
+/*
+	Function: png_set_palette
+
+	This function sets the palette of an indexed (PNG_INDEXED, depth 8) png to be written with png_set_data.
+	The palette is written as a PLTE chunk, followed by a tRNS chunk if any entry is not fully opaque.
+	When reading an indexed png, the palette (with an alpha of 255 for entries tRNS doesn't cover) is
+	available in png->palette and png->palette_size once png_get_data or png_get_rows has returned.
+
+	Parameters:
+		png - png struct opened for writing.
+		rgba - num_colors entries of 4 bytes each: red, green, blue, and alpha.
+		num_colors - Number of palette entries (1 to 256).
+
+	Returns:
+		PNG_NO_ERROR on success, otherwise an error code.
+*/
+
+int png_set_palette(png_t* png, const unsigned char* rgba, unsigned num_colors);
+
 /*
 	Function: png_close_file
 
@@ -226,7 +293,7 @@ int png_set_data(png_t* png, unsigned width, unsigned height, char depth, int co
 		png - png to close.
 
 	Returns:
-		PNG_NO_ERROR
+		PNG_NO_ERROR on success, PNG_FILE_ERROR if buffered data couldn't be written.
 */
 
 int png_close_file(png_t* png);
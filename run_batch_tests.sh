@@ -0,0 +1,130 @@
+#! /usr/bin/env bash
+
+# Run the shard command of c_imgproc or asm_imgproc on small manifests
+# and check that crashed workers are detected and replaced, and that
+# an interrupted run resumes from its checkpoint file.
+
+error_count="0"
+
+check() {
+  local description="$1"
+  shift
+  echo -n "Checking ${description}..."
+  if "$@"; then
+    echo "passed"
+  else
+    echo "FAILED"
+    error_count=$((${error_count} + 1))
+  fi
+}
+
+# check that a file contains a line matching a pattern
+contains() {
+  grep -q -- "$2" "$1"
+}
+
+if [[ $# -ne 1 ]]; then
+  >&2 echo "Usage: ./run_batch_tests.sh <exe_version>"
+  >&2 echo "  <exe_version> is either 'c' or 'asm'"
+  exit 1
+fi
+
+exe="./$1_imgproc"
+if [[ ! -x ${exe} ]]; then
+  >&2 echo "${exe} doesn't exist or is not executable (maybe you need to run make?)"
+  exit 1
+fi
+
+work=$(mktemp -d /tmp/imgproc_batch_tests_XXXXXX)
+trap 'rm -rf ${work}' EXIT
+
+# job 1 reads a FIFO, so its worker blocks until the FIFO is opened
+# for writing; that's when the worker is killed
+mkfifo ${work}/stall.png
+cat > ${work}/manifest.txt <<EOF
+# shard test jobs
+rotate input/dice.png ${work}/out0.png 90
+rotate ${work}/stall.png ${work}/out1.png 90
+
+squash input/dice.png ${work}/out2.png 2 2
+flip input/dice.png ${work}/out3.png h
+EOF
+
+# a killed worker is reported, and a new one runs the remaining jobs
+${exe} shard ${work}/manifest.txt 1 ${work}/checkpoint.txt 2> ${work}/crash.err &
+coordinator=$!
+worker=""
+for attempt in $(seq 100); do
+  worker=$(pgrep -P ${coordinator})
+  [[ -n ${worker} ]] && break
+  sleep 0.1
+done
+timeout 10 bash -c "exec 3> ${work}/stall.png && kill -KILL ${worker}"
+wait ${coordinator}
+status=$?
+check "that a run with a killed worker fails" test ${status} -ne 0
+check "that the killed worker is reported" contains ${work}/crash.err "worker crashed (signal 9) running 'rotate ${work}/stall.png'"
+check "the crash summary" contains ${work}/crash.err "3 of 4 jobs succeeded .*0 failed, 1 crashed"
+check "that the other jobs completed" test -f ${work}/out0.png -a -f ${work}/out2.png -a -f ${work}/out3.png
+check "the checkpointed jobs" test "$(cut -d' ' -f1 ${work}/checkpoint.txt | sort | tr '\n' ' ')" = "0 2 3 "
+
+# the rerun only runs the job that crashed
+rm ${work}/stall.png ${work}/out0.png
+cp input/dice.png ${work}/stall.png
+${exe} shard ${work}/manifest.txt 2 ${work}/checkpoint.txt 2> ${work}/resume.err
+check "that the resumed run succeeds" test $? -eq 0
+check "the resume summary" contains ${work}/resume.err "4 of 4 jobs succeeded .*(3 resumed from checkpoint"
+check "that the crashed job ran" test -f ${work}/out1.png
+check "that checkpointed jobs didn't run again" test ! -f ${work}/out0.png
+
+# a partly written last line doesn't count, and doesn't swallow the
+# next line written
+grep -e '^0 ' -e '^1 ' ${work}/checkpoint.txt > ${work}/partial.txt
+echo -n "$(grep '^3 ' ${work}/checkpoint.txt | head -c 10)" >> ${work}/partial.txt
+${exe} shard ${work}/manifest.txt 2 ${work}/partial.txt 2> ${work}/partial.err
+check "that the run after a partial line succeeds" test $? -eq 0
+check "the partial line summary" contains ${work}/partial.err "4 of 4 jobs succeeded .*(2 resumed from checkpoint"
+${exe} shard ${work}/manifest.txt 2 ${work}/partial.txt 2> ${work}/partial2.err
+check "that the jobs after a partial line are checkpointed" contains ${work}/partial2.err "(4 resumed from checkpoint"
+
+# jobs are logged with their dimensions, result and arguments
+IMGPROC_JOB_LOG=${work}/jobs.log ${exe} squash input/dice.png ${work}/log0.png 2 3
+IMGPROC_JOB_LOG=${work}/jobs.log ${exe} blur input/ingo.png ${work}/log1.png 2 --palette
+IMGPROC_JOB_LOG=${work}/jobs.log ${exe} squash input/dice.png ${work}/no_such_dir/log2.png 1 1 2> /dev/null
+check "the number of logged jobs" test "$(wc -l < ${work}/jobs.log)" -eq 3
+check "a logged job" contains ${work}/jobs.log "^squash 800 600 400 200 [0-9.]* [0-9.]* [0-9.]* 0 2 3$"
+check "a logged job with --palette" contains ${work}/jobs.log "^blur 552 552 552 552 .* 0 2 --palette$"
+check "a logged failure" contains ${work}/jobs.log "^squash 800 600 800 600 .* 1 1 1$"
+
+# the replay runs the successful jobs and reports malformed lines
+cp ${work}/jobs.log ${work}/replay.log
+cat >> ${work}/replay.log <<EOF
+
+rotate 64 48 48 64 0.1 0.2 0.3 0 90
+rotate 64 48
+rotate x 48 48 64 0.1 0.2 0.3 0 90
+rotate 0 48 48 64 0.1 0.2 0.3 0 90
+rotate 64 48 48 64 0.1 0.2 0.3 2 90
+rotate 64 48 48 64 0.1 0.2 0.3 0 90 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17
+EOF
+printf 'rotate 64 48 48 64 0.1 0.2 0.3 0 90 %05000d\n' 0 >> ${work}/replay.log
+IMGPROC_JOB_LOG=${work}/jobs.log ${exe} replay ${work}/replay.log 2 > ${work}/replay.out 2> ${work}/replay.err
+check "that the replay succeeds" test $? -eq 0
+check "the replay summary" contains ${work}/replay.out "^3 jobs x 2 (1 skipped, 6 malformed, 0 failed)"
+check "the replay percentiles" contains ${work}/replay.out "^replayed "
+check "the malformed line warnings" test "$(grep -c 'Warning: job log line' ${work}/replay.err)" -eq 6
+check "the too long line warning" contains ${work}/replay.err "line 11 is too long"
+check "that replayed jobs aren't logged" test "$(wc -l < ${work}/jobs.log)" -eq 3
+
+# a log without any jobs to replay
+echo "rotate 64 48" > ${work}/empty.log
+${exe} replay ${work}/empty.log > /dev/null 2> ${work}/empty.err
+check "that replaying no jobs fails" test $? -ne 0
+
+if [[ ${error_count} -eq 0 ]]; then
+  echo "All tests passed!"
+  exit 0
+else
+  echo "${error_count} test(s) failed"
+  exit 1
+fi